@@ -0,0 +1,198 @@
+#include "color_management.h"
+#include "mock_compositor.h"
+
+#include <QFile>
+#include <QGuiApplication>
+#include <QQuickWindow>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <memory>
+
+#include <wayland-client-protocol.h>
+
+namespace {
+    constexpr int REFERENCE_LUMINANCE = 203;
+    constexpr int OTHER_REFERENCE_LUMINANCE = 100;
+}
+
+// ColorManagementSurface against MockCompositor, through Qt's Wayland platform like in the viewer
+class ColorManagementTest : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ColorManagementTest(MockCompositor &compositor)
+        : m_compositor(compositor)
+    {
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        auto waylandApp = qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>();
+        QVERIFY(waylandApp);
+        m_display = waylandApp->display();
+
+        m_global = std::make_unique<ColorManagementGlobal>();
+        QTRY_VERIFY(m_global->isActive());
+        // The supported features follow the bind
+        wl_display_roundtrip(m_display);
+        QVERIFY(m_global->supportsPQ());
+
+        m_wlSurface = wl_compositor_create_surface(waylandApp->compositor());
+        QVERIFY(m_wlSurface);
+    }
+
+    void cleanupTestCase()
+    {
+        m_global.reset();
+        wl_surface_destroy(m_wlSurface);
+        wl_display_roundtrip(m_display);
+    }
+
+    void init()
+    {
+        m_compositor.setAutoReady(true);
+        m_surface = std::make_unique<ColorManagementSurface>(m_global.get(), &m_window,
+                                                             m_global->get_surface(m_wlSurface), nullptr);
+    }
+
+    void cleanup()
+    {
+        // A wl_surface has at most one color management surface at a time
+        m_surface.reset();
+        wl_display_roundtrip(m_display);
+        m_compositor.clearApplied();
+    }
+
+    // Switching back to parameters used before applies the cached description in the same call
+    void sameKeyReusesDescription()
+    {
+        const int first = m_compositor.descriptionCount();
+
+        m_surface->setPQMode(REFERENCE_LUMINANCE);
+        settle();
+        m_surface->setPQMode(OTHER_REFERENCE_LUMINANCE);
+        settle();
+        QCOMPARE(m_compositor.descriptionCount(), first + 2);
+
+        // A description created now would never become ready
+        m_compositor.setAutoReady(false);
+        m_surface->setPQMode(REFERENCE_LUMINANCE);
+        wl_display_roundtrip(m_display);
+
+        QCOMPARE(m_compositor.descriptionCount(), first + 2);
+        const QList<MockCompositor::Description> applied = m_compositor.appliedDescriptions();
+        QCOMPARE(applied.size(), 3);
+        QCOMPARE(applied[0].index, first);
+        QCOMPARE(applied[1].index, first + 1);
+        QCOMPARE(applied[2].index, first);
+        QCOMPARE(applied[2].referenceLuminance, uint32_t(REFERENCE_LUMINANCE));
+        QCOMPARE(applied[2].transferFunction, uint32_t(WP_COLOR_MANAGER_V1_TRANSFER_FUNCTION_ST2084_PQ));
+    }
+
+    // A prepared description is ready by the time it is requested
+    void preparedDescriptionAppliesRightAway()
+    {
+        const int first = m_compositor.descriptionCount();
+
+        m_surface->preparePQMode(REFERENCE_LUMINANCE);
+        settle();
+        QVERIFY(m_compositor.appliedDescriptions().isEmpty());
+
+        m_compositor.setAutoReady(false);
+        m_surface->setPQMode(REFERENCE_LUMINANCE);
+        wl_display_roundtrip(m_display);
+
+        QCOMPARE(m_compositor.descriptionCount(), first + 1);
+        const QList<MockCompositor::Description> applied = m_compositor.appliedDescriptions();
+        QCOMPARE(applied.size(), 1);
+        QCOMPARE(applied[0].index, first);
+    }
+
+    // A ready event for a request that was superseded in the meantime must not override the newer one
+    void staleReadyIsNotApplied()
+    {
+        m_compositor.setAutoReady(false);
+        const int first = m_compositor.descriptionCount();
+
+        // The older description becomes ready first
+        m_surface->setPQMode(REFERENCE_LUMINANCE);
+        m_surface->setPQMode(OTHER_REFERENCE_LUMINANCE);
+        wl_display_roundtrip(m_display);
+        QCOMPARE(m_compositor.descriptionCount(), first + 2);
+
+        m_compositor.sendReady(first);
+        settle();
+        QVERIFY(m_compositor.appliedDescriptions().isEmpty());
+
+        m_compositor.sendReady(first + 1);
+        settle();
+        QList<MockCompositor::Description> applied = m_compositor.appliedDescriptions();
+        QCOMPARE(applied.size(), 1);
+        QCOMPARE(applied[0].index, first + 1);
+        QCOMPARE(applied[0].referenceLuminance, uint32_t(OTHER_REFERENCE_LUMINANCE));
+
+        // The older description becomes ready after the newer one was applied
+        m_compositor.clearApplied();
+        m_surface->setPQMode(REFERENCE_LUMINANCE + 1);
+        m_surface->setPQMode(OTHER_REFERENCE_LUMINANCE + 1);
+        wl_display_roundtrip(m_display);
+        QCOMPARE(m_compositor.descriptionCount(), first + 4);
+
+        m_compositor.sendReady(first + 3);
+        settle();
+        m_compositor.sendReady(first + 2);
+        settle();
+        applied = m_compositor.appliedDescriptions();
+        QCOMPARE(applied.size(), 1);
+        QCOMPARE(applied[0].index, first + 3);
+
+        // Switching to the default also supersedes a pending description
+        m_compositor.clearApplied();
+        m_surface->setPQMode(REFERENCE_LUMINANCE + 2);
+        m_surface->setColorMode(ColorManagementSurface::ColorMode::Default);
+        wl_display_roundtrip(m_display);
+        m_compositor.sendReady(first + 4);
+        settle();
+        applied = m_compositor.appliedDescriptions();
+        QCOMPARE(applied.size(), 1);
+        QCOMPARE(applied[0].index, MockCompositor::UNSET);
+    }
+
+private:
+    // Twice: the first round-trip delivers the compositor's events, the second one the requests the
+    // client sent in response
+    void settle()
+    {
+        wl_display_roundtrip(m_display);
+        wl_display_roundtrip(m_display);
+    }
+
+    MockCompositor &m_compositor;
+    wl_display *m_display = nullptr;
+    wl_surface *m_wlSurface = nullptr;
+    // Never shown, only asked for updates
+    QQuickWindow m_window;
+    std::unique_ptr<ColorManagementGlobal> m_global;
+    std::unique_ptr<ColorManagementSurface> m_surface;
+};
+
+int main(int argc, char *argv[])
+{
+    // The compositor has to listen before the application connects
+    QTemporaryDir runtimeDirectory;
+    if (qEnvironmentVariableIsEmpty("XDG_RUNTIME_DIR")) {
+        qputenv("XDG_RUNTIME_DIR", QFile::encodeName(runtimeDirectory.path()));
+    }
+    MockCompositor compositor;
+    qputenv("WAYLAND_DISPLAY", compositor.socketName());
+    qputenv("QT_QPA_PLATFORM", "wayland");
+
+    QGuiApplication app(argc, argv);
+    ColorManagementTest test(compositor);
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "color_management_test.moc"
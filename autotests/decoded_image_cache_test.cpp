@@ -0,0 +1,101 @@
+#include "decoded_image_cache.h"
+#include "memory_budget.h"
+
+#include <QFile>
+#include <QImage>
+#include <QTemporaryDir>
+#include <QTest>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    constexpr QSize FRAME_SIZE(512, 512);
+    constexpr int FRAMES_IN_BUDGET = 3;
+}
+
+class DecodedImageCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        m_frameBytes = QImage(FRAME_SIZE, QImage::Format_RGBA8888_Premultiplied).sizeInBytes();
+        MemoryBudget::instance().setLimit(FRAMES_IN_BUDGET * m_frameBytes);
+        // Registers the evictor
+        DecodedImageCache::instance();
+    }
+
+    // The oldest entry is on screen and the next one still held by an item, so a prefetch that needs room
+    // has to take the newest one
+    void evictionSkipsPinnedAndSharedFrames()
+    {
+        auto &cache = DecodedImageCache::instance();
+        cache.insert(u"/pinned.png"_s, makeFrame());
+        DecodedFrame shown = makeFrame();
+        cache.insert(u"/shown.png"_s, shown);
+        cache.insert(u"/unused.png"_s, makeFrame());
+        cache.setPinned(u"/pinned.png"_s);
+
+        const auto reservation = MemoryBudget::instance().reserve(m_frameBytes, MemoryBudget::Priority::Prefetch);
+        QVERIFY(reservation);
+        QVERIFY(cache.contains(u"/pinned.png"_s));
+        QVERIFY(cache.contains(u"/shown.png"_s));
+        QVERIFY(!cache.contains(u"/unused.png"_s));
+
+        // Nothing left that would free memory
+        QVERIFY(!MemoryBudget::instance().reserve(m_frameBytes, MemoryBudget::Priority::Display));
+        QVERIFY(cache.contains(u"/pinned.png"_s));
+        QVERIFY(cache.contains(u"/shown.png"_s));
+    }
+
+    // A file rewritten in place no longer gets the frame decoded from its previous content
+    void changedFileIsStale()
+    {
+        QTemporaryDir directory;
+        const QString localPath = directory.filePath(u"grade.png"_s);
+        QVERIFY(writeFile(localPath, "first"));
+
+        auto &cache = DecodedImageCache::instance();
+        cache.setPinned(localPath);
+        DecodedFrame frame = makeFrame();
+        frame.fileKey = ProbeCache::keyForFile(localPath);
+        cache.insert(localPath, frame);
+        frame = {};
+        QVERIFY(cache.contains(localPath));
+        QVERIFY(!cache.find(localPath).isNull());
+
+        QVERIFY(writeFile(localPath, "second export"));
+        QVERIFY(!cache.contains(localPath));
+        QVERIFY(cache.find(localPath).isNull());
+        // The new version is cached again, even at a lower resolution than the stale one
+        DecodedFrame smaller = makeFrame(FRAME_SIZE / 2);
+        smaller.fileKey = ProbeCache::keyForFile(localPath);
+        cache.insert(localPath, smaller);
+        QVERIFY(cache.contains(localPath));
+
+        cache.setPinned({});
+    }
+
+private:
+    DecodedFrame makeFrame(const QSize &size = FRAME_SIZE) const
+    {
+        DecodedFrame frame;
+        frame.levels = {QImage(size, QImage::Format_RGBA8888_Premultiplied)};
+        frame.fullSize = size;
+        frame.memory = MemoryBudget::instance().reserve(frame.levels.first().sizeInBytes(), MemoryBudget::Priority::Display);
+        return frame;
+    }
+
+    static bool writeFile(const QString &path, QByteArrayView content)
+    {
+        QFile file(path);
+        return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(content.data(), content.size()) == content.size();
+    }
+
+    qint64 m_frameBytes = 0;
+};
+
+QTEST_GUILESS_MAIN(DecodedImageCacheTest)
+
+#include "decoded_image_cache_test.moc"
@@ -0,0 +1,125 @@
+#include "file_detector.h"
+#include "synthetic_corpus.h"
+#include "tiff_reader.h"
+
+#include <QTest>
+#include <QtEndian>
+
+#include <limits>
+
+Q_DECLARE_METATYPE(FileDetector::ImageFormat)
+
+namespace {
+    // A typical phone photo, its 2x2 grid tiles are 2016x1512
+    constexpr QSize PHOTO_SIZE(4032, 3024);
+
+    constexpr quint16 TIFF_TYPE_LONG = 4;
+    constexpr quint16 TIFF_TYPE_UNDEFINED = 7;
+    constexpr quint32 TIFF_WIDTH = 640;
+
+    template<typename T>
+    void appendLittleEndian(QByteArray &out, T value)
+    {
+        char bytes[sizeof(T)];
+        qToLittleEndian(value, bytes);
+        out.append(bytes, sizeof(T));
+    }
+
+    // Little-endian BigTIFF with a single IFD right after the header: the given entry count, the width
+    // and an ICC profile entry with the given count and offset
+    QByteArray bigTiff(quint64 entryCount, quint64 profileCount, quint64 profileOffset)
+    {
+        QByteArray data("II");
+        appendLittleEndian<quint16>(data, 43);
+        appendLittleEndian<quint16>(data, 8);
+        appendLittleEndian<quint16>(data, 0);
+        appendLittleEndian<quint64>(data, 16);
+
+        appendLittleEndian<quint64>(data, entryCount);
+        appendLittleEndian<quint16>(data, TiffReader::TAG_IMAGE_WIDTH);
+        appendLittleEndian<quint16>(data, TIFF_TYPE_LONG);
+        appendLittleEndian<quint64>(data, 1);
+        appendLittleEndian<quint64>(data, TIFF_WIDTH);
+        appendLittleEndian<quint16>(data, TiffReader::TAG_ICC_PROFILE);
+        appendLittleEndian<quint16>(data, TIFF_TYPE_UNDEFINED);
+        appendLittleEndian<quint64>(data, profileCount);
+        appendLittleEndian<quint64>(data, profileOffset);
+        // No next IFD, then some room the offsets may point into
+        appendLittleEndian<quint64>(data, 0);
+        data.append(256, '\0');
+        return data;
+    }
+}
+
+class FileDetectorTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    // Size, rotation and color are the primary item's, not the first ones in the file
+    void probeIsoMedia_data()
+    {
+        QTest::addColumn<FileDetector::ImageFormat>("format");
+        QTest::addColumn<bool>("hdr");
+        QTest::addColumn<bool>("grid");
+        QTest::addColumn<bool>("rotated");
+
+        for (const auto format : {FileDetector::ImageFormat::AVIF, FileDetector::ImageFormat::HEIC}) {
+            for (const bool hdr : {true, false}) {
+                const char *formatName = FileDetector::formatName(format);
+                const char *range = hdr ? "hdr" : "sdr";
+                QTest::addRow("%s-%s", formatName, range) << format << hdr << false << false;
+                QTest::addRow("%s-%s-grid", formatName, range) << format << hdr << true << false;
+                QTest::addRow("%s-%s-rotated", formatName, range) << format << hdr << false << true;
+                QTest::addRow("%s-%s-grid-rotated", formatName, range) << format << hdr << true << true;
+            }
+        }
+    }
+    void probeIsoMedia()
+    {
+        QFETCH(FileDetector::ImageFormat, format);
+        QFETCH(bool, hdr);
+        QFETCH(bool, grid);
+        QFETCH(bool, rotated);
+
+        const QByteArray data = SyntheticCorpus::isoMedia(format, {.size = PHOTO_SIZE, .hdr = hdr, .grid = grid, .rotated = rotated});
+        FileDetector::ImageProbe probe;
+        FileDetector::probeIsoMedia(data, probe);
+
+        QCOMPARE(probe.size, PHOTO_SIZE);
+        QCOMPARE(probe.isHDR, hdr);
+        QCOMPARE(probe.transfer, hdr ? FileDetector::TransferFunction::PQ : FileDetector::TransferFunction::SRGB);
+        QCOMPARE(probe.primaries, hdr ? FileDetector::ColorPrimaries::BT2020 : FileDetector::ColorPrimaries::BT709);
+        QCOMPARE(probe.transformations, QImageIOHandler::Transformations(rotated ? QImageIOHandler::TransformationRotate270 : QImageIOHandler::TransformationNone));
+        QCOMPARE(probe.displaySize(), rotated ? PHOTO_SIZE.transposed() : PHOTO_SIZE);
+    }
+
+    // Counts and offsets near the 64 bit limits neither hang nor read out of bounds
+    void probeTiffHugeCounts_data()
+    {
+        QTest::addColumn<QByteArray>("data");
+        QTest::addColumn<bool>("entriesRead");
+
+        // Times the entry size, this count wraps around to a single entry
+        QTest::newRow("entry-count") << bigTiff((quint64(1) << 62) + 1, 0, 0) << false;
+        QTest::newRow("entry-count-negative") << bigTiff(~quint64(0), 0, 0) << false;
+        QTest::newRow("icc-count") << bigTiff(2, std::numeric_limits<qint64>::max(), 64) << true;
+        QTest::newRow("icc-count-negative") << bigTiff(2, ~quint64(0), 64) << true;
+        QTest::newRow("icc-offset") << bigTiff(2, 16, std::numeric_limits<qint64>::max() - 8) << true;
+    }
+    void probeTiffHugeCounts()
+    {
+        QFETCH(QByteArray, data);
+        QFETCH(bool, entriesRead);
+
+        FileDetector::ImageProbe probe;
+        FileDetector::probeTiff(data, probe);
+
+        QCOMPARE(probe.size.width() == int(TIFF_WIDTH), entriesRead);
+        QVERIFY(!probe.isHDR);
+    }
+};
+
+QTEST_GUILESS_MAIN(FileDetectorTest)
+
+#include "file_detector_test.moc"
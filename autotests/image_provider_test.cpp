@@ -0,0 +1,80 @@
+#include "image_provider.h"
+
+#include <QImage>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QUrl>
+
+#include <memory>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    // Large enough that a decode takes far longer than issuing the next request
+    constexpr QSize IMAGE_SIZE(2048, 2048);
+    constexpr int DECODE_TIMEOUT_MS = 30 * 1000;
+    constexpr QLatin1StringView SUPERSEDED("Decode request was superseded");
+}
+
+class ImageProviderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        // Decodes may write freedesktop thumbnails
+        QStandardPaths::setTestModeEnabled(true);
+        QVERIFY(m_directory.isValid());
+        for (const QString &name : {u"a1"_s, u"a2"_s, u"b"_s}) {
+            QImage image(IMAGE_SIZE, QImage::Format_RGB32);
+            image.fill(Qt::darkCyan);
+            QVERIFY(image.save(m_directory.filePath(name + u".png")));
+        }
+    }
+
+    void idRoundTrip()
+    {
+        const QUrl source = QUrl::fromLocalFile(m_directory.filePath(QStringLiteral("a1.png")));
+        QCOMPARE(ImageProvider::localPathFromId(ImageProvider::idForSource(source)), source.toLocalFile());
+        QCOMPARE(ImageProvider::localPathFromId(ImageProvider::idForSource(source, 42)), source.toLocalFile());
+    }
+
+    // A pinned item (B) keeps decoding while another item (A) navigates twice
+    void otherConsumerDoesNotSupersede()
+    {
+        ImageProvider provider;
+        const quint64 consumerA = ImageProvider::createConsumerId();
+        const quint64 consumerB = ImageProvider::createConsumerId();
+
+        std::unique_ptr<QQuickImageResponse> b(provider.requestImageResponse(idFor(u"b.png", consumerB), {}));
+        std::unique_ptr<QQuickImageResponse> a1(provider.requestImageResponse(idFor(u"a1.png", consumerA), {}));
+        std::unique_ptr<QQuickImageResponse> a2(provider.requestImageResponse(idFor(u"a2.png", consumerA), {}));
+
+        // Responses finish through queued calls, so nothing is emitted before the spies exist
+        QSignalSpy bFinished(b.get(), &QQuickImageResponse::finished);
+        QSignalSpy a1Finished(a1.get(), &QQuickImageResponse::finished);
+        QSignalSpy a2Finished(a2.get(), &QQuickImageResponse::finished);
+        QTRY_VERIFY_WITH_TIMEOUT(bFinished.count() == 1 && a1Finished.count() == 1 && a2Finished.count() == 1, DECODE_TIMEOUT_MS);
+
+        QCOMPARE(b->errorString(), QString());
+        QCOMPARE(static_cast<ImageResponse *>(b.get())->frame().fullSize, IMAGE_SIZE);
+        // A newer request of the same item still supersedes its older one
+        QCOMPARE(a1->errorString(), QString(SUPERSEDED));
+        QCOMPARE(a2->errorString(), QString());
+    }
+
+private:
+    QString idFor(QStringView fileName, quint64 consumerId) const
+    {
+        return ImageProvider::idForSource(QUrl::fromLocalFile(m_directory.filePath(fileName.toString())), consumerId);
+    }
+
+    QTemporaryDir m_directory;
+};
+
+QTEST_GUILESS_MAIN(ImageProviderTest)
+
+#include "image_provider_test.moc"
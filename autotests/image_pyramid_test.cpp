@@ -0,0 +1,57 @@
+#include "image_pyramid.h"
+
+#include <QColor>
+#include <QImage>
+#include <QTest>
+
+#include <cstdlib>
+
+// Opaque black next to half transparent white, in 2x2 blocks
+class ImagePyramidTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void downsampleMixedAlpha_data()
+    {
+        QTest::addColumn<bool>("premultiplied");
+        QTest::addColumn<QColor>("expected");
+
+        // Averaged in linear light with alpha 0.75: a third of linear white, sRGB code 156
+        QTest::newRow("straight") << false << QColor(156, 156, 156, 191);
+        // The same color premultiplied by the averaged alpha
+        QTest::newRow("premultiplied") << true << QColor(117, 117, 117, 191);
+    }
+    void downsampleMixedAlpha()
+    {
+        QFETCH(bool, premultiplied);
+        QFETCH(QColor, expected);
+        const QImage::Format format = premultiplied ? QImage::Format_RGBA8888_Premultiplied : QImage::Format_RGBA8888;
+
+        QImage image(4, 4, QImage::Format_RGBA8888);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                image.setPixelColor(x, y, (x + y) % 2 ? QColor(255, 255, 255, 128) : QColor(0, 0, 0, 255));
+            }
+        }
+        // Premultiplies code values, like the texture conversion
+        image.convertTo(format);
+
+        const QImage level = ImagePyramid::downsample(image, ImagePyramid::TransferFunction::SRGB);
+        QCOMPARE(level.size(), QSize(2, 2));
+        QCOMPARE(level.format(), format);
+        for (int y = 0; y < level.height(); ++y) {
+            const uchar *pixel = level.constScanLine(y);
+            for (int x = 0; x < level.width(); ++x, pixel += 4) {
+                for (int c = 0; c < 3; ++c) {
+                    QVERIFY2(std::abs(pixel[c] - expected.red()) <= 1, qPrintable(QString::number(pixel[c])));
+                }
+                QVERIFY(std::abs(pixel[3] - expected.alpha()) <= 1);
+            }
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(ImagePyramidTest)
+
+#include "image_pyramid_test.moc"
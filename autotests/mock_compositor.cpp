@@ -0,0 +1,305 @@
+#include "mock_compositor.h"
+
+#include <wayland-server.h>
+
+#include "wayland-color-management-v1-server-protocol.h"
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include <poll.h>
+
+namespace {
+    constexpr int COMPOSITOR_VERSION = 4;
+    constexpr int COLOR_MANAGER_VERSION = 1;
+    // How long the server thread sleeps without requests before it checks whether to stop
+    constexpr int POLL_INTERVAL_MS = 10;
+}
+
+struct MockCompositorState {
+    using Description = MockCompositor::Description;
+
+    wl_display *display = nullptr;
+    QByteArray socketName;
+    std::thread thread;
+    std::atomic_bool running = true;
+
+    // Held by the server thread while it dispatches and by every public method
+    mutable std::mutex mutex;
+    bool autoReady = true;
+    QList<Description> descriptions;
+    // Null once the client destroyed the description
+    QList<wl_resource *> descriptionResources;
+    QList<Description> applied;
+
+    void run();
+    void sendReady(int index);
+};
+
+namespace {
+    // Per creator, filled by the set_* requests
+    struct CreatorData {
+        MockCompositorState *state;
+        MockCompositor::Description description;
+    };
+
+    struct DescriptionData {
+        MockCompositorState *state;
+        int index;
+    };
+
+    void destroyResource(wl_client *, wl_resource *resource)
+    {
+        wl_resource_destroy(resource);
+    }
+
+    // Requests the viewer never sends are left out, libwayland aborts with the request name if one arrives
+
+    const struct wl_surface_interface SURFACE_IMPLEMENTATION = {
+        .destroy = destroyResource,
+    };
+
+    const struct wl_region_interface REGION_IMPLEMENTATION = {
+        .destroy = destroyResource,
+    };
+
+    void createSurface(wl_client *client, wl_resource *resource, uint32_t id)
+    {
+        wl_resource *surface = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
+        wl_resource_set_implementation(surface, &SURFACE_IMPLEMENTATION, nullptr, nullptr);
+    }
+
+    void createRegion(wl_client *client, wl_resource *resource, uint32_t id)
+    {
+        wl_resource *region = wl_resource_create(client, &wl_region_interface, wl_resource_get_version(resource), id);
+        wl_resource_set_implementation(region, &REGION_IMPLEMENTATION, nullptr, nullptr);
+    }
+
+    const struct wl_compositor_interface COMPOSITOR_IMPLEMENTATION = {
+        .create_surface = createSurface,
+        .create_region = createRegion,
+    };
+
+    void bindCompositor(wl_client *client, void *data, uint32_t version, uint32_t id)
+    {
+        wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+        wl_resource_set_implementation(resource, &COMPOSITOR_IMPLEMENTATION, data, nullptr);
+    }
+
+    const struct wp_image_description_v1_interface DESCRIPTION_IMPLEMENTATION = {
+        .destroy = destroyResource,
+    };
+
+    void destroyDescription(wl_resource *resource)
+    {
+        auto data = static_cast<DescriptionData *>(wl_resource_get_user_data(resource));
+        data->state->descriptionResources[data->index] = nullptr;
+        delete data;
+    }
+
+    void createDescription(wl_client *client, wl_resource *resource, uint32_t id)
+    {
+        auto creator = static_cast<CreatorData *>(wl_resource_get_user_data(resource));
+        MockCompositorState *state = creator->state;
+
+        const int index = state->descriptions.size();
+        MockCompositor::Description description = creator->description;
+        description.index = index;
+        state->descriptions.append(description);
+
+        wl_resource *descriptionResource = wl_resource_create(client, &wp_image_description_v1_interface,
+                                                              wl_resource_get_version(resource), id);
+        wl_resource_set_implementation(descriptionResource, &DESCRIPTION_IMPLEMENTATION,
+                                       new DescriptionData{state, index}, destroyDescription);
+        state->descriptionResources.append(descriptionResource);
+        if (state->autoReady) {
+            state->sendReady(index);
+        }
+        // create is the creator's destructor
+        wl_resource_destroy(resource);
+    }
+
+    MockCompositor::Description &creatorDescription(wl_resource *resource)
+    {
+        return static_cast<CreatorData *>(wl_resource_get_user_data(resource))->description;
+    }
+
+    void setTfNamed(wl_client *, wl_resource *resource, uint32_t tf)
+    {
+        creatorDescription(resource).transferFunction = tf;
+    }
+
+    void setPrimariesNamed(wl_client *, wl_resource *resource, uint32_t primaries)
+    {
+        creatorDescription(resource).primaries = primaries;
+    }
+
+    void setLuminances(wl_client *, wl_resource *resource, uint32_t /*minLum*/, uint32_t maxLum, uint32_t referenceLum)
+    {
+        creatorDescription(resource).maxLuminance = maxLum;
+        creatorDescription(resource).referenceLuminance = referenceLum;
+    }
+
+    void setMasteringLuminance(wl_client *, wl_resource *resource, uint32_t /*minLum*/, uint32_t maxLum)
+    {
+        creatorDescription(resource).masteringMaxLuminance = maxLum;
+    }
+
+    const struct wp_image_description_creator_params_v1_interface CREATOR_IMPLEMENTATION = {
+        .create = createDescription,
+        .set_tf_named = setTfNamed,
+        .set_primaries_named = setPrimariesNamed,
+        .set_luminances = setLuminances,
+        .set_mastering_luminance = setMasteringLuminance,
+    };
+
+    void destroyCreator(wl_resource *resource)
+    {
+        delete static_cast<CreatorData *>(wl_resource_get_user_data(resource));
+    }
+
+    void setImageDescription(wl_client *, wl_resource *resource, wl_resource *imageDescription, uint32_t /*renderIntent*/)
+    {
+        auto state = static_cast<MockCompositorState *>(wl_resource_get_user_data(resource));
+        auto data = static_cast<DescriptionData *>(wl_resource_get_user_data(imageDescription));
+        state->applied.append(state->descriptions[data->index]);
+    }
+
+    void unsetImageDescription(wl_client *, wl_resource *resource)
+    {
+        auto state = static_cast<MockCompositorState *>(wl_resource_get_user_data(resource));
+        state->applied.append(MockCompositor::Description{});
+    }
+
+    const struct wp_color_management_surface_v1_interface COLOR_SURFACE_IMPLEMENTATION = {
+        .destroy = destroyResource,
+        .set_image_description = setImageDescription,
+        .unset_image_description = unsetImageDescription,
+    };
+
+    void getSurface(wl_client *client, wl_resource *resource, uint32_t id, wl_resource * /*surface*/)
+    {
+        wl_resource *colorSurface = wl_resource_create(client, &wp_color_management_surface_v1_interface,
+                                                       wl_resource_get_version(resource), id);
+        wl_resource_set_implementation(colorSurface, &COLOR_SURFACE_IMPLEMENTATION,
+                                       wl_resource_get_user_data(resource), nullptr);
+    }
+
+    void createParametricCreator(wl_client *client, wl_resource *resource, uint32_t id)
+    {
+        auto state = static_cast<MockCompositorState *>(wl_resource_get_user_data(resource));
+        wl_resource *creator = wl_resource_create(client, &wp_image_description_creator_params_v1_interface,
+                                                  wl_resource_get_version(resource), id);
+        wl_resource_set_implementation(creator, &CREATOR_IMPLEMENTATION, new CreatorData{state, {}}, destroyCreator);
+    }
+
+    const struct wp_color_manager_v1_interface COLOR_MANAGER_IMPLEMENTATION = {
+        .destroy = destroyResource,
+        .get_surface = getSurface,
+        .create_parametric_creator = createParametricCreator,
+    };
+
+    void bindColorManager(wl_client *client, void *data, uint32_t version, uint32_t id)
+    {
+        wl_resource *resource = wl_resource_create(client, &wp_color_manager_v1_interface, version, id);
+        wl_resource_set_implementation(resource, &COLOR_MANAGER_IMPLEMENTATION, data, nullptr);
+
+        wp_color_manager_v1_send_supported_intent(resource, WP_COLOR_MANAGER_V1_RENDER_INTENT_PERCEPTUAL);
+        for (const uint32_t feature : {WP_COLOR_MANAGER_V1_FEATURE_PARAMETRIC,
+                                       WP_COLOR_MANAGER_V1_FEATURE_SET_LUMINANCES,
+                                       WP_COLOR_MANAGER_V1_FEATURE_SET_MASTERING_DISPLAY_PRIMARIES}) {
+            wp_color_manager_v1_send_supported_feature(resource, feature);
+        }
+        for (const uint32_t tf : {WP_COLOR_MANAGER_V1_TRANSFER_FUNCTION_GAMMA22,
+                                  WP_COLOR_MANAGER_V1_TRANSFER_FUNCTION_ST2084_PQ}) {
+            wp_color_manager_v1_send_supported_tf_named(resource, tf);
+        }
+        for (const uint32_t primaries : {WP_COLOR_MANAGER_V1_PRIMARIES_SRGB, WP_COLOR_MANAGER_V1_PRIMARIES_BT2020}) {
+            wp_color_manager_v1_send_supported_primaries_named(resource, primaries);
+        }
+        wp_color_manager_v1_send_done(resource);
+    }
+}
+
+void MockCompositorState::run()
+{
+    wl_event_loop *loop = wl_display_get_event_loop(display);
+    pollfd descriptor{.fd = wl_event_loop_get_fd(loop), .events = POLLIN, .revents = 0};
+    while (running) {
+        poll(&descriptor, 1, POLL_INTERVAL_MS);
+        std::lock_guard lock(mutex);
+        wl_event_loop_dispatch(loop, 0);
+        wl_display_flush_clients(display);
+    }
+}
+
+void MockCompositorState::sendReady(int index)
+{
+    if (wl_resource *resource = descriptionResources.value(index)) {
+        // Any unique identity will do
+        wp_image_description_v1_send_ready(resource, index + 1);
+    }
+}
+
+MockCompositor::MockCompositor()
+    : d(std::make_unique<MockCompositorState>())
+{
+    d->display = wl_display_create();
+    const char *socketName = wl_display_add_socket_auto(d->display);
+    if (!socketName) {
+        wl_display_destroy(d->display);
+        throw std::runtime_error("Cannot create a Wayland socket, is XDG_RUNTIME_DIR set?");
+    }
+    d->socketName = socketName;
+
+    wl_global_create(d->display, &wl_compositor_interface, COMPOSITOR_VERSION, d.get(), bindCompositor);
+    wl_global_create(d->display, &wp_color_manager_v1_interface, COLOR_MANAGER_VERSION, d.get(), bindColorManager);
+
+    d->thread = std::thread(&MockCompositorState::run, d.get());
+}
+
+MockCompositor::~MockCompositor()
+{
+    d->running = false;
+    d->thread.join();
+    wl_display_destroy_clients(d->display);
+    wl_display_destroy(d->display);
+}
+
+QByteArray MockCompositor::socketName() const
+{
+    return d->socketName;
+}
+
+void MockCompositor::setAutoReady(bool autoReady)
+{
+    std::lock_guard lock(d->mutex);
+    d->autoReady = autoReady;
+}
+
+void MockCompositor::sendReady(int index)
+{
+    std::lock_guard lock(d->mutex);
+    d->sendReady(index);
+    wl_display_flush_clients(d->display);
+}
+
+int MockCompositor::descriptionCount() const
+{
+    std::lock_guard lock(d->mutex);
+    return d->descriptions.size();
+}
+
+QList<MockCompositor::Description> MockCompositor::appliedDescriptions() const
+{
+    std::lock_guard lock(d->mutex);
+    return d->applied;
+}
+
+void MockCompositor::clearApplied()
+{
+    std::lock_guard lock(d->mutex);
+    d->applied.clear();
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+
+#include <cstdint>
+#include <memory>
+
+struct MockCompositorState;
+
+// Minimal in-process Wayland compositor for the color management tests: wl_compositor for surfaces and
+// a wp_color_manager_v1 that advertises everything the PQ description needs. The server runs on its
+// own thread; the methods below may be called from the test thread at any time.
+class MockCompositor
+{
+public:
+    // A description created through the parametric creator, or an unset_image_description
+    struct Description {
+        int index = UNSET;
+        uint32_t transferFunction = 0;
+        uint32_t primaries = 0;
+        uint32_t referenceLuminance = 0;
+        uint32_t maxLuminance = 0;
+        uint32_t masteringMaxLuminance = 0;
+    };
+    static constexpr int UNSET = -1;
+
+    // Listens on a new socket in XDG_RUNTIME_DIR
+    MockCompositor();
+    ~MockCompositor();
+
+    QByteArray socketName() const;
+
+    // Whether created descriptions are reported ready right away, otherwise see sendReady()
+    void setAutoReady(bool autoReady);
+    void sendReady(int index);
+
+    // Created since the compositor started, indices count up from 0
+    int descriptionCount() const;
+    // Every set_image_description and unset_image_description since the last clear, oldest first
+    QList<Description> appliedDescriptions() const;
+    void clearApplied();
+
+private:
+    std::unique_ptr<MockCompositorState> d;
+};
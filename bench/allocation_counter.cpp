@@ -0,0 +1,69 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+
+namespace {
+    // Per thread, so that the thread pool and the event loop do not show up in a measurement.
+    // Static TLS of the executable, accessing it never allocates.
+    constinit thread_local quint64 t_allocations = 0;
+    constinit thread_local quint64 t_bytes = 0;
+
+    void count(std::size_t bytes)
+    {
+        ++t_allocations;
+        t_bytes += bytes;
+    }
+}
+
+#if defined(__GLIBC__)
+// glibc's own entry points, so the replacements need no dlsym() (which allocates itself). memalign and
+// friends are not counted, nothing on the probe path uses them.
+extern "C" {
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t elements, std::size_t size);
+void *__libc_realloc(void *pointer, std::size_t size);
+
+void *malloc(std::size_t size) noexcept
+{
+    count(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(std::size_t elements, std::size_t size) noexcept
+{
+    count(elements * size);
+    return __libc_calloc(elements, size);
+}
+
+void *realloc(void *pointer, std::size_t size) noexcept
+{
+    count(size);
+    return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+AllocationCounter::AllocationCounter()
+    : m_startAllocations(t_allocations)
+    , m_startBytes(t_bytes)
+{
+}
+
+quint64 AllocationCounter::allocations() const
+{
+    return t_allocations - m_startAllocations;
+}
+
+quint64 AllocationCounter::bytes() const
+{
+    return t_bytes - m_startBytes;
+}
+
+bool AllocationCounter::isAvailable()
+{
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
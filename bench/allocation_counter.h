@@ -0,0 +1,21 @@
+#pragma once
+
+#include <QtGlobal>
+
+// Counts the heap allocations the calling thread makes while the counter is alive. The malloc family
+// is replaced for the whole benchmark binary, which covers operator new as well as Qt's containers.
+// Only available with glibc; elsewhere isAvailable() is false and both counts stay 0.
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+
+    quint64 allocations() const;
+    quint64 bytes() const;
+
+    static bool isAvailable();
+
+private:
+    const quint64 m_startAllocations;
+    const quint64 m_startBytes;
+};
@@ -0,0 +1,442 @@
+#include "allocation_counter.h"
+#include "directory_scanner.h"
+#include "file_detector.h"
+#include "io_counter.h"
+#include "legacy_probe.h"
+#include "synthetic_corpus.h"
+#include "tone_mapper_bench.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSignalSpy>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace {
+    constexpr QSize DEFAULT_CORPUS_SIZE(1024, 768);
+    // Images in the scanned directory, each with a sidecar file next to it
+    constexpr int DEFAULT_SCAN_FILES = 2000;
+    constexpr int SCAN_TIMEOUT_MS = 120 * 1000;
+    // A 4K UHD frame, large photos are a few times that
+    constexpr QSize DEFAULT_TONE_MAP_SIZE(3840, 2160);
+
+    struct BenchOptions {
+        QSize corpusSize = DEFAULT_CORPUS_SIZE;
+        int scanFiles = DEFAULT_SCAN_FILES;
+        QSize toneMapSize = DEFAULT_TONE_MAP_SIZE;
+        QString writeCorpus;
+        // probe, tone-map or all; QTest function names only exist in one of them
+        QString suite = QStringLiteral("all");
+    };
+
+    std::optional<QSize> parseSize(const QString &value)
+    {
+        const QStringList parts = value.split(u'x');
+        bool widthOk = false;
+        bool heightOk = false;
+        const QSize size = parts.size() == 2 ? QSize(parts[0].toInt(&widthOk), parts[1].toInt(&heightOk)) : QSize();
+        if (!widthOk || !heightOk || size.isEmpty()) {
+            return std::nullopt;
+        }
+        return size;
+    }
+
+    void printUsage()
+    {
+        std::fprintf(stderr,
+                     "Additional options:\n"
+                     "  --corpus-size <W>x<H>   Size of the synthetic images (default %dx%d)\n"
+                     "  --scan-files <N>        Images in the scanned directory (default %d)\n"
+                     "  --tone-map-size <W>x<H> Size of the tone mapped image (default %dx%d)\n"
+                     "  --write-corpus <dir>    Write the synthetic corpus to <dir> and exit\n"
+                     "  --suite <name>          probe, tone-map or all (default)\n"
+                     "All other arguments are passed to QTest, e.g. -iterations, -callgrind or a benchmark name\n"
+                     "together with --suite.\n",
+                     DEFAULT_CORPUS_SIZE.width(), DEFAULT_CORPUS_SIZE.height(), DEFAULT_SCAN_FILES,
+                     DEFAULT_TONE_MAP_SIZE.width(), DEFAULT_TONE_MAP_SIZE.height());
+    }
+
+    // Takes the benchmark's own options out of arguments, leaving the ones for QTest
+    std::optional<BenchOptions> parseOptions(QStringList &arguments)
+    {
+        BenchOptions options;
+        for (qsizetype i = 1; i < arguments.size();) {
+            const QString option = arguments[i];
+            if (option != u"--corpus-size" && option != u"--scan-files" && option != u"--tone-map-size"
+                && option != u"--write-corpus" && option != u"--suite") {
+                if (option == u"-help" || option == u"--help") {
+                    printUsage();
+                }
+                ++i;
+                continue;
+            }
+            if (i + 1 >= arguments.size()) {
+                std::fprintf(stderr, "Missing value for %s\n", qPrintable(option));
+                return std::nullopt;
+            }
+            const QString value = arguments[i + 1];
+            arguments.remove(i, 2);
+
+            bool ok = true;
+            if (option == u"--corpus-size" || option == u"--tone-map-size") {
+                const std::optional<QSize> size = parseSize(value);
+                ok = size.has_value();
+                (option == u"--corpus-size" ? options.corpusSize : options.toneMapSize) = size.value_or(QSize());
+            } else if (option == u"--scan-files") {
+                options.scanFiles = value.toInt(&ok);
+                ok = ok && options.scanFiles > 0;
+            } else if (option == u"--suite") {
+                options.suite = value;
+                ok = value == u"probe" || value == u"tone-map" || value == u"all";
+            } else {
+                options.writeCorpus = value;
+            }
+            if (!ok) {
+                std::fprintf(stderr, "Invalid value for %s: %s\n", qPrintable(option), qPrintable(value));
+                return std::nullopt;
+            }
+        }
+        return options;
+    }
+
+    // Probes log per file, which would dominate the measured time and bury the results
+    void messageHandler(QtMsgType type, const QMessageLogContext &, const QString &message)
+    {
+        if (type != QtDebugMsg) {
+            std::fprintf(stderr, "%s\n", qPrintable(message));
+        }
+    }
+}
+
+Q_DECLARE_METATYPE(FileDetector::ImageFormat)
+Q_DECLARE_METATYPE(QImageIOHandler::Transformations)
+
+// Microbenchmarks of format detection and probing on a synthetic corpus. Cold probes call the
+// parsers directly, warm ones go through the ProbeCache like the viewer does on a second visit.
+class FileDetectorBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileDetectorBenchmark(const BenchOptions &options)
+        : m_options(options)
+    {
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        QVERIFY(m_directory.isValid());
+        for (const bool hdr : {true, false}) {
+            const QString corpus = m_directory.filePath(QStringLiteral("corpus"));
+            const auto files = SyntheticCorpus::write(corpus, {m_options.corpusSize, hdr});
+            QCOMPARE(files.size(), 5);
+            m_files += files;
+            // AVIF and HEIC as phones write them
+            for (const auto &[grid, rotated] : {std::pair(true, false), std::pair(false, true)}) {
+                const auto variants = SyntheticCorpus::write(corpus, {.size = m_options.corpusSize, .hdr = hdr, .grid = grid, .rotated = rotated});
+                QCOMPARE(variants.size(), 2);
+                m_files += variants;
+            }
+        }
+
+        m_scanDirectory = m_directory.filePath(QStringLiteral("scan"));
+        const QStringList copies = SyntheticCorpus::writeCopies(m_scanDirectory, m_files, m_options.scanFiles);
+        QCOMPARE(copies.size(), m_options.scanFiles);
+    }
+
+    void detectImageFormat_data() { addFileRows(); }
+    void detectImageFormat()
+    {
+        QFETCH(QString, path);
+        QFETCH(FileDetector::ImageFormat, format);
+
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray header = file.read(12);
+
+        FileDetector::ImageFormat detected = FileDetector::ImageFormat::Unknown;
+        QBENCHMARK {
+            detected = FileDetector::detectImageFormat(QByteArrayView(header));
+        }
+        QCOMPARE(detected, format);
+    }
+
+    void detectImageFormatFromFile_data() { addFileRows(); }
+    void detectImageFormatFromFile()
+    {
+        QFETCH(QString, path);
+        QFETCH(FileDetector::ImageFormat, format);
+
+        FileDetector::ImageFormat detected = FileDetector::ImageFormat::Unknown;
+        QBENCHMARK {
+            detected = FileDetector::detectImageFormat(path);
+        }
+        QCOMPARE(detected, format);
+    }
+
+    // Open, map and parse, as on the first visit of a directory
+    void probeUncached_data() { addFileRows(); }
+    void probeUncached()
+    {
+        QFETCH(QString, path);
+        QFETCH(FileDetector::ImageFormat, format);
+        QFETCH(bool, hdr);
+        QFETCH(QImageIOHandler::Transformations, transformations);
+
+        FileDetector::ImageProbe probe;
+        QBENCHMARK {
+            probe = FileDetector::probeFile(path);
+        }
+        printCounts([&] {
+            probe = FileDetector::probeFile(path);
+        });
+        QCOMPARE(probe.format, format);
+        QCOMPARE(probe.isHDR, hdr);
+        // The image's size, not the one of a grid tile
+        QCOMPARE(probe.size, m_options.corpusSize);
+        QCOMPARE(probe.transformations, transformations);
+    }
+
+    // Stat and ProbeCache lookup
+    void isImageHDR_data() { addFileRows(); }
+    void isImageHDR()
+    {
+        QFETCH(QString, path);
+        QFETCH(bool, hdr);
+
+        // The first call outside the measurement fills the cache
+        bool detected = FileDetector::isImageHDR(path);
+        QBENCHMARK {
+            detected = FileDetector::isImageHDR(path);
+        }
+        printCounts([&] {
+            detected = FileDetector::isImageHDR(path);
+        });
+        QCOMPARE(detected, hdr);
+    }
+
+    // The ISO BMFF box walk alone, on the mapped file
+    void parseIsoMediaBoxes_data()
+    {
+        addFileRows([](FileDetector::ImageFormat format) {
+            return format == FileDetector::ImageFormat::AVIF || format == FileDetector::ImageFormat::HEIC;
+        });
+    }
+    void parseIsoMediaBoxes()
+    {
+        QFETCH(QString, path);
+        QFETCH(bool, hdr);
+
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const uchar *mapped = file.map(0, file.size());
+        QVERIFY(mapped);
+        const QByteArrayView data(mapped, file.size());
+
+        FileDetector::ImageProbe probe;
+        QBENCHMARK {
+            probe = {};
+            FileDetector::probeIsoMedia(data, probe);
+        }
+        printCounts([&] {
+            probe = {};
+            FileDetector::probeIsoMedia(data, probe);
+        });
+        QCOMPARE(probe.isHDR, hdr);
+    }
+
+    // Before and after parsing from a mapping: the PNG and ISO BMFF parsers from opening the file on, once
+    // with the per-field reads FileDetector used to make, once on the mapped file
+    void parseLegacy_data() { addFileRows(isChunkedFormat); }
+    void parseLegacy()
+    {
+        QFETCH(QString, path);
+        QFETCH(FileDetector::ImageFormat, format);
+        QFETCH(bool, hdr);
+
+        const auto parse = [&]() {
+            FileDetector::ImageProbe probe;
+            QFile file(path);
+            if (file.open(QIODevice::ReadOnly)) {
+                if (format == FileDetector::ImageFormat::PNG) {
+                    LegacyProbe::probePng(file, probe);
+                } else {
+                    LegacyProbe::probeIsoMedia(file, probe);
+                }
+            }
+            return probe;
+        };
+        FileDetector::ImageProbe probe;
+        QBENCHMARK {
+            probe = parse();
+        }
+        printCounts([&] {
+            probe = parse();
+        });
+        QCOMPARE(probe.isHDR, hdr);
+    }
+
+    void parseMapped_data() { addFileRows(isChunkedFormat); }
+    void parseMapped()
+    {
+        QFETCH(QString, path);
+        QFETCH(FileDetector::ImageFormat, format);
+        QFETCH(bool, hdr);
+
+        const auto parse = [&]() {
+            FileDetector::ImageProbe probe;
+            QFile file(path);
+            const uchar *mapped = file.open(QIODevice::ReadOnly) ? file.map(0, file.size()) : nullptr;
+            if (mapped) {
+                const QByteArrayView data(mapped, file.size());
+                if (format == FileDetector::ImageFormat::PNG) {
+                    FileDetector::probePng(data, probe);
+                } else {
+                    FileDetector::probeIsoMedia(data, probe);
+                }
+            }
+            return probe;
+        };
+        FileDetector::ImageProbe probe;
+        QBENCHMARK {
+            probe = parse();
+        }
+        printCounts([&] {
+            probe = parse();
+        });
+        QCOMPARE(probe.isHDR, hdr);
+    }
+
+    // The DirectoryScanner as used by the viewer, with a warm ProbeCache after the first iteration
+    void directoryScan()
+    {
+        DirectoryScanner scanner;
+        QSignalSpy finished(&scanner, &DirectoryScanner::finished);
+        qsizetype found = 0;
+        connect(&scanner, &DirectoryScanner::imagesFound, this, [&found](const QStringList &fileNames) {
+            found += fileNames.size();
+        });
+
+        QBENCHMARK {
+            found = 0;
+            finished.clear();
+            scanner.scan(m_scanDirectory);
+            QVERIFY(finished.wait(SCAN_TIMEOUT_MS));
+        }
+        QCOMPARE(found, m_options.scanFiles);
+    }
+
+    // Listing plus cold probes of every file on one thread, the cost the ProbeCache saves
+    void directoryProbeUncached()
+    {
+        const QDir directory(m_scanDirectory);
+        qsizetype found = 0;
+        QBENCHMARK {
+            found = 0;
+            const QStringList fileNames = directory.entryList(QDir::Files, QDir::Name);
+            for (const QString &fileName : fileNames) {
+                if (FileDetector::probeFile(directory.absoluteFilePath(fileName)).isSupported) {
+                    ++found;
+                }
+            }
+        }
+        QCOMPARE(found, m_options.scanFiles);
+    }
+
+private:
+    // One more call after the measurement, with the heap allocations, read calls and page faults it caused.
+    // Counters that are not available on the platform print 0.
+    static void printCounts(const std::function<void()> &call)
+    {
+        if (!AllocationCounter::isAvailable() && !IoCounter::isAvailable()) {
+            return;
+        }
+        const IoCounter io;
+        const AllocationCounter allocations;
+        call();
+        const quint64 allocationCount = allocations.allocations();
+        const quint64 allocatedBytes = allocations.bytes();
+        const IoCounter::Counts ioCounts = io.counts();
+        std::printf("%s(%s): %llu allocations, %llu bytes allocated, %llu read calls, %llu bytes read, %llu page faults\n",
+                    QTest::currentTestFunction(), QTest::currentDataTag(),
+                    static_cast<unsigned long long>(allocationCount), static_cast<unsigned long long>(allocatedBytes),
+                    static_cast<unsigned long long>(ioCounts.readCalls), static_cast<unsigned long long>(ioCounts.bytesRead),
+                    static_cast<unsigned long long>(ioCounts.pageFaults));
+    }
+
+    // The formats FileDetector used to walk with a read per field
+    static bool isChunkedFormat(FileDetector::ImageFormat format)
+    {
+        return format == FileDetector::ImageFormat::PNG || format == FileDetector::ImageFormat::AVIF
+            || format == FileDetector::ImageFormat::HEIC;
+    }
+
+    void addFileRows(const std::function<bool(FileDetector::ImageFormat)> &filter = {})
+    {
+        QTest::addColumn<QString>("path");
+        QTest::addColumn<FileDetector::ImageFormat>("format");
+        QTest::addColumn<bool>("hdr");
+        QTest::addColumn<QImageIOHandler::Transformations>("transformations");
+
+        for (const SyntheticCorpus::File &file : std::as_const(m_files)) {
+            if (filter && !filter(file.format)) {
+                continue;
+            }
+            QTest::addRow("%s-%s%s", FileDetector::formatName(file.format), file.hdr ? "hdr" : "sdr",
+                          file.variant.isEmpty() ? "" : qPrintable(u'-' + file.variant))
+                << file.path << file.format << file.hdr << file.transformations;
+        }
+    }
+
+    const BenchOptions m_options;
+    QTemporaryDir m_directory;
+    QList<SyntheticCorpus::File> m_files;
+    QString m_scanDirectory;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    qInstallMessageHandler(messageHandler);
+    // Keeps the ProbeCache log of the benchmark away from the user's cache directory
+    QStandardPaths::setTestModeEnabled(true);
+
+    QStringList arguments = app.arguments();
+    const std::optional<BenchOptions> options = parseOptions(arguments);
+    if (!options) {
+        printUsage();
+        return 1;
+    }
+
+    if (!options->writeCorpus.isEmpty()) {
+        for (const bool hdr : {true, false}) {
+            for (const auto &[grid, rotated] : {std::pair(false, false), std::pair(true, false), std::pair(false, true)}) {
+                const SyntheticCorpus::Options corpusOptions{.size = options->corpusSize, .hdr = hdr, .grid = grid, .rotated = rotated};
+                for (const SyntheticCorpus::File &file : SyntheticCorpus::write(options->writeCorpus, corpusOptions)) {
+                    std::printf("%s\n", qPrintable(file.path));
+                }
+            }
+        }
+        return 0;
+    }
+
+    int status = 0;
+    if (options->suite != u"tone-map") {
+        FileDetectorBenchmark benchmark(*options);
+        status |= QTest::qExec(&benchmark, arguments);
+    }
+    if (options->suite != u"probe") {
+        status |= runToneMapperBenchmark(options->toneMapSize, arguments);
+    }
+    return status;
+}
+
+#include "file_detector_bench.moc"
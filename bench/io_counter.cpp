@@ -0,0 +1,73 @@
+#include "io_counter.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // /proc/thread-self/io is seven short lines
+    constexpr std::size_t IO_STATUS_SIZE = 512;
+
+    // Without allocating, the AllocationCounter may be running at the same time
+    quint64 fieldValue(const char *status, const char *name)
+    {
+        const char *field = std::strstr(status, name);
+        return field ? std::strtoull(field + std::strlen(name), nullptr, 10) : 0;
+    }
+}
+
+IoCounter::IoCounter()
+    : m_start(sample(&m_startBytes))
+{
+}
+
+IoCounter::Counts IoCounter::counts() const
+{
+    const Counts end = sample();
+    return {
+        .readCalls = end.readCalls - m_start.readCalls - 1,
+        .bytesRead = end.bytesRead - m_start.bytesRead - m_startBytes,
+        .pageFaults = end.pageFaults - m_start.pageFaults,
+    };
+}
+
+bool IoCounter::isAvailable()
+{
+#if defined(Q_OS_LINUX)
+    // Needs CONFIG_TASK_IO_ACCOUNTING
+    return access("/proc/thread-self/io", R_OK) == 0;
+#else
+    return false;
+#endif
+}
+
+IoCounter::Counts IoCounter::sample(quint64 *sampleBytes)
+{
+    Counts result;
+#if defined(Q_OS_LINUX)
+    const int fd = open("/proc/thread-self/io", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        char status[IO_STATUS_SIZE];
+        const ssize_t length = read(fd, status, sizeof(status) - 1);
+        close(fd);
+        if (length > 0) {
+            if (sampleBytes) {
+                *sampleBytes = static_cast<quint64>(length);
+            }
+            status[length] = '\0';
+            result.readCalls = fieldValue(status, "syscr: ");
+            result.bytesRead = fieldValue(status, "rchar: ");
+        }
+    }
+    rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        result.pageFaults = static_cast<quint64>(usage.ru_minflt) + static_cast<quint64>(usage.ru_majflt);
+    }
+#endif
+    return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QtGlobal>
+
+// Counts the read system calls, the bytes they returned and the page faults of the calling thread while
+// the counter is alive, from the kernel's own accounting (/proc/thread-self/io and RUSAGE_THREAD).
+// Page faults are what reading from a mapping costs instead of read calls. Opening, stat and mapping
+// the file are not covered, strace -c has those. Linux only; elsewhere isAvailable() is false.
+class IoCounter
+{
+public:
+    struct Counts {
+        quint64 readCalls = 0;
+        quint64 bytesRead = 0;
+        quint64 pageFaults = 0;
+    };
+
+    IoCounter();
+
+    // Since construction; all at once, every sample of the counters is a read call itself
+    Counts counts() const;
+
+    static bool isAvailable();
+
+private:
+    // Reading the counters is a read call itself, which shows up in the next sample. sampleBytes
+    // returns its length, so that it can be taken out again.
+    static Counts sample(quint64 *sampleBytes = nullptr);
+
+    // Before m_start, which fills it
+    quint64 m_startBytes = 0;
+    Counts m_start;
+};
@@ -0,0 +1,166 @@
+#include "legacy_probe.h"
+
+#include <QByteArray>
+#include <QString>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    constexpr int CICP_PRIMARIES_BT2020 = 9;
+    constexpr int CICP_TRANSFER_PQ = 16;
+
+    quint32 readBigEndian32(const QByteArray &data, int offset)
+    {
+        if (offset + 4 > data.size()) return 0;
+        return (static_cast<unsigned char>(data[offset]) << 24) |
+               (static_cast<unsigned char>(data[offset + 1]) << 16) |
+               (static_cast<unsigned char>(data[offset + 2]) << 8) |
+               static_cast<unsigned char>(data[offset + 3]);
+    }
+
+    bool parseIsoMediaBoxes(QFile &file, FileDetector::ImageProbe &probe, qint64 maxEnd)
+    {
+        while (file.pos() < maxEnd && !file.atEnd()) {
+            const qint64 boxStart = file.pos();
+
+            const QByteArray sizeBytes = file.read(4);
+            if (sizeBytes.size() < 4) break;
+            const quint32 boxSize = readBigEndian32(sizeBytes, 0);
+
+            const QByteArray boxType = file.read(4);
+            if (boxType.size() < 4) break;
+
+            qint64 actualSize = boxSize;
+            if (boxSize == 1) {
+                const QByteArray extSizeBytes = file.read(8);
+                if (extSizeBytes.size() < 8) break;
+                actualSize = 0;
+                for (int i = 0; i < 8; i++) {
+                    actualSize = (actualSize << 8) | static_cast<unsigned char>(extSizeBytes[i]);
+                }
+            } else if (boxSize == 0) {
+                actualSize = maxEnd - boxStart;
+            }
+            const qint64 dataEnd = boxStart + actualSize;
+
+            if (boxType == "colr") {
+                const QByteArray colrData = file.read(qMin(actualSize - 8, qint64(20)));
+                if (colrData.size() >= 11) {
+                    const QString colorType = QString::fromLatin1(colrData.left(4));
+                    if (colorType == "nclx"_L1 || colorType == "rncl"_L1) {
+                        const quint16 colorPrimaries = (static_cast<unsigned char>(colrData[4]) << 8) |
+                                                       static_cast<unsigned char>(colrData[5]);
+                        const quint16 transferCharacteristics = (static_cast<unsigned char>(colrData[6]) << 8) |
+                                                                static_cast<unsigned char>(colrData[7]);
+                        if (transferCharacteristics == CICP_TRANSFER_PQ || colorPrimaries == CICP_PRIMARIES_BT2020) {
+                            return true;
+                        }
+                    } else if (colorType == "prof"_L1) {
+                        const qint64 savedPos = file.pos();
+                        const QString profileStr = QString::fromLatin1(file.read(qMin(actualSize - 8, qint64(8192))));
+                        if (profileStr.contains("Rec. 2020"_L1, Qt::CaseInsensitive) ||
+                            profileStr.contains("BT.2020"_L1, Qt::CaseInsensitive) ||
+                            (profileStr.contains("2020"_L1) && profileStr.contains("PQ"_L1))) {
+                            return true;
+                        }
+                        file.seek(savedPos);
+                    }
+                }
+            }
+
+            if (boxType == "irot") {
+                const QByteArray irotData = file.read(1);
+                if (irotData.size() == 1) {
+                    static constexpr QImageIOHandler::Transformation rotations[] = {
+                        QImageIOHandler::TransformationNone,
+                        QImageIOHandler::TransformationRotate270,
+                        QImageIOHandler::TransformationRotate180,
+                        QImageIOHandler::TransformationRotate90,
+                    };
+                    probe.transformations = rotations[static_cast<unsigned char>(irotData[0]) & 0x03];
+                }
+            }
+
+            if (boxType == "ispe" && !probe.size.isValid()) {
+                const QByteArray ispeData = file.read(12);
+                if (ispeData.size() == 12) {
+                    probe.size = QSize(static_cast<int>(readBigEndian32(ispeData, 4)),
+                                       static_cast<int>(readBigEndian32(ispeData, 8)));
+                }
+            }
+
+            if (boxType == "meta" || boxType == "iprp" || boxType == "ipco" ||
+                boxType == "moov" || boxType == "trak" || boxType == "mdia") {
+                // 'meta' has 4 bytes version/flags before its children
+                if (boxType == "meta") {
+                    file.seek(file.pos() + 4);
+                }
+                if (parseIsoMediaBoxes(file, probe, dataEnd)) {
+                    return true;
+                }
+            }
+
+            if (dataEnd > file.pos()) {
+                file.seek(dataEnd);
+            } else {
+                break;
+            }
+        }
+        return false;
+    }
+}
+
+void LegacyProbe::probePng(QFile &file, FileDetector::ImageProbe &probe)
+{
+    // Skip the signature
+    file.seek(8);
+
+    while (!file.atEnd()) {
+        const QByteArray lengthBytes = file.read(4);
+        if (lengthBytes.size() < 4) break;
+        const quint32 chunkLength = readBigEndian32(lengthBytes, 0);
+
+        const QByteArray chunkType = file.read(4);
+        if (chunkType.size() < 4) break;
+        const qint64 chunkDataStart = file.pos();
+
+        if (chunkType == "IHDR") {
+            const QByteArray chunkData = file.read(qMin(chunkLength, 9u));
+            if (chunkData.size() >= 9) {
+                probe.size = QSize(static_cast<int>(readBigEndian32(chunkData, 0)),
+                                   static_cast<int>(readBigEndian32(chunkData, 4)));
+                probe.bitDepth = static_cast<unsigned char>(chunkData[8]);
+            }
+        }
+
+        if (chunkType == "cICP") {
+            const QByteArray chunkData = file.read(qMin(chunkLength, 4u));
+            if (chunkData.size() >= 2 && static_cast<unsigned char>(chunkData[1]) == CICP_TRANSFER_PQ) {
+                probe.isHDR = true;
+                return;
+            }
+        }
+
+        if (chunkType == "iCCP") {
+            const QString profileData = QString::fromLatin1(file.read(chunkLength));
+            if (profileData.contains("PQ"_L1, Qt::CaseInsensitive) ||
+                profileData.contains("Rec. 2020"_L1, Qt::CaseInsensitive) ||
+                profileData.contains("BT.2020"_L1, Qt::CaseInsensitive)) {
+                probe.isHDR = true;
+                return;
+            }
+        }
+
+        if (chunkType == "IEND") {
+            break;
+        }
+
+        // Data and CRC
+        file.seek(chunkDataStart + chunkLength + 4);
+    }
+}
+
+void LegacyProbe::probeIsoMedia(QFile &file, FileDetector::ImageProbe &probe)
+{
+    probe.isHDR = parseIsoMediaBoxes(file, probe, file.size());
+}
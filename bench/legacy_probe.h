@@ -0,0 +1,15 @@
+#pragma once
+
+#include <QFile>
+
+#include "file_detector.h"
+
+// The PNG chunk walk and ISO BMFF box walk as FileDetector did them before it parsed from a mapping:
+// one QFile::read() and one QByteArray per field, QString conversions for the ICC profile. Kept as the
+// baseline of the probe benchmarks, the color information is reduced to the HDR flag.
+class LegacyProbe
+{
+public:
+    static void probePng(QFile &file, FileDetector::ImageProbe &probe);
+    static void probeIsoMedia(QFile &file, FileDetector::ImageProbe &probe);
+};
@@ -0,0 +1,503 @@
+#include "synthetic_corpus.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <jxl/encode.h>
+#include <jxl/encode_cxx.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+namespace {
+    // H.273 code points written into cICP and nclx
+    constexpr quint8 CICP_PRIMARIES_BT709 = 1;
+    constexpr quint8 CICP_PRIMARIES_BT2020 = 9;
+    constexpr quint8 CICP_TRANSFER_SRGB = 13;
+    constexpr quint8 CICP_TRANSFER_PQ = 16;
+    constexpr quint8 CICP_MATRIX_BT2020_NCL = 9;
+    constexpr quint8 CICP_MATRIX_BT709 = 1;
+
+    // Roughly what AV1 and HEVC need per pixel at visually lossless quality, for a realistic file size
+    constexpr qint64 ISO_MEDIA_PAYLOAD_BITS_PER_PIXEL = 2;
+
+    // Sidecar files next to every image of a copied corpus, as left behind by RAW developers
+    constexpr char SIDECAR_SUFFIX[] = ".xmp";
+
+    constexpr std::array<quint32, 256> makeCrcTable()
+    {
+        std::array<quint32, 256> table{};
+        for (quint32 n = 0; n < 256; ++n) {
+            quint32 c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }
+
+    // CRC-32 as used by PNG chunks
+    quint32 crc32(QByteArrayView data)
+    {
+        static constexpr std::array<quint32, 256> table = makeCrcTable();
+        quint32 crc = 0xFFFFFFFFu;
+        for (const char byte : data) {
+            crc = table[(crc ^ static_cast<quint8>(byte)) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    template<typename T>
+    void appendBigEndian(QByteArray &out, T value)
+    {
+        char bytes[sizeof(T)];
+        qToBigEndian(value, bytes);
+        out.append(bytes, sizeof(T));
+    }
+
+    template<typename T>
+    void appendLittleEndian(QByteArray &out, T value)
+    {
+        char bytes[sizeof(T)];
+        qToLittleEndian(value, bytes);
+        out.append(bytes, sizeof(T));
+    }
+
+    // Deterministic 16 bit RGB test pattern: horizontal and vertical ramps plus a fine checker
+    quint16 sample(int x, int y, int channel, const QSize &size)
+    {
+        switch (channel) {
+            case 0: return static_cast<quint16>(qint64(x) * 65535 / std::max(1, size.width() - 1));
+            case 1: return static_cast<quint16>(qint64(y) * 65535 / std::max(1, size.height() - 1));
+            default: return static_cast<quint16>(((x ^ y) & 0xFF) << 8);
+        }
+    }
+
+    QByteArray pngChunk(const char (&type)[5], QByteArrayView data)
+    {
+        QByteArray chunk;
+        appendBigEndian<quint32>(chunk, static_cast<quint32>(data.size()));
+        chunk.append(type, 4);
+        chunk.append(data);
+        appendBigEndian<quint32>(chunk, crc32(QByteArrayView(chunk).sliced(4)));
+        return chunk;
+    }
+
+    QByteArray isoBox(const char (&type)[5], QByteArrayView payload)
+    {
+        QByteArray box;
+        appendBigEndian<quint32>(box, static_cast<quint32>(8 + payload.size()));
+        box.append(type, 4);
+        box.append(payload);
+        return box;
+    }
+
+    // Box with version (0) and flags (0) in front of the payload
+    QByteArray isoFullBox(const char (&type)[5], QByteArrayView payload)
+    {
+        return isoBox(type, QByteArray(4, '\0') + payload);
+    }
+
+    // Minimal ICC v2 display profile with nothing but a 'desc' tag, which is what the probe reads
+    QByteArray iccProfile(const QByteArray &description)
+    {
+        QByteArray desc("desc");
+        desc.append(4, '\0');
+        appendBigEndian<quint32>(desc, static_cast<quint32>(description.size() + 1));
+        desc.append(description);
+        desc.append('\0');
+        // Empty Unicode (language, count) and ScriptCode (code, count, 67 bytes) descriptions
+        desc.append(8 + 3 + 67, '\0');
+        while (desc.size() % 4 != 0) {
+            desc.append('\0');
+        }
+
+        constexpr int headerSize = 128;
+        constexpr int tagTableSize = 4 + 12;
+        QByteArray icc;
+        appendBigEndian<quint32>(icc, static_cast<quint32>(headerSize + tagTableSize + desc.size()));
+        icc.append(4, '\0');                      // CMM
+        appendBigEndian<quint32>(icc, 0x02100000); // Version 2.1
+        icc.append("mntrRGB XYZ ", 12);
+        icc.append(12, '\0');                     // Date
+        icc.append("acsp", 4);
+        icc.append(headerSize - icc.size(), '\0');
+
+        appendBigEndian<quint32>(icc, 1);
+        icc.append("desc", 4);
+        appendBigEndian<quint32>(icc, headerSize + tagTableSize);
+        appendBigEndian<quint32>(icc, static_cast<quint32>(desc.size()));
+        icc.append(desc);
+        return icc;
+    }
+
+    QString variantName(const SyntheticCorpus::Options &options)
+    {
+        if (options.grid) {
+            return options.rotated ? QStringLiteral("grid-rotated") : QStringLiteral("grid");
+        }
+        return options.rotated ? QStringLiteral("rotated") : QString();
+    }
+
+    QString fileName(const SyntheticCorpus::Options &options, const char *suffix)
+    {
+        const QString variant = variantName(options);
+        return QStringLiteral("synthetic-%1%2-%3x%4.%5")
+            .arg(options.hdr ? QStringLiteral("hdr") : QStringLiteral("sdr"))
+            .arg(variant.isEmpty() ? QString() : u'-' + variant)
+            .arg(options.size.width())
+            .arg(options.size.height())
+            .arg(QLatin1StringView(suffix));
+    }
+
+    bool writeFile(const QString &path, const QByteArray &data)
+    {
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+            qWarning() << "Cannot write" << path << "-" << file.errorString();
+            return false;
+        }
+        return file.commit();
+    }
+}
+
+QList<SyntheticCorpus::File> SyntheticCorpus::write(const QString &directory, const Options &options)
+{
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Cannot create corpus directory" << directory;
+        return {};
+    }
+
+    using Format = FileDetector::ImageFormat;
+    const struct {
+        Format format;
+        const char *suffix;
+    } formats[] = {
+        {Format::PNG, "png"},
+        {Format::AVIF, "avif"},
+        {Format::HEIC, "heic"},
+        {Format::JPEG_XL, "jxl"},
+        {Format::TIFF, "tiff"},
+    };
+
+    QList<File> files;
+    const QDir dir(directory);
+    const bool isoMediaOnly = options.grid || options.rotated;
+    for (const auto &[format, suffix] : formats) {
+        if (isoMediaOnly && format != Format::AVIF && format != Format::HEIC) {
+            continue;
+        }
+        QByteArray data;
+        switch (format) {
+            case Format::PNG: data = png(options); break;
+            case Format::AVIF:
+            case Format::HEIC: data = isoMedia(format, options); break;
+            case Format::JPEG_XL: data = jpegXl(options); break;
+            case Format::TIFF: data = tiff(options); break;
+            default: break;
+        }
+
+        const QString path = dir.absoluteFilePath(fileName(options, suffix));
+        if (data.isEmpty() || !writeFile(path, data)) {
+            continue;
+        }
+        files.append({path, format, options.hdr, variantName(options),
+                      options.rotated ? QImageIOHandler::TransformationRotate270 : QImageIOHandler::TransformationNone});
+    }
+    return files;
+}
+
+QStringList SyntheticCorpus::writeCopies(const QString &directory, const QList<File> &files, int count)
+{
+    if (files.isEmpty() || !QDir().mkpath(directory)) {
+        return {};
+    }
+
+    const QDir dir(directory);
+    QStringList paths;
+    for (int i = 0; i < count; ++i) {
+        const QFileInfo source(files[i % files.size()].path);
+        const QString baseName = QStringLiteral("%1-%2").arg(i, 6, 10, QLatin1Char('0')).arg(source.completeBaseName());
+        const QString path = dir.absoluteFilePath(baseName + u'.' + source.suffix());
+        QFile::remove(path);
+        if (!QFile::copy(source.filePath(), path)) {
+            qWarning() << "Cannot copy" << source.filePath() << "to" << path;
+            continue;
+        }
+        paths.append(path);
+
+        writeFile(dir.absoluteFilePath(baseName + QLatin1StringView(SIDECAR_SUFFIX)), QByteArrayLiteral("<x:xmpmeta/>\n"));
+    }
+    return paths;
+}
+
+QByteArray SyntheticCorpus::png(const Options &options)
+{
+    const QSize size = options.size;
+
+    QByteArray ihdr;
+    appendBigEndian<quint32>(ihdr, static_cast<quint32>(size.width()));
+    appendBigEndian<quint32>(ihdr, static_cast<quint32>(size.height()));
+    ihdr.append(char(16)); // Bit depth
+    ihdr.append(char(2));  // Color type RGB
+    ihdr.append(3, '\0');  // Compression, filter, interlace
+
+    QByteArray cicp;
+    cicp.append(char(options.hdr ? CICP_PRIMARIES_BT2020 : CICP_PRIMARIES_BT709));
+    cicp.append(char(options.hdr ? CICP_TRANSFER_PQ : CICP_TRANSFER_SRGB));
+    cicp.append(char(0)); // RGB
+    cicp.append(char(1)); // Full range
+
+    // Filter type 0 in front of every row, samples in network byte order
+    QByteArray raw;
+    raw.reserve(qsizetype(size.height()) * (1 + size.width() * 6));
+    for (int y = 0; y < size.height(); ++y) {
+        raw.append('\0');
+        for (int x = 0; x < size.width(); ++x) {
+            for (int channel = 0; channel < 3; ++channel) {
+                appendBigEndian<quint16>(raw, sample(x, y, channel, size));
+            }
+        }
+    }
+    // qCompress() prepends the uncompressed size to the zlib stream, IDAT takes the stream only
+    const QByteArray idat = qCompress(raw, 6).sliced(4);
+
+    QByteArray out("\x89PNG\r\n\x1a\n", 8);
+    out += pngChunk("IHDR", ihdr);
+    out += pngChunk("cICP", cicp);
+    out += pngChunk("IDAT", idat);
+    out += pngChunk("IEND", {});
+    return out;
+}
+
+QByteArray SyntheticCorpus::isoMedia(FileDetector::ImageFormat format, const Options &options)
+{
+    const bool avif = format == FileDetector::ImageFormat::AVIF;
+
+    QByteArray ftyp(avif ? "avif" : "heic", 4);
+    appendBigEndian<quint32>(ftyp, 0);
+    ftyp.append(avif ? "avifmif1miaf" : "heicmif1miaf", 12);
+
+    QByteArray hdlr(4, '\0'); // Pre-defined
+    hdlr.append("pict", 4);
+    hdlr.append(12, '\0');
+    hdlr.append('\0'); // Empty name
+
+    const auto ispe = [](QSize size) {
+        QByteArray extents;
+        appendBigEndian<quint32>(extents, static_cast<quint32>(size.width()));
+        appendBigEndian<quint32>(extents, static_cast<quint32>(size.height()));
+        return isoFullBox("ispe", extents);
+    };
+
+    QByteArray colr("nclx", 4);
+    appendBigEndian<quint16>(colr, options.hdr ? CICP_PRIMARIES_BT2020 : CICP_PRIMARIES_BT709);
+    appendBigEndian<quint16>(colr, options.hdr ? CICP_TRANSFER_PQ : CICP_TRANSFER_SRGB);
+    appendBigEndian<quint16>(colr, options.hdr ? CICP_MATRIX_BT2020_NCL : CICP_MATRIX_BT709);
+    colr.append(char(0x80)); // Full range
+
+    // Properties in the order phone encoders write them: the tile extents of a grid first, the color
+    // before the extents of the image. Only the primary item's associations tell them apart.
+    // Item 1 is the image (the grid), items 2 to 5 are its tiles.
+    constexpr quint16 PRIMARY_ITEM = 1;
+    constexpr int GRID_TILES = 4;
+    constexpr quint8 ESSENTIAL = 0x80;
+    QByteArray ipco;
+    QList<quint8> primaryAssociations;
+    QList<quint8> tileAssociations;
+    if (options.grid) {
+        ipco += ispe(QSize((options.size.width() + 1) / 2, (options.size.height() + 1) / 2));
+        tileAssociations.append(1);
+    }
+    ipco += isoBox("colr", colr);
+    primaryAssociations.append(options.grid ? 2 : 1);
+    tileAssociations.append(2);
+    ipco += ispe(options.size);
+    primaryAssociations.append(options.grid ? 3 : 2);
+    if (options.rotated) {
+        ipco += isoBox("irot", QByteArray(1, char(1)));
+        primaryAssociations.append(ESSENTIAL | (options.grid ? 4 : 3));
+    }
+
+    // Version 0, flags 0: 16 bit item IDs and 7 bit property indices
+    QByteArray ipma;
+    appendBigEndian<quint32>(ipma, options.grid ? 1 + GRID_TILES : 1);
+    appendBigEndian<quint16>(ipma, PRIMARY_ITEM);
+    ipma.append(char(primaryAssociations.size()));
+    for (const quint8 index : std::as_const(primaryAssociations)) {
+        ipma.append(char(index));
+    }
+    for (int tile = 0; options.grid && tile < GRID_TILES; ++tile) {
+        appendBigEndian<quint16>(ipma, static_cast<quint16>(PRIMARY_ITEM + 1 + tile));
+        ipma.append(char(tileAssociations.size()));
+        for (const quint8 index : std::as_const(tileAssociations)) {
+            ipma.append(char(index));
+        }
+    }
+
+    QByteArray pitm;
+    appendBigEndian<quint16>(pitm, PRIMARY_ITEM);
+
+    const QByteArray meta = isoFullBox("hdlr", hdlr) + isoFullBox("pitm", pitm)
+        + isoBox("iprp", isoBox("ipco", ipco) + isoFullBox("ipma", ipma));
+
+    // Filler with the size of a compressed payload, from a fixed seed
+    QByteArray payload(qint64(options.size.width()) * options.size.height() * ISO_MEDIA_PAYLOAD_BITS_PER_PIXEL / 8, Qt::Uninitialized);
+    quint32 state = 0x12345678u;
+    for (char &byte : payload) {
+        state = state * 1664525u + 1013904223u;
+        byte = static_cast<char>(state >> 24);
+    }
+
+    return isoBox("ftyp", ftyp) + isoFullBox("meta", meta) + isoBox("mdat", payload);
+}
+
+QByteArray SyntheticCorpus::jpegXl(const Options &options)
+{
+    const QSize size = options.size;
+
+    auto encoder = JxlEncoderMake(nullptr);
+    if (!encoder) {
+        return {};
+    }
+
+    JxlBasicInfo info;
+    JxlEncoderInitBasicInfo(&info);
+    info.xsize = static_cast<uint32_t>(size.width());
+    info.ysize = static_cast<uint32_t>(size.height());
+    info.bits_per_sample = 16;
+    info.num_color_channels = 3;
+    info.uses_original_profile = JXL_FALSE;
+    if (JxlEncoderSetBasicInfo(encoder.get(), &info) != JXL_ENC_SUCCESS) {
+        return {};
+    }
+
+    JxlColorEncoding color{};
+    if (options.hdr) {
+        color.color_space = JXL_COLOR_SPACE_RGB;
+        color.white_point = JXL_WHITE_POINT_D65;
+        color.primaries = JXL_PRIMARIES_2100;
+        color.transfer_function = JXL_TRANSFER_FUNCTION_PQ;
+        color.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
+    } else {
+        JxlColorEncodingSetToSRGB(&color, JXL_FALSE);
+    }
+    if (JxlEncoderSetColorEncoding(encoder.get(), &color) != JXL_ENC_SUCCESS) {
+        return {};
+    }
+
+    // Fastest effort, the content does not matter to the probe
+    JxlEncoderFrameSettings *settings = JxlEncoderFrameSettingsCreate(encoder.get(), nullptr);
+    JxlEncoderFrameSettingsSetOption(settings, JXL_ENC_FRAME_SETTING_EFFORT, 1);
+
+    std::vector<quint16> pixels;
+    pixels.reserve(size_t(size.width()) * size.height() * 3);
+    for (int y = 0; y < size.height(); ++y) {
+        for (int x = 0; x < size.width(); ++x) {
+            for (int channel = 0; channel < 3; ++channel) {
+                pixels.push_back(sample(x, y, channel, size));
+            }
+        }
+    }
+    const JxlPixelFormat pixelFormat{3, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+    if (JxlEncoderAddImageFrame(settings, &pixelFormat, pixels.data(), pixels.size() * sizeof(quint16)) != JXL_ENC_SUCCESS) {
+        return {};
+    }
+    JxlEncoderCloseInput(encoder.get());
+
+    QByteArray out(64 * 1024, Qt::Uninitialized);
+    qsizetype written = 0;
+    for (;;) {
+        auto next = reinterpret_cast<uint8_t *>(out.data() + written);
+        size_t available = out.size() - written;
+        const JxlEncoderStatus status = JxlEncoderProcessOutput(encoder.get(), &next, &available);
+        written = reinterpret_cast<char *>(next) - out.data();
+        if (status == JXL_ENC_SUCCESS) {
+            break;
+        }
+        if (status != JXL_ENC_NEED_MORE_OUTPUT) {
+            qWarning() << "JPEG XL encoding failed";
+            return {};
+        }
+        out.resize(out.size() * 2);
+    }
+    out.truncate(written);
+    return out;
+}
+
+QByteArray SyntheticCorpus::tiff(const Options &options)
+{
+    const QSize size = options.size;
+    const QByteArray icc = iccProfile(options.hdr ? QByteArrayLiteral("Rec. 2020 PQ") : QByteArrayLiteral("sRGB IEC61966-2.1"));
+    const quint32 stripBytes = static_cast<quint32>(qint64(size.width()) * size.height() * 6);
+
+    struct Entry {
+        quint16 tag;
+        quint16 type;
+        quint32 count;
+        quint32 value;
+    };
+    constexpr quint16 SHORT = 3;
+    constexpr quint16 LONG = 4;
+    constexpr quint16 UNDEFINED = 7;
+    constexpr int entryCount = 11;
+
+    // Header, IFD, then the out of line values: bits per sample, ICC profile, pixel data
+    const quint32 ifdOffset = 8;
+    const quint32 bitsOffset = ifdOffset + 2 + entryCount * 12 + 4;
+    const quint32 iccOffset = bitsOffset + 6;
+    const quint32 stripOffset = iccOffset + static_cast<quint32>(icc.size());
+
+    const Entry entries[entryCount] = {
+        {256, LONG, 1, static_cast<quint32>(size.width())},  // ImageWidth
+        {257, LONG, 1, static_cast<quint32>(size.height())}, // ImageLength
+        {258, SHORT, 3, bitsOffset},                         // BitsPerSample
+        {259, SHORT, 1, 1},                                  // Compression: none
+        {262, SHORT, 1, 2},                                  // PhotometricInterpretation: RGB
+        {273, LONG, 1, stripOffset},                         // StripOffsets
+        {277, SHORT, 1, 3},                                  // SamplesPerPixel
+        {278, LONG, 1, static_cast<quint32>(size.height())}, // RowsPerStrip
+        {279, LONG, 1, stripBytes},                          // StripByteCounts
+        {284, SHORT, 1, 1},                                  // PlanarConfiguration: chunky
+        {34675, UNDEFINED, static_cast<quint32>(icc.size()), iccOffset}, // ICC profile
+    };
+
+    QByteArray out("II", 2);
+    appendLittleEndian<quint16>(out, 42);
+    appendLittleEndian<quint32>(out, ifdOffset);
+
+    appendLittleEndian<quint16>(out, entryCount);
+    for (const Entry &entry : entries) {
+        appendLittleEndian<quint16>(out, entry.tag);
+        appendLittleEndian<quint16>(out, entry.type);
+        appendLittleEndian<quint32>(out, entry.count);
+        // Single SHORT values are left aligned in the value field
+        if (entry.type == SHORT && entry.count == 1) {
+            appendLittleEndian<quint16>(out, static_cast<quint16>(entry.value));
+            appendLittleEndian<quint16>(out, 0);
+        } else {
+            appendLittleEndian<quint32>(out, entry.value);
+        }
+    }
+    appendLittleEndian<quint32>(out, 0); // No further IFD
+
+    for (int channel = 0; channel < 3; ++channel) {
+        appendLittleEndian<quint16>(out, 16);
+    }
+    out += icc;
+
+    out.reserve(out.size() + stripBytes);
+    for (int y = 0; y < size.height(); ++y) {
+        for (int x = 0; x < size.width(); ++x) {
+            for (int channel = 0; channel < 3; ++channel) {
+                appendLittleEndian<quint16>(out, sample(x, y, channel, size));
+            }
+        }
+    }
+    return out;
+}
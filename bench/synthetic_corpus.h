@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QList>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+
+#include "file_detector.h"
+
+// Writes small, deterministic sample files for every probed format, so that probe benchmarks do not
+// depend on downloaded images. The same options always produce byte-identical files.
+//
+// PNG, JPEG XL and TIFF files are complete and decodable. The AVIF and HEIC files only carry the
+// container boxes the probe reads (ftyp, meta with pitm, ipma and ispe, nclx colr and irot
+// properties) followed by an mdat of filler bytes, since encoding AV1 or HEVC would need libraries
+// the viewer does not link.
+class SyntheticCorpus
+{
+public:
+    struct Options {
+        QSize size = QSize(1024, 768);
+        // PQ / BT.2020 when true, sRGB / BT.709 otherwise
+        bool hdr = true;
+        // AVIF and HEIC only, write() skips the other formats when set: a grid of 2x2 tiles as
+        // phones write it, and an 'irot' of one anti-clockwise quarter turn
+        bool grid = false;
+        bool rotated = false;
+    };
+
+    struct File {
+        QString path;
+        FileDetector::ImageFormat format = FileDetector::ImageFormat::Unknown;
+        bool hdr = false;
+        // "grid", "rotated" or empty
+        QString variant;
+        // Expected from the probe, the stored size is always Options::size
+        QImageIOHandler::Transformations transformations = QImageIOHandler::TransformationNone;
+    };
+
+    // Writes one file per format into directory (created if needed), named after the format and
+    // options. Existing files with the same name are replaced.
+    static QList<File> write(const QString &directory, const Options &options);
+    // Copies the files of one write() count times into directory, e.g. for directory scans
+    static QStringList writeCopies(const QString &directory, const QList<File> &files, int count);
+
+    static QByteArray png(const Options &options);
+    static QByteArray isoMedia(FileDetector::ImageFormat format, const Options &options);
+    static QByteArray jpegXl(const Options &options);
+    static QByteArray tiff(const Options &options);
+};
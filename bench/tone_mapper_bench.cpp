@@ -0,0 +1,135 @@
+#include "tone_mapper_bench.h"
+#include "tone_mapper.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QTest>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace {
+    // ST 2084 constants, for the code values of the synthetic image
+    constexpr double PQ_M1 = 2610.0 / 16384.0;
+    constexpr double PQ_M2 = 2523.0 / 4096.0 * 128.0;
+    constexpr double PQ_C1 = 3424.0 / 4096.0;
+    constexpr double PQ_C2 = 2413.0 / 4096.0 * 32.0;
+    constexpr double PQ_C3 = 2392.0 / 4096.0 * 32.0;
+    constexpr double PQ_MAX_NITS = 10000.0;
+    // A little above the assumed content peak, so that clipping is measured too
+    constexpr double SYNTHETIC_PEAK_NITS = 1500.0;
+
+    quint16 pqCode(double nits)
+    {
+        const double y = std::pow(std::clamp(nits / PQ_MAX_NITS, 0.0, 1.0), PQ_M1);
+        const double value = std::pow((PQ_C1 + PQ_C2 * y) / (1.0 + PQ_C3 * y), PQ_M2);
+        return static_cast<quint16>(std::lround(value * 65535.0));
+    }
+
+    // Luminance rises along x, logarithmically like real content, and the hue turns along y
+    QImage syntheticPQImage(QSize size)
+    {
+        QImage image(size, QImage::Format_RGBA64);
+        for (int y = 0; y < size.height(); ++y) {
+            const double hue = 2.0 * M_PI * y / size.height();
+            const double weights[3] = {
+                0.5 + 0.5 * std::cos(hue),
+                0.5 + 0.5 * std::cos(hue - 2.0 * M_PI / 3.0),
+                0.5 + 0.5 * std::cos(hue + 2.0 * M_PI / 3.0),
+            };
+            auto line = reinterpret_cast<quint16 *>(image.scanLine(y));
+            for (int x = 0; x < size.width(); ++x) {
+                const double nits = std::pow(SYNTHETIC_PEAK_NITS, double(x) / std::max(size.width() - 1, 1));
+                line[4 * x + 0] = pqCode(nits * weights[0]);
+                line[4 * x + 1] = pqCode(nits * weights[1]);
+                line[4 * x + 2] = pqCode(nits * weights[2]);
+                line[4 * x + 3] = 0xffff;
+            }
+        }
+        return image;
+    }
+}
+
+Q_DECLARE_METATYPE(ToneMapper::Isa)
+
+// One row per kernel set the CPU supports. The fastest iteration is printed as MPix/s, QBENCHMARK
+// reports the mean time as usual.
+class ToneMapperBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ToneMapperBenchmark(QSize imageSize)
+        : m_imageSize(imageSize)
+    {
+    }
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        m_image = syntheticPQImage(m_imageSize);
+        QVERIFY(!m_image.isNull());
+        // The tables are built on first use, not inside the measurement
+        QVERIFY(!ToneMapper::toneMapPQToSRGB(m_image.copy(0, 0, 16, 16), FileDetector::ColorPrimaries::BT2020).isNull());
+    }
+
+    void toneMapPQToSRGB_data()
+    {
+        QTest::addColumn<ToneMapper::Isa>("isa");
+        for (const ToneMapper::Isa isa : ToneMapper::supportedIsas()) {
+            QTest::addRow("%s", ToneMapper::isaName(isa)) << isa;
+        }
+    }
+    void toneMapPQToSRGB()
+    {
+        QFETCH(ToneMapper::Isa, isa);
+
+        QImage result;
+        qint64 fastestNs = std::numeric_limits<qint64>::max();
+        QBENCHMARK {
+            QElapsedTimer timer;
+            timer.start();
+            result = ToneMapper::toneMapPQToSRGB(m_image, FileDetector::ColorPrimaries::BT2020, isa);
+            fastestNs = std::min(fastestNs, timer.nsecsElapsed());
+        }
+        QCOMPARE(result.size(), m_imageSize);
+        QCOMPARE(result.format(), QImage::Format_RGBA8888_Premultiplied);
+
+        const double megapixels = double(m_imageSize.width()) * m_imageSize.height() / 1e6;
+        std::printf("%-8s %dx%d: %.1f MPix/s\n", ToneMapper::isaName(isa), m_imageSize.width(), m_imageSize.height(),
+                    megapixels / (std::max<qint64>(fastestNs, 1) / 1e9));
+    }
+
+    // Every kernel set against the scalar one, they may differ by rounding only
+    void kernelsAgree()
+    {
+        const QImage sample = m_image.copy(0, 0, std::min(m_image.width(), 1024), std::min(m_image.height(), 256));
+        const QImage reference = ToneMapper::toneMapPQToSRGB(sample, FileDetector::ColorPrimaries::BT2020, ToneMapper::Isa::Scalar);
+        for (const ToneMapper::Isa isa : ToneMapper::supportedIsas()) {
+            const QImage result = ToneMapper::toneMapPQToSRGB(sample, FileDetector::ColorPrimaries::BT2020, isa);
+            int maxDifference = 0;
+            for (int y = 0; y < sample.height(); ++y) {
+                const uchar *a = reference.constScanLine(y);
+                const uchar *b = result.constScanLine(y);
+                for (int i = 0; i < sample.width() * 4; ++i) {
+                    maxDifference = std::max(maxDifference, std::abs(a[i] - b[i]));
+                }
+            }
+            QVERIFY2(maxDifference <= 1, ToneMapper::isaName(isa));
+        }
+    }
+
+private:
+    const QSize m_imageSize;
+    QImage m_image;
+};
+
+int runToneMapperBenchmark(QSize imageSize, const QStringList &arguments)
+{
+    ToneMapperBenchmark benchmark(imageSize);
+    return QTest::qExec(&benchmark, arguments);
+}
+
+#include "tone_mapper_bench.moc"
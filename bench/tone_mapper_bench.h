@@ -0,0 +1,8 @@
+#pragma once
+
+#include <QSize>
+#include <QStringList>
+
+// Throughput of the PQ to SDR tone mapping fallback per kernel set, on a synthetic image of the
+// given size. arguments are passed to QTest like for the probe benchmarks.
+int runToneMapperBenchmark(QSize imageSize, const QStringList &arguments);
@@ -1,12 +1,21 @@
 #include "app.h"
+#include "decoded_image_cache.h"
+#include "memory_budget.h"
+#include "directory_scanner.h"
+#include "directory_watcher.h"
 #include "file_detector.h"
+#include "image_list_model.h"
+#include "image_prefetcher.h"
+#include "metrics.h"
+#include "tone_mapper.h"
+#include "trace.h"
 
 #include <QDir>
 #include <QCursor>
+#include <QDebug>
 #include <QEvent>
 #include <QFileInfo>
 #include <QGuiApplication>
-#include <QImageReader>
 #include <QMimeDatabase>
 #include <QPlatformSurfaceEvent>
 #include <QQuickWindow>
@@ -15,13 +24,58 @@
 #include <QUrl>
 #include <qpa/qplatformwindow_p.h>
 
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+
 namespace {
     constexpr int DEFAULT_PQ_REFERENCE_LUMINANCE = 203;
+    // Number of images decoded ahead in the paging direction, the previous one is decoded as well
+    constexpr int PREFETCH_AHEAD = 2;
+    // Directory change notifications come in bursts, e.g. while an export writes many files
+    constexpr int DIRECTORY_SYNC_DELAY_MS = 250;
+    // The scene graph only renders on changes, longer gaps between frames are idle time, not jitter
+    constexpr std::chrono::milliseconds MAX_FRAME_INTERVAL{100};
 }
 
 ImageNavigator::ImageNavigator(QObject *parent)
     : QObject(parent)
+    , m_model(new ImageListModel(this))
+    , m_scanner(new DirectoryScanner(this))
+    , m_prefetcher(new ImagePrefetcher(this))
+    , m_watcher(new DirectoryWatcher(this))
 {
+    connect(m_scanner, &DirectoryScanner::imagesFound, this, &ImageNavigator::mergeScannedImages);
+    connect(m_scanner, &DirectoryScanner::finished, this, [this]() {
+        qDebug() << "Directory scan finished:" << m_model->count() << "images in" << m_model->directory().absolutePath();
+        // Catch up with what changed during the scan
+        m_scanning = false;
+        applyDirectoryChanges();
+    });
+
+    m_syncTimer.setSingleShot(true);
+    m_syncTimer.setInterval(DIRECTORY_SYNC_DELAY_MS);
+    connect(&m_syncTimer, &QTimer::timeout, this, &ImageNavigator::applyDirectoryChanges);
+
+    // Later events for the same file override earlier ones, only the state after the burst matters
+    connect(m_watcher, &DirectoryWatcher::fileAdded, this, [this](const QString &fileName) {
+        m_pendingEntries.insert(fileName, true);
+        scheduleDirectoryChanges();
+    });
+    connect(m_watcher, &DirectoryWatcher::fileRemoved, this, [this](const QString &fileName) {
+        m_pendingEntries.insert(fileName, false);
+        scheduleDirectoryChanges();
+    });
+    connect(m_watcher, &DirectoryWatcher::fileRenamed, this, [this](const QString &oldFileName, const QString &newFileName) {
+        m_pendingEntries.insert(oldFileName, false);
+        m_pendingEntries.insert(newFileName, true);
+        m_pendingRenames.append({oldFileName, newFileName});
+        scheduleDirectoryChanges();
+    });
+    connect(m_watcher, &DirectoryWatcher::overflowed, this, [this]() {
+        m_relistPending = true;
+        scheduleDirectoryChanges();
+    });
 }
 
 void ImageNavigator::initializeFromPath(const QString &imagePath)
@@ -29,28 +83,96 @@ void ImageNavigator::initializeFromPath(const QString &imagePath)
     loadImageListFromDirectory(imagePath);
 }
 
+int ImageNavigator::totalImages() const
+{
+    return m_model->count();
+}
+
 void ImageNavigator::navigateNext()
 {
-    if (m_imageList.isEmpty() || m_currentIndex < 0) {
+    if (m_model->isEmpty() || m_currentIndex < 0) {
         return;
     }
 
-    m_currentIndex = (m_currentIndex + 1) % m_imageList.size();
-    m_currentImagePath = m_imageList[m_currentIndex];
-    Q_EMIT currentImageChanged(m_currentImagePath);
+    m_direction = 1;
+    navigateTo((m_currentIndex + 1) % m_model->count());
 }
 
 void ImageNavigator::navigatePrevious()
 {
-    if (m_imageList.isEmpty() || m_currentIndex < 0) {
+    if (m_model->isEmpty() || m_currentIndex < 0) {
         return;
     }
 
-    m_currentIndex = (m_currentIndex - 1 + m_imageList.size()) % m_imageList.size();
-    m_currentImagePath = m_imageList[m_currentIndex];
+    m_direction = -1;
+    navigateTo((m_currentIndex - 1 + m_model->count()) % m_model->count());
+}
+
+void ImageNavigator::navigateToIndex(int index)
+{
+    if (index < 0 || index >= m_model->count() || index == m_currentIndex) {
+        return;
+    }
+
+    m_direction = index > m_currentIndex ? 1 : -1;
+    navigateTo(index);
+}
+
+void ImageNavigator::navigateTo(int index)
+{
+    TraceSpan span("navigation", "ImageNavigator::navigateTo");
+    setCurrentIndex(index);
+    setCurrentImage(m_model->fileName(m_currentIndex));
+    prefetchNeighbors();
+}
+
+void ImageNavigator::setCurrentIndex(int index)
+{
+    if (m_currentIndex != index) {
+        m_currentIndex = index;
+        Q_EMIT currentIndexChanged();
+    }
+}
+
+void ImageNavigator::setCurrentImage(const QString &fileName)
+{
+    const QString localPath = m_model->directory().absoluteFilePath(fileName);
+    m_currentImagePath = QUrl::fromLocalFile(localPath).toString();
+    DecodedImageCache::instance().setPinned(localPath);
+    // Ends with the first frame that shows the image, see TiledImageItem
+    Trace::asyncBegin("load", "Load image", Trace::id(m_currentImagePath), localPath);
     Q_EMIT currentImageChanged(m_currentImagePath);
 }
 
+void ImageNavigator::prefetchNeighbors()
+{
+    const int count = m_model->count();
+    if (count < 2 || m_currentIndex < 0) {
+        return;
+    }
+    TraceSpan span("navigation", "ImageNavigator::prefetchNeighbors");
+
+    // Priority order: next in paging direction first, then the one we came from, then further ahead
+    QList<int> offsets = {m_direction, -m_direction};
+    for (int distance = 2; distance <= PREFETCH_AHEAD; ++distance) {
+        offsets.append(distance * m_direction);
+    }
+
+    QStringList paths;
+    for (int offset : offsets) {
+        const int index = ((m_currentIndex + offset) % count + count) % count;
+        if (index == m_currentIndex) {
+            continue;
+        }
+        const QString localPath = m_model->localPath(index);
+        if (!paths.contains(localPath)) {
+            paths.append(localPath);
+        }
+    }
+
+    m_prefetcher->prefetch(paths);
+}
+
 void ImageNavigator::loadImageListFromDirectory(const QString &currentImagePath)
 {
     QString localPath = currentImagePath;
@@ -63,39 +185,176 @@ void ImageNavigator::loadImageListFromDirectory(const QString &currentImagePath)
         return;
     }
 
-    QDir directory = currentFile.dir();
+    m_syncTimer.stop();
+    m_pendingEntries.clear();
+    m_pendingRenames.clear();
+    m_relistPending = false;
+
+    // Show the current image right away, the rest of the directory is merged in as the scan finds it
+    m_model->reset(currentFile.dir(), {currentFile.fileName()});
+    m_currentIndex = -1;
+    setCurrentIndex(0);
+    setCurrentImage(currentFile.fileName());
+
+    // Before the scan lists the directory, so that no change falls between the two
+    m_watcher->watch(m_model->directory().absolutePath());
+    m_scanning = true;
+    m_scanner->scan(m_model->directory().absolutePath(), currentFile.fileName());
+}
+
+void ImageNavigator::mergeScannedImages(const QStringList &fileNames)
+{
+    TraceSpan span("navigation", "ImageNavigator::mergeScannedImages");
+    const QString currentFileName = m_model->fileName(m_currentIndex);
+
+    // Both lists are sorted by name, the current image may already be listed
+    if (m_model->insertSorted(fileNames) == 0) {
+        return;
+    }
+
+    // Keep pointing at the image on screen
+    setCurrentIndex(m_model->indexOf(currentFileName));
+
+    // New neighbors may have appeared
+    prefetchNeighbors();
+}
+
+void ImageNavigator::scheduleDirectoryChanges()
+{
+    // At most one sync per interval while a burst goes on; during the scan the changes wait for its end
+    if (!m_scanning && !m_syncTimer.isActive()) {
+        m_syncTimer.start(DIRECTORY_SYNC_DELAY_MS);
+    }
+}
 
-    // Get all files sorted by name
-    QStringList allFiles = directory.entryList(QDir::Files, QDir::Name);
+void ImageNavigator::applyDirectoryChanges()
+{
+    TraceSpan span("navigation", "ImageNavigator::applyDirectoryChanges");
+
+    // Renamed images keep their probe result and move to their new place; the image on screen stays on
+    // screen under its new name. In order, so that chains of renames end up at the last name.
+    QString currentFileName = m_model->fileName(m_currentIndex);
+    bool currentRenamed = false;
+    for (const auto &[oldFileName, newFileName] : std::as_const(m_pendingRenames)) {
+        if (m_model->remove(oldFileName) < 0) {
+            continue;
+        }
+        // A no-op when it replaced another image
+        m_model->insertSorted({newFileName});
+        if (oldFileName == currentFileName) {
+            currentFileName = newFileName;
+            currentRenamed = true;
+        }
+    }
+    if (!m_pendingRenames.isEmpty()) {
+        setCurrentIndex(m_model->indexOf(currentFileName));
+    }
+    if (currentRenamed) {
+        setCurrentImage(currentFileName);
+    }
+    // Against the model after the renames, a rename target that is gone again shows up as removed
+    if (m_relistPending) {
+        relistDirectory();
+    }
 
-    m_imageList.clear();
-    for (const QString &fileName : allFiles) {
-        QString fullPath = directory.absoluteFilePath(fileName);
-        
-        if (FileDetector::isSupportedImageFormat(fullPath)) {
-            m_imageList.append(QUrl::fromLocalFile(fullPath).toString());
+    QStringList removed;
+    QStringList added;
+    QStringList modified;
+    for (auto it = m_pendingEntries.cbegin(); it != m_pendingEntries.cend(); ++it) {
+        const bool listed = m_model->indexOf(it.key()) >= 0;
+        if (!it.value() && listed) {
+            removed.append(it.key());
+        } else if (it.value() && !listed) {
+            added.append(it.key());
+        } else if (it.value()) {
+            modified.append(it.key());
         }
     }
+    const bool renamed = !m_pendingRenames.isEmpty();
+    m_pendingEntries.clear();
+    m_pendingRenames.clear();
 
-    // Find current file index
-    QString currentUrl = QUrl::fromLocalFile(localPath).toString();
-    m_currentIndex = m_imageList.indexOf(currentUrl);
+    for (const QString &fileName : std::as_const(removed)) {
+        removeImage(fileName);
+    }
 
-    if (m_currentIndex >= 0) {
-        m_currentImagePath = currentUrl;
-    } else {
-        // Fallback: use provided path as current
-        m_currentImagePath = currentImagePath;
-        m_currentIndex = 0;
+    // Rewritten in place: decoded and prefetched frames show the old content
+    currentFileName = m_model->fileName(m_currentIndex);
+    for (const QString &fileName : std::as_const(modified)) {
+        DecodedImageCache::instance().remove(m_model->directory().absoluteFilePath(fileName));
+        if (fileName == currentFileName) {
+            Q_EMIT currentImageModified();
+        }
     }
 
-    Q_EMIT currentImageChanged(m_currentImagePath);
+    // The scanner reports them sorted when asked in order, for the merge into the model
+    if (!added.isEmpty()) {
+        std::sort(added.begin(), added.end());
+        m_scanner->probe(m_model->directory().absolutePath(), added);
+    }
+
+    if (!removed.isEmpty() || !modified.isEmpty() || renamed) {
+        prefetchNeighbors();
+    }
+}
+
+void ImageNavigator::relistDirectory()
+{
+    TraceSpan span("navigation", "ImageNavigator::relistDirectory");
+    m_relistPending = false;
+
+    // Sorted like the model, so both differences are a single linear pass
+    const QStringList &imageList = m_model->fileNames();
+    const QStringList entries = m_model->directory().entryList(QDir::Files, QDir::Name);
+
+    // The listing is the truth, whatever the events said
+    m_pendingEntries.clear();
+    QStringList removed;
+    std::set_difference(imageList.cbegin(), imageList.cend(), entries.cbegin(), entries.cend(),
+                        std::back_inserter(removed));
+    for (const QString &fileName : std::as_const(removed)) {
+        m_pendingEntries.insert(fileName, false);
+    }
+    QStringList added;
+    std::set_difference(entries.cbegin(), entries.cend(), imageList.cbegin(), imageList.cend(),
+                        std::back_inserter(added));
+    for (const QString &fileName : std::as_const(added)) {
+        m_pendingEntries.insert(fileName, true);
+    }
+}
+
+void ImageNavigator::removeImage(const QString &fileName)
+{
+    const int index = m_model->remove(fileName);
+    if (index < 0) {
+        return;
+    }
+
+    if (index < m_currentIndex) {
+        setCurrentIndex(m_currentIndex - 1);
+    } else if (index == m_currentIndex) {
+        // The image on screen was deleted, show the one that took its place
+        if (m_model->isEmpty()) {
+            setCurrentIndex(-1);
+        } else {
+            navigateTo(m_currentIndex % m_model->count());
+        }
+    }
 }
 
 ColorController::ColorController(QObject *parent)
     : QObject(parent)
     , m_global(std::make_unique<ColorManagementGlobal>())
 {
+    // The supported features follow the bind, wait for them so that the first decode already knows
+    // whether HDR images have to be tone mapped
+    if (m_global->isActive()) {
+        if (auto waylandApp = qGuiApp->nativeInterface<QNativeInterface::QWaylandApplication>()) {
+            wl_display_roundtrip(waylandApp->display());
+        }
+    }
+    updateToneMapping();
+    connect(m_global.get(), &ColorManagementGlobal::capabilitiesChanged, this, &ColorController::updateToneMapping);
 }
 
 ColorController::~ColorController() = default;
@@ -108,6 +367,11 @@ void ColorController::setupWindow(QQuickWindow *window)
 
 void ColorController::setPQMode(QQuickWindow *window, int referenceLuminance)
 {
+    // HDR images were tone mapped to sRGB while decoding
+    if (ToneMapper::isEnabled()) {
+        setColorMode(window, ColorManagementSurface::ColorMode::Default);
+        return;
+    }
     m_windowData[window] = {
         .colorMode = std::nullopt,
         .referenceLuminance = referenceLuminance,
@@ -124,6 +388,18 @@ void ColorController::setColorMode(QQuickWindow *window, ColorManagementSurface:
     createSurfaceForWindow(window);
 }
 
+void ColorController::preparePQMode(QQuickWindow *window, int referenceLuminance)
+{
+    if (ToneMapper::isEnabled()) {
+        return;
+    }
+    // Before the surface exists, setupWindow() requests the PQ description anyway
+    const auto it = m_surfaces.find(window);
+    if (it != m_surfaces.end()) {
+        it->second->preparePQMode(referenceLuminance);
+    }
+}
+
 QString ColorController::getPreferredDescription(QQuickWindow *window) const
 {
     const auto it = m_surfaces.find(window);
@@ -148,10 +424,20 @@ bool ColorController::eventFilter(QObject *watched, QEvent *event)
     return false;
 }
 
+void ColorController::updateToneMapping()
+{
+    const bool enabled = !m_global->supportsPQ();
+    if (enabled != ToneMapper::isEnabled()) {
+        qInfo() << (enabled ? "Compositor cannot show PQ surfaces, tone mapping HDR images to SDR using" : "Compositor supports PQ surfaces, tone mapping disabled, kernels")
+                 << ToneMapper::isaName(ToneMapper::bestIsa());
+    }
+    ToneMapper::setEnabled(enabled);
+}
+
 void ColorController::createSurfaceForWindow(QQuickWindow *window)
 {
     const auto it = m_windowData.find(window);
-    if (it == m_windowData.end()) {
+    if (it == m_windowData.end() || !m_global->isActive()) {
         return;
     }
 
@@ -194,6 +480,15 @@ void App::setupMainWindow(QQuickWindow *window)
 {
     m_mainWindow = window;
     m_colorController->setupWindow(window);
+
+    // Frame pacing, measured on the render thread while zooming, panning or uploading tiles
+    connect(window, &QQuickWindow::frameSwapped, window, [last = std::chrono::steady_clock::time_point{}]() mutable {
+        const auto now = std::chrono::steady_clock::now();
+        if (last.time_since_epoch().count() != 0 && now - last < MAX_FRAME_INTERVAL) {
+            Metrics::instance().frameInterval.record(now - last);
+        }
+        last = now;
+    }, Qt::DirectConnection);
 }
 
 void App::adjustWindowSizeToImage(QQuickWindow *window, const QString &imagePath)
@@ -202,20 +497,14 @@ void App::adjustWindowSizeToImage(QQuickWindow *window, const QString &imagePath
         return;
     }
 
-    // Convert URL to local file path if needed
-    QString localPath = imagePath;
-    if (localPath.startsWith(QStringLiteral("file://"))) {
-        localPath = QUrl(localPath).toLocalFile();
-    }
-
-    // Read image dimensions
-    QImageReader reader(localPath);
-    if (!reader.canRead()) {
-        qWarning() << "Cannot read image for size adjustment:" << localPath;
+    // Image dimensions as displayed, from the cached probe
+    const FileDetector::ImageProbe probe = FileDetector::probe(imagePath);
+    if (!probe.isSupported) {
+        qWarning() << "Cannot read image for size adjustment:" << imagePath;
         return;
     }
 
-    QSize imageSize = reader.size();
+    QSize imageSize = probe.displaySize();
     if (!imageSize.isValid() || imageSize.width() <= 0 || imageSize.height() <= 0) {
         qWarning() << "Invalid image size:" << imageSize;
         return;
@@ -268,11 +557,13 @@ void App::adjustWindowSizeToImage(QQuickWindow *window, const QString &imagePath
 
 void App::enablePQMode(QQuickWindow *window, int referenceLuminance)
 {
+    TraceSpan span("color", "App::enablePQMode");
     m_colorController->setPQMode(window, referenceLuminance);
 }
 
 void App::disablePQMode(QQuickWindow *window)
 {
+    TraceSpan span("color", "App::disablePQMode");
     // Set to sRGB mode for SDR images
     m_colorController->setColorMode(window, ColorManagementSurface::ColorMode::Default);
 }
@@ -285,9 +576,23 @@ void App::setColorProfile(QQuickWindow *window, int profileId)
 
 bool App::isImageHDR(const QString &imagePath)
 {
+    TraceSpan span("probe", "App::isImageHDR");
+    span.setDetail(imagePath);
     return FileDetector::isImageHDR(imagePath);
 }
 
+bool App::prepareColorMode(QQuickWindow *window, const QString &imagePath)
+{
+    TraceSpan span("color", "App::prepareColorMode");
+    span.setDetail(imagePath);
+    // SDR images unset the description, there is nothing to create
+    const bool hdr = FileDetector::isImageHDR(imagePath);
+    if (hdr) {
+        m_colorController->preparePQMode(window, DEFAULT_PQ_REFERENCE_LUMINANCE);
+    }
+    return hdr;
+}
+
 void App::setCursorHidden(QQuickWindow *window, bool hidden)
 {
     if (!window) {
@@ -311,19 +616,55 @@ void App::initializeImageList(const QString &imagePath)
 
 void App::navigateToNext()
 {
+    TraceSpan span("navigation", "App::navigateToNext");
     m_imageNavigator->navigateNext();
 }
 
 void App::navigateToPrevious()
 {
+    TraceSpan span("navigation", "App::navigateToPrevious");
     m_imageNavigator->navigatePrevious();
 }
 
+void App::navigateToIndex(int index)
+{
+    TraceSpan span("navigation", "App::navigateToIndex");
+    m_imageNavigator->navigateToIndex(index);
+}
+
+QVariantMap App::cacheStatistics() const
+{
+    const auto stats = DecodedImageCache::instance().statistics();
+    return {
+        {QStringLiteral("hits"), stats.hits},
+        {QStringLiteral("misses"), stats.misses},
+        {QStringLiteral("bytesResident"), stats.bytesResident},
+        {QStringLiteral("memoryLimit"), stats.memoryLimit},
+        {QStringLiteral("memoryUsed"), MemoryBudget::instance().used()},
+        {QStringLiteral("imageCount"), stats.imageCount},
+    };
+}
+
+QVariantMap App::performanceStatistics() const
+{
+    return Metrics::instance().snapshot();
+}
+
 QString App::currentImagePath() const
 {
     return m_imageNavigator->currentImagePath();
 }
 
+QAbstractItemModel *App::imageListModel() const
+{
+    return m_imageNavigator->model();
+}
+
+int App::currentIndex() const
+{
+    return m_imageNavigator->currentIndex();
+}
+
 QString App::preferredDescription() const
 {
     if (m_mainWindow) {
@@ -336,6 +677,10 @@ void App::connectSignals()
 {
     connect(m_imageNavigator.get(), &ImageNavigator::currentImageChanged,
             this, &App::currentImagePathChanged);
+    connect(m_imageNavigator.get(), &ImageNavigator::currentImageModified,
+            this, &App::currentImageModified);
+    connect(m_imageNavigator.get(), &ImageNavigator::currentIndexChanged,
+            this, &App::currentIndexChanged);
     connect(m_colorController.get(), &ColorController::preferredDescriptionChanged,
             this, &App::preferredDescriptionChanged);
 }
@@ -1,17 +1,27 @@
 #pragma once
 
+#include <QAbstractItemModel>
+#include <QHash>
 #include <QObject>
 #include <QQmlEngine>
 #include <QQuickWindow>
 #include <QStringList>
+#include <QTimer>
 #include <QUrl>
+#include <QVariantMap>
 
 #include <memory>
 #include <optional>
 #include <unordered_map>
+#include <utility>
 
 #include "color_management.h"
 
+class DirectoryScanner;
+class DirectoryWatcher;
+class ImageListModel;
+class ImagePrefetcher;
+
 class ImageNavigator : public QObject
 {
     Q_OBJECT
@@ -22,20 +32,49 @@ public:
     void initializeFromPath(const QString &imagePath);
     void navigateNext();
     void navigatePrevious();
+    void navigateToIndex(int index);
     
     QString currentImagePath() const { return m_currentImagePath; }
     int currentIndex() const { return m_currentIndex; }
-    int totalImages() const { return m_imageList.size(); }
+    int totalImages() const;
+    ImageListModel *model() const { return m_model; }
 
 Q_SIGNALS:
     void currentImageChanged(const QString &imagePath);
+    // The file on screen was rewritten in place, e.g. by a new export
+    void currentImageModified();
+    void currentIndexChanged();
 
 private:
     void loadImageListFromDirectory(const QString &currentImagePath);
-
-    QStringList m_imageList;
+    void mergeScannedImages(const QStringList &fileNames);
+    void scheduleDirectoryChanges();
+    void applyDirectoryChanges();
+    // After lost events, the pending changes are taken from a full listing instead
+    void relistDirectory();
+    void removeImage(const QString &fileName);
+    void navigateTo(int index);
+    void setCurrentIndex(int index);
+    void setCurrentImage(const QString &fileName);
+    void prefetchNeighbors();
+
+    // Sorted file names of the directory. Filled incrementally by the scanner,
+    // navigation works on the partial list.
+    ImageListModel *m_model;
     QString m_currentImagePath;
     int m_currentIndex = -1;
+    // +1 when paging forward, -1 when paging backward
+    int m_direction = 1;
+    DirectoryScanner *m_scanner;
+    ImagePrefetcher *m_prefetcher;
+    // Watches the directory from the start of the scan, changes are applied in place once it finished
+    DirectoryWatcher *m_watcher;
+    QTimer m_syncTimer;
+    bool m_scanning = false;
+    // Changes since the last sync: whether each touched file exists now, and the renames in order
+    QHash<QString, bool> m_pendingEntries;
+    QList<std::pair<QString, QString>> m_pendingRenames;
+    bool m_relistPending = false;
 };
 
 class ColorController : public QObject
@@ -49,6 +88,8 @@ public:
     void setupWindow(QQuickWindow *window);
     void setPQMode(QQuickWindow *window, int referenceLuminance);
     void setColorMode(QQuickWindow *window, ColorManagementSurface::ColorMode mode);
+    // Without applying it, see ColorManagementSurface::preparePQMode()
+    void preparePQMode(QQuickWindow *window, int referenceLuminance);
     
     QString getPreferredDescription(QQuickWindow *window) const;
 
@@ -60,6 +101,8 @@ protected:
 
 private:
     void createSurfaceForWindow(QQuickWindow *window);
+    // HDR images are tone mapped on the CPU unless the compositor can show them as PQ
+    void updateToneMapping();
 
     struct WindowData {
         std::optional<ColorManagementSurface::ColorMode> colorMode;
@@ -78,6 +121,8 @@ class App : public QObject
     QML_SINGLETON
 
     Q_PROPERTY(QString currentImagePath READ currentImagePath NOTIFY currentImagePathChanged)
+    Q_PROPERTY(QAbstractItemModel *imageListModel READ imageListModel CONSTANT)
+    Q_PROPERTY(int currentIndex READ currentIndex NOTIFY currentIndexChanged)
     Q_PROPERTY(QString preferredDescription READ preferredDescription NOTIFY preferredDescriptionChanged)
 
 public:
@@ -93,6 +138,9 @@ public:
     Q_INVOKABLE void disablePQMode(QQuickWindow *window);
     Q_INVOKABLE void setColorProfile(QQuickWindow *window, int profileId);
     Q_INVOKABLE bool isImageHDR(const QString &imagePath);
+    // HDR classification from the probe, before decoding; the matching image description is created
+    // while the image decodes, so that enablePQMode() applies it with the first frame of the image
+    Q_INVOKABLE bool prepareColorMode(QQuickWindow *window, const QString &imagePath);
 
     // Cursor management
     Q_INVOKABLE void setCursorHidden(QQuickWindow *window, bool hidden);
@@ -101,13 +149,23 @@ public:
     Q_INVOKABLE void initializeImageList(const QString &imagePath);
     Q_INVOKABLE void navigateToNext();
     Q_INVOKABLE void navigateToPrevious();
+    Q_INVOKABLE void navigateToIndex(int index);
+
+    // Decoded image cache statistics (hits, misses, bytesResident, memoryLimit, memoryUsed, imageCount)
+    Q_INVOKABLE QVariantMap cacheStatistics() const;
+    // Timing histograms and counters for the stats overlay, see Metrics::snapshot()
+    Q_INVOKABLE QVariantMap performanceStatistics() const;
 
     // Properties
     QString currentImagePath() const;
+    QAbstractItemModel *imageListModel() const;
+    int currentIndex() const;
     QString preferredDescription() const;
 
 Q_SIGNALS:
     void currentImagePathChanged();
+    void currentImageModified();
+    void currentIndexChanged();
     void preferredDescriptionChanged();
 
 private:
@@ -1,9 +1,12 @@
 #include "color_management.h"
+#include "trace.h"
 
+#include <QDebug>
 #include <QPointF>
 #include <QString>
 #include <qpa/qplatformwindow_p.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <sstream>
 #include <string_view>
@@ -11,6 +14,13 @@
 namespace {
     constexpr double PRIMARIES_SCALE = 1'000'000.0;
     constexpr double LUMINANCE_SCALE = 10'000.0;
+    // Parameters of the SDR sRGB and the HDR PQ descriptions, in cd/m²
+    constexpr int SRGB_REFERENCE_LUMINANCE = 100;
+    constexpr int SRGB_MAX_LUMINANCE = 200;
+    constexpr int PQ_MAX_LUMINANCE = 10'000;
+    constexpr int PQ_MASTERING_MAX_LUMINANCE = 1'000;
+    // Per surface; a handful of modes and reference luminances
+    constexpr std::size_t MAX_CACHED_DESCRIPTIONS = 8;
 }
 
 ColorManagementGlobal::ColorManagementGlobal()
@@ -24,9 +34,42 @@ ColorManagementGlobal::ColorManagementGlobal()
     });
 }
 
-void ColorManagementGlobal::wp_color_manager_v1_supported_feature(uint32_t /*feature*/)
+void ColorManagementGlobal::wp_color_manager_v1_supported_feature(uint32_t feature)
 {
-    // Note: Should check supported features before using them
+    if (feature < 32) {
+        m_features |= 1u << feature;
+    }
+}
+
+void ColorManagementGlobal::wp_color_manager_v1_supported_tf_named(uint32_t tf)
+{
+    if (tf < 32) {
+        m_transferFunctions |= 1u << tf;
+    }
+}
+
+void ColorManagementGlobal::wp_color_manager_v1_supported_primaries_named(uint32_t primaries)
+{
+    if (primaries < 32) {
+        m_primaries |= 1u << primaries;
+    }
+}
+
+void ColorManagementGlobal::wp_color_manager_v1_done()
+{
+    m_done = true;
+    Q_EMIT capabilitiesChanged();
+}
+
+bool ColorManagementGlobal::supportsPQ() const
+{
+    return isActive() && m_done
+        && supportsFeature(feature_parametric)
+        && supportsFeature(feature_set_luminances)
+        // Also covers set_mastering_luminance
+        && supportsFeature(feature_set_mastering_display_primaries)
+        && (m_transferFunctions & (1u << transfer_function_st2084_pq))
+        && (m_primaries & (1u << primaries_bt2020));
 }
 
 ImageDescriptionInfo::ImageDescriptionInfo(::wp_image_description_info_v1 *info)
@@ -151,29 +194,33 @@ CompositorImageDescription::~CompositorImageDescription()
     wp_image_description_v1_destroy(object());
 }
 
-PendingImageDescription::PendingImageDescription(QQuickWindow *window,
-                                               ColorManagementSurface *surface,
+CachedImageDescription::CachedImageDescription(ColorManagementSurface *surface,
                                                ::wp_image_description_v1 *descr,
                                                uint32_t renderIntent)
     : QtWayland::wp_image_description_v1(descr)
-    , m_window(window)
     , m_surface(surface)
     , m_renderIntent(renderIntent)
 {
 }
 
-PendingImageDescription::~PendingImageDescription()
+CachedImageDescription::~CachedImageDescription()
 {
     wp_image_description_v1_destroy(object());
 }
 
-void PendingImageDescription::wp_image_description_v1_ready(uint32_t /*identity*/)
+void CachedImageDescription::wp_image_description_v1_ready(uint32_t /*identity*/)
 {
-    if (m_window && m_surface) {
-        wp_color_management_surface_v1_set_image_description(m_surface->object(), object(), m_renderIntent);
-        m_window->requestUpdate();
-    }
-    delete this;
+    Trace::asyncEnd("color", "Image description", reinterpret_cast<quintptr>(this));
+    m_ready = true;
+    m_surface->descriptionReady(this);
+}
+
+void CachedImageDescription::wp_image_description_v1_failed(uint32_t cause, const QString &msg)
+{
+    Trace::asyncEnd("color", "Image description", reinterpret_cast<quintptr>(this));
+    qWarning() << "Compositor rejected image description:" << cause << msg;
+    // Deletes this
+    m_surface->descriptionFailed(this);
 }
 
 ColorManagementFeedback::ColorManagementFeedback(::wp_color_management_surface_feedback_v1 *obj)
@@ -228,29 +275,88 @@ ColorManagementSurface::~ColorManagementSurface()
 void ColorManagementSurface::setColorMode(ColorMode mode)
 {
     if (mode == ColorMode::Default) {
+        // Also a request: a description that becomes ready later must not replace it
+        ++m_generation;
         unset_image_description();
         m_window->requestUpdate();
         return;
     }
 
-    createParametricDescription(mode);
+    switch (mode) {
+    case ColorMode::sRGB_Gamma22:
+        requestDescription({.mode = mode, .referenceLuminance = SRGB_REFERENCE_LUMINANCE,
+                            .maxLuminance = SRGB_MAX_LUMINANCE, .masteringMaxLuminance = SRGB_MAX_LUMINANCE});
+        break;
+    case ColorMode::BT2020_Gamma22:
+    case ColorMode::BT2020_PQ:
+    case ColorMode::PAL_M:
+    case ColorMode::CIE1931_XYZ:
+        // Luminances are left to the compositor's defaults for the transfer function
+        requestDescription({.mode = mode});
+        break;
+    default:
+        break;
+    }
 }
 
 void ColorManagementSurface::setPQMode(int referenceLuminance)
 {
-    createPQDescription(referenceLuminance);
+    requestDescription(pqDescriptionKey(referenceLuminance));
+}
+
+void ColorManagementSurface::preparePQMode(int referenceLuminance)
+{
+    if (!m_global->supportsFeature(QtWayland::wp_color_manager_v1::feature_parametric)) {
+        return;
+    }
+    findOrCreateDescription(pqDescriptionKey(referenceLuminance));
+}
+
+ColorManagementSurface::DescriptionKey ColorManagementSurface::pqDescriptionKey(int referenceLuminance)
+{
+    return {.mode = ColorMode::BT2020_PQ, .referenceLuminance = referenceLuminance,
+            .maxLuminance = PQ_MAX_LUMINANCE, .masteringMaxLuminance = PQ_MASTERING_MAX_LUMINANCE};
+}
+
+void ColorManagementSurface::requestDescription(const DescriptionKey &key)
+{
+    if (!m_global->supportsFeature(QtWayland::wp_color_manager_v1::feature_parametric)) {
+        qWarning() << "Compositor cannot create parametric image descriptions, keeping the default";
+        return;
+    }
+    const quint64 generation = ++m_generation;
+    const auto it = findOrCreateDescription(key);
+    it->second.lastUsed = generation;
+    it->second.requested = generation;
+
+    // Otherwise applied by descriptionReady(), unless another request came in first
+    if (it->second.description->isReady()) {
+        apply(*it->second.description);
+    }
 }
 
-void ColorManagementSurface::createParametricDescription(ColorMode mode)
+std::map<ColorManagementSurface::DescriptionKey, ColorManagementSurface::CacheEntry>::iterator
+ColorManagementSurface::findOrCreateDescription(const DescriptionKey &key)
 {
+    auto it = m_descriptions.find(key);
+    if (it == m_descriptions.end()) {
+        it = m_descriptions.emplace(key, CacheEntry{createDescription(key), m_generation}).first;
+        evictUnused(key);
+    } else {
+        it->second.lastUsed = m_generation;
+    }
+    return it;
+}
+
+std::unique_ptr<CachedImageDescription> ColorManagementSurface::createDescription(const DescriptionKey &key)
+{
+    TraceSpan span("color", "ColorManagementSurface::createDescription");
     auto creator = m_global->create_parametric_creator();
 
-    switch (mode) {
+    switch (key.mode) {
     case ColorMode::sRGB_Gamma22:
         wp_image_description_creator_params_v1_set_primaries_named(creator, QtWayland::wp_color_manager_v1::primaries_srgb);
         wp_image_description_creator_params_v1_set_tf_named(creator, QtWayland::wp_color_manager_v1::transfer_function_gamma22);
-        wp_image_description_creator_params_v1_set_luminances(creator, 0, 200, 100);
-        wp_image_description_creator_params_v1_set_mastering_luminance(creator, 0, 200);
         break;
 
     case ColorMode::BT2020_Gamma22:
@@ -273,22 +379,69 @@ void ColorManagementSurface::createParametricDescription(ColorMode mode)
         wp_image_description_creator_params_v1_set_tf_named(creator, QtWayland::wp_color_manager_v1::transfer_function_gamma22);
         break;
 
-    default:
-        return;
+    case ColorMode::Default:
+        break;
+    }
+
+    // Not every compositor has these, a request for an unsupported feature is a protocol error
+    if (key.maxLuminance > 0 && m_global->supportsFeature(QtWayland::wp_color_manager_v1::feature_set_luminances)) {
+        wp_image_description_creator_params_v1_set_luminances(creator, 0, key.maxLuminance, key.referenceLuminance);
+    }
+    if (key.masteringMaxLuminance > 0 && m_global->supportsFeature(QtWayland::wp_color_manager_v1::feature_set_mastering_display_primaries)) {
+        wp_image_description_creator_params_v1_set_mastering_luminance(creator, 0, key.masteringMaxLuminance);
     }
 
-    new PendingImageDescription(m_window, this, wp_image_description_creator_params_v1_create(creator));
+    auto description = std::make_unique<CachedImageDescription>(this, wp_image_description_creator_params_v1_create(creator));
+    // Until the compositor reports the description ready
+    Trace::asyncBegin("color", "Image description", reinterpret_cast<quintptr>(description.get()));
+    return description;
 }
 
-void ColorManagementSurface::createPQDescription(int referenceLuminance)
+void ColorManagementSurface::apply(CachedImageDescription &description)
 {
-    auto creator = m_global->create_parametric_creator();
-    wp_image_description_creator_params_v1_set_primaries_named(creator, QtWayland::wp_color_manager_v1::primaries_bt2020);
-    wp_image_description_creator_params_v1_set_tf_named(creator, QtWayland::wp_color_manager_v1::transfer_function_st2084_pq);
-    wp_image_description_creator_params_v1_set_luminances(creator, 0, 10'000, referenceLuminance);
-    wp_image_description_creator_params_v1_set_mastering_luminance(creator, 0, 1'000);
-    
-    new PendingImageDescription(m_window, this, wp_image_description_creator_params_v1_create(creator));
+    set_image_description(description.object(), description.renderIntent());
+    m_window->requestUpdate();
+}
+
+void ColorManagementSurface::evictUnused(const DescriptionKey &keep)
+{
+    // E.g. while dragging a reference luminance slider, keep the most recently used ones
+    while (m_descriptions.size() > MAX_CACHED_DESCRIPTIONS) {
+        const auto oldest = std::min_element(m_descriptions.begin(), m_descriptions.end(), [&keep](const auto &a, const auto &b) {
+            // The one just added sorts last
+            if ((a.first == keep) != (b.first == keep)) {
+                return b.first == keep;
+            }
+            return a.second.lastUsed < b.second.lastUsed;
+        });
+        m_descriptions.erase(oldest);
+    }
+}
+
+void ColorManagementSurface::descriptionReady(CachedImageDescription *description)
+{
+    // Only prepared ones (requested 0) wait for their request
+    const auto it = findEntry(description);
+    if (it != m_descriptions.end() && it->second.requested != 0 && it->second.requested == m_generation) {
+        apply(*description);
+    }
+}
+
+void ColorManagementSurface::descriptionFailed(CachedImageDescription *description)
+{
+    // Requested again, the next switch to these parameters creates a new one
+    const auto it = findEntry(description);
+    if (it != m_descriptions.end()) {
+        m_descriptions.erase(it);
+    }
+}
+
+std::map<ColorManagementSurface::DescriptionKey, ColorManagementSurface::CacheEntry>::iterator
+ColorManagementSurface::findEntry(const CachedImageDescription *description)
+{
+    return std::find_if(m_descriptions.begin(), m_descriptions.end(), [description](const auto &entry) {
+        return entry.second.description.get() == description;
+    });
 }
 
 #include "moc_color_management.cpp"
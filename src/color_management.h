@@ -6,7 +6,9 @@
 #include <QQuickWindow>
 #include <QWaylandClientExtension>
 
+#include <compare>
 #include <deque>
+#include <map>
 #include <memory>
 #include <optional>
 #include <unordered_map>
@@ -25,8 +27,27 @@ public:
     explicit ColorManagementGlobal();
     ~ColorManagementGlobal() override = default;
 
+    bool supportsFeature(uint32_t feature) const { return feature < 32 && (m_features & (1u << feature)); }
+    // Everything the PQ description uses: parametric creation with luminances and mastering luminances,
+    // the ST 2084 transfer function and BT.2020 primaries. False until the compositor sent done.
+    bool supportsPQ() const;
+
+Q_SIGNALS:
+    // Emitted after the compositor announced its features, transfer functions and primaries
+    void capabilitiesChanged();
+
 protected:
     void wp_color_manager_v1_supported_feature(uint32_t feature) override;
+    void wp_color_manager_v1_supported_tf_named(uint32_t tf) override;
+    void wp_color_manager_v1_supported_primaries_named(uint32_t primaries) override;
+    void wp_color_manager_v1_done() override;
+
+private:
+    // Bit sets indexed by the protocol enum values
+    quint32 m_features = 0;
+    quint32 m_transferFunctions = 0;
+    quint32 m_primaries = 0;
+    bool m_done = false;
 };
 
 class ImageDescriptionInfo : public QObject, 
@@ -94,22 +115,27 @@ private:
     ImageDescriptionInfo m_info;
 };
 
-class PendingImageDescription : public QtWayland::wp_image_description_v1
+// Image description created by the client, owned by the ColorManagementSurface cache. Usable once the
+// compositor sent ready, then reused for every switch back to the same parameters.
+class CachedImageDescription : public QtWayland::wp_image_description_v1
 {
 public:
-    explicit PendingImageDescription(QQuickWindow *window,
-                                   ColorManagementSurface *surface,
-                                   ::wp_image_description_v1 *descr,
-                                   uint32_t renderIntent = WP_COLOR_MANAGER_V1_RENDER_INTENT_PERCEPTUAL);
-    ~PendingImageDescription() override;
+    explicit CachedImageDescription(ColorManagementSurface *surface,
+                                    ::wp_image_description_v1 *descr,
+                                    uint32_t renderIntent = WP_COLOR_MANAGER_V1_RENDER_INTENT_PERCEPTUAL);
+    ~CachedImageDescription() override;
+
+    bool isReady() const { return m_ready; }
+    uint32_t renderIntent() const { return m_renderIntent; }
 
 protected:
     void wp_image_description_v1_ready(uint32_t identity) override;
+    void wp_image_description_v1_failed(uint32_t cause, const QString &msg) override;
 
 private:
-    QPointer<QQuickWindow> m_window;
-    QPointer<ColorManagementSurface> m_surface;
+    ColorManagementSurface *m_surface;
     uint32_t m_renderIntent;
+    bool m_ready = false;
 };
 
 class ColorManagementFeedback : public QObject, 
@@ -159,14 +185,49 @@ public:
 
     void setColorMode(ColorMode mode);
     void setPQMode(int referenceLuminance);
+    // Creates the PQ description ahead of time without applying it, so that a later setPQMode() with the
+    // same reference luminance takes effect with the next frame instead of after a compositor round-trip
+    void preparePQMode(int referenceLuminance);
 
     ColorManagementFeedback* feedback() const { return m_feedback.get(); }
 
 private:
-    void createParametricDescription(ColorMode mode);
-    void createPQDescription(int referenceLuminance);
+    friend class CachedImageDescription;
+
+    // Everything that goes into the parametric creator
+    struct DescriptionKey {
+        ColorMode mode;
+        int referenceLuminance = 0;
+        int maxLuminance = 0;
+        int masteringMaxLuminance = 0;
+
+        auto operator<=>(const DescriptionKey &) const = default;
+    };
+
+    struct CacheEntry {
+        std::unique_ptr<CachedImageDescription> description;
+        // Generation of the last request or preparation, for the least recently used eviction
+        quint64 lastUsed = 0;
+        // Generation of the last request, 0 while only prepared
+        quint64 requested = 0;
+    };
+
+    // Applies the cached description right away, or creates it and applies it once ready
+    void requestDescription(const DescriptionKey &key);
+    std::map<DescriptionKey, CacheEntry>::iterator findOrCreateDescription(const DescriptionKey &key);
+    static DescriptionKey pqDescriptionKey(int referenceLuminance);
+    std::unique_ptr<CachedImageDescription> createDescription(const DescriptionKey &key);
+    void apply(CachedImageDescription &description);
+    void evictUnused(const DescriptionKey &keep);
+    void descriptionReady(CachedImageDescription *description);
+    void descriptionFailed(CachedImageDescription *description);
+    std::map<DescriptionKey, CacheEntry>::iterator findEntry(const CachedImageDescription *description);
 
     ColorManagementGlobal *m_global;
     QQuickWindow *m_window;
     std::unique_ptr<ColorManagementFeedback> m_feedback;
+    std::map<DescriptionKey, CacheEntry> m_descriptions;
+    // Incremented by every mode switch; a description that becomes ready is only applied while it is
+    // still the latest request, so a slow ready event cannot override a newer switch
+    quint64 m_generation = 0;
 };
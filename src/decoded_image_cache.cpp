@@ -0,0 +1,207 @@
+#include "decoded_image_cache.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <iterator>
+
+DecodedImageCache &DecodedImageCache::instance()
+{
+    static DecodedImageCache cache;
+    return cache;
+}
+
+DecodedImageCache::DecodedImageCache()
+{
+    MemoryBudget::instance().setEvictor([this](MemoryBudget::Priority priority) {
+        return evictForBudget(priority);
+    });
+}
+
+DecodedFrame DecodedImageCache::find(const QString &localPath, const QSize &requestedSize)
+{
+    const std::optional<ProbeCache::FileKey> key = ProbeCache::keyForFile(localPath);
+    DecodedFrame stale;
+    QMutexLocker locker(&m_mutex);
+    stale = takeStaleLocked(localPath, key);
+
+    const auto it = m_index.constFind(localPath);
+    if (it == m_index.constEnd() || !it.value()->frame.satisfies(requestedSize)) {
+        ++m_misses;
+        return {};
+    }
+
+    // Move to the front of the LRU list
+    m_entries.splice(m_entries.begin(), m_entries, it.value());
+    ++m_hits;
+    return m_entries.front().frame;
+}
+
+bool DecodedImageCache::contains(const QString &localPath) const
+{
+    const std::optional<ProbeCache::FileKey> key = ProbeCache::keyForFile(localPath);
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_index.constFind(localPath);
+    return it != m_index.constEnd() && it.value()->frame.fileKey == key;
+}
+
+void DecodedImageCache::insert(const QString &localPath, const DecodedFrame &frame)
+{
+    if (frame.isNull()) {
+        return;
+    }
+
+    DecodedFrame replaced;
+    QMutexLocker locker(&m_mutex);
+
+    const qint64 cost = frame.sizeInBytes();
+    const auto it = m_index.find(localPath);
+    if (it != m_index.end()) {
+        // A viewport sized decode finishing after the full resolution one must not replace it
+        const DecodedFrame &cached = it.value()->frame;
+        if (cached.fileKey == frame.fileKey && cached.image().width() > frame.image().width()) {
+            m_entries.splice(m_entries.begin(), m_entries, it.value());
+            return;
+        }
+        m_bytesResident -= cached.sizeInBytes();
+        replaced = std::move(it.value()->frame);
+        m_entries.erase(it.value());
+        m_index.erase(it);
+    }
+
+    m_entries.push_front({localPath, frame});
+    m_index.insert(localPath, m_entries.begin());
+    m_bytesResident += cost;
+}
+
+void DecodedImageCache::remove(const QString &localPath)
+{
+    DecodedFrame removed;
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_index.find(localPath);
+    if (it == m_index.end()) {
+        return;
+    }
+    m_bytesResident -= it.value()->frame.sizeInBytes();
+    removed = std::move(it.value()->frame);
+    m_entries.erase(it.value());
+    m_index.erase(it);
+}
+
+bool DecodedImageCache::beginDecode(const QString &localPath)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_inFlight.contains(localPath)) {
+        return false;
+    }
+    m_inFlight.insert(localPath);
+    return true;
+}
+
+void DecodedImageCache::endDecode(const QString &localPath, const DecodedFrame &frame)
+{
+    insert(localPath, frame);
+
+    QMutexLocker locker(&m_mutex);
+    m_inFlight.remove(localPath);
+    m_decodeFinished.wakeAll();
+}
+
+DecodedFrame DecodedImageCache::waitForDecode(const QString &localPath)
+{
+    DecodedFrame stale;
+    QMutexLocker locker(&m_mutex);
+    while (m_inFlight.contains(localPath)) {
+        m_decodeFinished.wait(&m_mutex);
+    }
+
+    // The running decode may have read the file before it was rewritten
+    locker.unlock();
+    const std::optional<ProbeCache::FileKey> key = ProbeCache::keyForFile(localPath);
+    locker.relock();
+    stale = takeStaleLocked(localPath, key);
+
+    const auto it = m_index.constFind(localPath);
+    if (it == m_index.constEnd()) {
+        return {};
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it.value());
+    ++m_hits;
+    return m_entries.front().frame;
+}
+
+void DecodedImageCache::setPinned(const QString &localPath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pinned = localPath;
+}
+
+DecodedImageCache::Statistics DecodedImageCache::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return {
+        .hits = m_hits.load(),
+        .misses = m_misses.load(),
+        .bytesResident = m_bytesResident,
+        .memoryLimit = MemoryBudget::instance().limit(),
+        .imageCount = static_cast<int>(m_entries.size()),
+    };
+}
+
+bool DecodedImageCache::evictForBudget(MemoryBudget::Priority priority)
+{
+    if (priority == MemoryBudget::Priority::Thumbnail) {
+        return false;
+    }
+
+    DecodedFrame evicted;
+    {
+        QMutexLocker locker(&m_mutex);
+        // Oldest first
+        const auto victim = std::find_if(m_entries.rbegin(), m_entries.rend(), [this](const Entry &entry) {
+            return isEvictableLocked(entry);
+        });
+        if (victim == m_entries.rend()) {
+            return false;
+        }
+
+        const auto it = std::prev(victim.base());
+        qDebug() << "Evicting for the memory budget:" << it->localPath;
+        m_bytesResident -= it->frame.sizeInBytes();
+        evicted = std::move(it->frame);
+        m_index.remove(it->localPath);
+        m_entries.erase(it);
+    }
+    // Released outside the lock, the last holder of the reservation returns the bytes to the budget
+    return true;
+}
+
+DecodedFrame DecodedImageCache::takeStaleLocked(const QString &localPath, const std::optional<ProbeCache::FileKey> &key)
+{
+    const auto it = m_index.find(localPath);
+    if (it == m_index.end() || it.value()->frame.fileKey == key) {
+        return {};
+    }
+
+    qDebug() << "Dropping the decoded frame of the changed file" << localPath;
+    m_bytesResident -= it.value()->frame.sizeInBytes();
+    DecodedFrame stale = std::move(it.value()->frame);
+    m_entries.erase(it.value());
+    m_index.erase(it);
+    return stale;
+}
+
+bool DecodedImageCache::isEvictableLocked(const Entry &entry) const
+{
+    if (entry.localPath == m_pinned) {
+        return false;
+    }
+    // Dropping a frame that is shared only drops the cache's reference, the budget would not see a byte
+    if (entry.frame.memory && entry.frame.memory.use_count() > 1) {
+        return false;
+    }
+    return std::all_of(entry.frame.levels.cbegin(), entry.frame.levels.cend(), [](const QImage &level) {
+        return level.isDetached();
+    });
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <list>
+#include <optional>
+
+#include "image_decoder.h"
+#include "memory_budget.h"
+#include "probe_cache.h"
+
+// Process-wide LRU of decoded frames (including their pyramids), shared by the image provider
+// and the prefetcher. Frames count against the MemoryBudget through their reservations; the cache
+// keeps them until a new reservation needs the room. The pinned frame and frames that are still in
+// use elsewhere are never evicted. Lookups stat the file and drop frames that were decoded from an
+// earlier version of it (see DecodedFrame::fileKey). All methods are thread safe.
+class DecodedImageCache
+{
+public:
+    struct Statistics {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        qint64 bytesResident = 0;
+        qint64 memoryLimit = 0;
+        int imageCount = 0;
+    };
+
+    static DecodedImageCache &instance();
+
+    // Returns the cached frame if it has the resolution requestedSize needs (invalid = full resolution)
+    // and counts a hit, otherwise a null frame and counts a miss
+    DecodedFrame find(const QString &localPath, const QSize &requestedSize = {});
+    // Lookup without touching the statistics or the LRU order
+    bool contains(const QString &localPath) const;
+    // Keeps the cached frame when it has a higher resolution than the new one of the same file version
+    void insert(const QString &localPath, const DecodedFrame &frame);
+    // Drops the frame right away, e.g. once the file was rewritten, instead of at the next lookup
+    void remove(const QString &localPath);
+
+    // In-flight bookkeeping, so that a display request can join a running prefetch
+    // instead of decoding the same file twice.
+    bool beginDecode(const QString &localPath);
+    void endDecode(const QString &localPath, const DecodedFrame &frame);
+    // Blocks until a decode started by beginDecode() finishes, returns the result (null on failure or
+    // when the file changed since)
+    DecodedFrame waitForDecode(const QString &localPath);
+
+    // The image on screen, kept no matter how old its entry is. Replaces the previous pin.
+    void setPinned(const QString &localPath);
+
+    Statistics statistics() const;
+
+private:
+    DecodedImageCache();
+
+    struct Entry {
+        QString localPath;
+        DecodedFrame frame;
+    };
+
+    // MemoryBudget evictor: drops the least recently used entry that frees memory, thumbnails evict nothing
+    bool evictForBudget(MemoryBudget::Priority priority);
+    // Not pinned, and no item, response or texture upload holds the frame: evicting it frees its bytes
+    bool isEvictableLocked(const Entry &entry) const;
+    // Removes the entry of localPath if it was decoded from another version of the file than key.
+    // Returns the frame, to be released after unlocking.
+    DecodedFrame takeStaleLocked(const QString &localPath, const std::optional<ProbeCache::FileKey> &key);
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_decodeFinished;
+    std::list<Entry> m_entries; // front = most recently used
+    QHash<QString, std::list<Entry>::iterator> m_index;
+    QSet<QString> m_inFlight;
+    QString m_pinned;
+    qint64 m_bytesResident = 0;
+    std::atomic<quint64> m_hits = 0;
+    std::atomic<quint64> m_misses = 0;
+};
@@ -0,0 +1,129 @@
+#include "directory_scanner.h"
+#include "file_detector.h"
+#include "trace.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <algorithm>
+
+namespace {
+    // Files per probe task, also the granularity at which results reach the GUI thread
+    constexpr qsizetype SCAN_BATCH_SIZE = 128;
+    // Probing is mostly waiting on I/O, so use more threads than cores on small machines
+    constexpr int MIN_SCAN_THREADS = 2;
+    constexpr int MAX_SCAN_THREADS = 8;
+}
+
+DirectoryScanner::DirectoryScanner(QObject *parent)
+    : QObject(parent)
+{
+    m_pool.setMaxThreadCount(std::clamp(QThread::idealThreadCount(), MIN_SCAN_THREADS, MAX_SCAN_THREADS));
+}
+
+DirectoryScanner::~DirectoryScanner()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+void DirectoryScanner::scan(const QString &directoryPath, const QString &startFileName)
+{
+    cancel();
+    const quint64 generation = m_generation.load();
+
+    m_pool.start([this, generation, directoryPath, startFileName]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        // Get all files sorted by name
+        const QStringList allFiles = QDir(directoryPath).entryList(QDir::Files, QDir::Name);
+        if (!isCurrent(generation)) {
+            return;
+        }
+
+        const qsizetype batchCount = (allFiles.size() + SCAN_BATCH_SIZE - 1) / SCAN_BATCH_SIZE;
+        if (batchCount == 0) {
+            QMetaObject::invokeMethod(this, [this, generation]() {
+                if (isCurrent(generation)) {
+                    Q_EMIT finished();
+                }
+            }, Qt::QueuedConnection);
+            return;
+        }
+
+        // Queue batches by distance from the start file, so that its neighbors are known first
+        const qsizetype startIndex = std::max<qsizetype>(allFiles.indexOf(startFileName), 0);
+        const qsizetype startBatch = startIndex / SCAN_BATCH_SIZE;
+        QList<qsizetype> batchOrder;
+        batchOrder.reserve(batchCount);
+        for (qsizetype distance = 0; batchOrder.size() < batchCount; ++distance) {
+            if (startBatch + distance < batchCount) {
+                batchOrder.append(startBatch + distance);
+            }
+            if (distance > 0 && startBatch - distance >= 0) {
+                batchOrder.append(startBatch - distance);
+            }
+        }
+
+        qDebug() << "Listed" << allFiles.size() << "files in" << directoryPath << "in" << timer.elapsed() << "ms";
+
+        auto pendingBatches = std::make_shared<std::atomic<int>>(static_cast<int>(batchCount));
+        for (qsizetype batch : batchOrder) {
+            const QStringList fileNames = allFiles.mid(batch * SCAN_BATCH_SIZE, SCAN_BATCH_SIZE);
+            m_pool.start([this, generation, directoryPath, fileNames, pendingBatches]() {
+                probeBatch(generation, directoryPath, fileNames, pendingBatches);
+            });
+        }
+    });
+}
+
+void DirectoryScanner::probe(const QString &directoryPath, const QStringList &fileNames)
+{
+    const quint64 generation = m_generation.load();
+    for (qsizetype start = 0; start < fileNames.size(); start += SCAN_BATCH_SIZE) {
+        m_pool.start([this, generation, directoryPath, fileNames = fileNames.mid(start, SCAN_BATCH_SIZE)]() {
+            probeBatch(generation, directoryPath, fileNames, nullptr);
+        });
+    }
+}
+
+void DirectoryScanner::cancel()
+{
+    // Queued batches of the old scan are dropped, running ones see the new generation and discard their result
+    ++m_generation;
+    m_pool.clear();
+}
+
+void DirectoryScanner::probeBatch(quint64 generation, const QString &directoryPath, const QStringList &fileNames,
+                                  const std::shared_ptr<std::atomic<int>> &pendingBatches)
+{
+    TraceSpan span("probe", "DirectoryScanner::probeBatch");
+    const QDir directory(directoryPath);
+    QStringList supported;
+    for (const QString &fileName : fileNames) {
+        if (!isCurrent(generation)) {
+            return;
+        }
+        if (FileDetector::isSupportedImageFormat(directory.absoluteFilePath(fileName))) {
+            supported.append(fileName);
+        }
+    }
+
+    const bool last = pendingBatches && --*pendingBatches == 0;
+    QMetaObject::invokeMethod(this, [this, generation, supported, last]() {
+        if (!isCurrent(generation)) {
+            return;
+        }
+        if (!supported.isEmpty()) {
+            Q_EMIT imagesFound(supported);
+        }
+        if (last) {
+            Q_EMIT finished();
+        }
+    }, Qt::QueuedConnection);
+}
+
+#include "moc_directory_scanner.cpp"
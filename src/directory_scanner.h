@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+
+// Lists a directory and probes its files for supported images on a thread pool.
+// Results arrive in batches, so a large directory becomes navigable while it is still being scanned.
+class DirectoryScanner : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DirectoryScanner(QObject *parent = nullptr);
+    ~DirectoryScanner() override;
+
+    // Starts a scan, superseding the running one. Files around startFileName are probed first.
+    void scan(const QString &directoryPath, const QString &startFileName = {});
+    // Probes specific files, e.g. ones that appeared after the scan. Does not cancel a running scan
+    // and does not emit finished().
+    void probe(const QString &directoryPath, const QStringList &fileNames);
+    void cancel();
+
+Q_SIGNALS:
+    // File names of supported images, sorted by name within one batch (when the input was sorted)
+    void imagesFound(const QStringList &fileNames);
+    void finished();
+
+private:
+    // pendingBatches is null for batches that are not part of a scan
+    void probeBatch(quint64 generation, const QString &directoryPath, const QStringList &fileNames,
+                    const std::shared_ptr<std::atomic<int>> &pendingBatches);
+    bool isCurrent(quint64 generation) const { return m_generation.load() == generation; }
+
+    QThreadPool m_pool;
+    std::atomic<quint64> m_generation = 0;
+};
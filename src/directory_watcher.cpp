@@ -0,0 +1,124 @@
+#include "directory_watcher.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+    // Creation alone is not reported, the new file is usually still empty; IN_CLOSE_WRITE follows once
+    // it was written
+    constexpr uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_ONLYDIR;
+    // Room for a few hundred events with typical file names per read
+    constexpr std::size_t EVENT_BUFFER_SIZE = 16 * 1024;
+}
+
+DirectoryWatcher::DirectoryWatcher(QObject *parent)
+    : QObject(parent)
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        qWarning() << "Cannot watch directories:" << std::strerror(errno);
+        return;
+    }
+    m_notifier = std::make_unique<QSocketNotifier>(m_fd, QSocketNotifier::Read);
+    connect(m_notifier.get(), &QSocketNotifier::activated, this, &DirectoryWatcher::readEvents);
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+    m_notifier.reset();
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool DirectoryWatcher::watch(const QString &directoryPath)
+{
+    stop();
+    if (m_fd < 0) {
+        return false;
+    }
+    m_watch = inotify_add_watch(m_fd, QFile::encodeName(directoryPath).constData(), WATCH_MASK);
+    if (m_watch < 0) {
+        qWarning() << "Cannot watch" << directoryPath << ":" << std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void DirectoryWatcher::stop()
+{
+    if (m_watch >= 0) {
+        inotify_rm_watch(m_fd, m_watch);
+        m_watch = -1;
+    }
+}
+
+void DirectoryWatcher::readEvents()
+{
+    alignas(inotify_event) char buffer[EVENT_BUFFER_SIZE];
+
+    // A move within the directory is a pair of events with the same cookie, normally back to back.
+    // A move out of it has no partner and counts as a removal.
+    QString movedFrom;
+    uint32_t movedCookie = 0;
+    bool moving = false;
+    const auto flushMove = [&]() {
+        if (moving) {
+            moving = false;
+            Q_EMIT fileRemoved(movedFrom);
+        }
+    };
+
+    ssize_t length;
+    while ((length = read(m_fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const auto event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                flushMove();
+                Q_EMIT overflowed();
+                continue;
+            }
+            // E.g. the IN_IGNORED of a replaced watch
+            if (event->wd != m_watch) {
+                continue;
+            }
+            if (event->mask & IN_DELETE_SELF) {
+                flushMove();
+                Q_EMIT overflowed();
+                continue;
+            }
+            if ((event->mask & IN_ISDIR) || event->len == 0) {
+                continue;
+            }
+
+            const QString fileName = QFile::decodeName(event->name);
+            if ((event->mask & IN_MOVED_TO) && moving && event->cookie == movedCookie) {
+                moving = false;
+                Q_EMIT fileRenamed(movedFrom, fileName);
+                continue;
+            }
+            flushMove();
+            if (event->mask & IN_MOVED_FROM) {
+                movedFrom = fileName;
+                movedCookie = event->cookie;
+                moving = true;
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                Q_EMIT fileAdded(fileName);
+            } else if (event->mask & IN_DELETE) {
+                Q_EMIT fileRemoved(fileName);
+            }
+        }
+    }
+    // EAGAIN, everything was read
+    flushMove();
+}
+
+#include "moc_directory_watcher.cpp"
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QString>
+
+#include <memory>
+
+// Reports the individual files that appear in, vanish from or move within one directory, using inotify.
+// Unlike QFileSystemWatcher, which only tells that the directory changed, so nothing has to be relisted.
+class DirectoryWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DirectoryWatcher(QObject *parent = nullptr);
+    ~DirectoryWatcher() override;
+
+    // Replaces the previously watched directory. False if inotify is unavailable or out of watches.
+    bool watch(const QString &directoryPath);
+    void stop();
+
+Q_SIGNALS:
+    // A file finished writing or was moved in; repeats when an existing file is rewritten
+    void fileAdded(const QString &fileName);
+    void fileRemoved(const QString &fileName);
+    // Within the watched directory
+    void fileRenamed(const QString &oldFileName, const QString &newFileName);
+    // Events were lost or the directory itself went away, only a full listing is reliable now
+    void overflowed();
+
+private:
+    void readEvents();
+
+    int m_fd = -1;
+    int m_watch = -1;
+    std::unique_ptr<QSocketNotifier> m_notifier;
+};
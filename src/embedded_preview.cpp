@@ -0,0 +1,296 @@
+#include "embedded_preview.h"
+#include "tiff_reader.h"
+
+#include <QBuffer>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImageReader>
+#include <QList>
+#include <QTransform>
+
+#include <jxl/decode.h>
+#include <jxl/decode_cxx.h>
+#include <jxl/types.h>
+
+#include <algorithm>
+
+namespace {
+    // Read instead of mapped when mapping fails; previews sit near the start of the file
+    constexpr qint64 PREVIEW_READ_LIMIT = 16 * 1024 * 1024;
+    // Previews smaller than this are not worth showing before the full image
+    constexpr int MIN_PREVIEW_EDGE = 160;
+
+    constexpr quint16 TIFF_COMPRESSION_OLD_JPEG = 6;
+    constexpr quint16 TIFF_COMPRESSION_JPEG = 7;
+
+    quint16 readJpegMarkerLength(QByteArrayView data, qint64 offset)
+    {
+        if (offset < 0 || offset + 2 > data.size()) return 0;
+        return static_cast<quint16>((static_cast<quint8>(data[offset]) << 8) | static_cast<quint8>(data[offset + 1]));
+    }
+
+    // True for baseline and progressive Huffman JPEGs, which the Qt plugin decodes. RAW files store
+    // their sensor data as lossless JPEG (SOF3) in the same IFD structures, those are rejected.
+    bool isDecodableJpeg(QByteArrayView jpeg)
+    {
+        if (jpeg.size() < 4 || static_cast<quint8>(jpeg[0]) != 0xFF || static_cast<quint8>(jpeg[1]) != 0xD8) {
+            return false;
+        }
+
+        qint64 offset = 2;
+        while (offset + 4 <= jpeg.size()) {
+            if (static_cast<quint8>(jpeg[offset]) != 0xFF) {
+                return false;
+            }
+            const quint8 marker = static_cast<quint8>(jpeg[offset + 1]);
+            if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2) {
+                return true;
+            }
+            // Other SOF markers (lossless, arithmetic coding) or the start of scan without any SOF
+            if ((marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) || marker == 0xDA) {
+                return false;
+            }
+            offset += 2 + readJpegMarkerLength(jpeg, offset + 2);
+        }
+        return false;
+    }
+
+    // Same order as Qt's auto transform: mirror and flip first, then rotate
+    QImage applyTransformations(QImage image, QImageIOHandler::Transformations transformations)
+    {
+        const bool mirror = transformations.testFlag(QImageIOHandler::TransformationMirror);
+        const bool flip = transformations.testFlag(QImageIOHandler::TransformationFlip);
+        if (mirror || flip) {
+            image = image.mirrored(mirror, flip);
+        }
+        if (transformations.testFlag(QImageIOHandler::TransformationRotate90)) {
+            image = image.transformed(QTransform().rotate(90));
+        }
+        return image;
+    }
+}
+
+QImage EmbeddedPreview::extract(const QString &localPath, const FileDetector::ImageProbe &probe, int maxEdge)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QFile file(localPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    // Map the file so that only the pages holding the structures and the preview are read
+    QByteArray buffer;
+    QByteArrayView data;
+    if (const uchar *mapped = file.map(0, file.size())) {
+        data = QByteArrayView(mapped, file.size());
+    } else {
+        buffer = file.read(PREVIEW_READ_LIMIT);
+        data = buffer;
+    }
+
+    QImage image;
+    switch (probe.format) {
+        case FileDetector::ImageFormat::JPEG_XL:
+            // libjxl applies the orientation itself; the preview has the same color encoding as the image
+            image = decodeJpegXlPreview(data);
+            break;
+        case FileDetector::ImageFormat::JPEG:
+            // The EXIF thumbnail is sRGB, an HDR image would be shown with the wrong colors
+            if (!probe.isHDR) {
+                image = decodeJpeg(largestTiffJpeg(jpegExifBlock(data)), maxEdge, probe.transformations);
+            }
+            break;
+        case FileDetector::ImageFormat::TIFF:
+        case FileDetector::ImageFormat::Unknown:
+            // TIFF, and TIFF based RAW formats with an unknown suffix
+            if (!probe.isHDR) {
+                image = decodeJpeg(largestTiffJpeg(data), maxEdge, probe.transformations);
+            }
+            break;
+        case FileDetector::ImageFormat::PNG:
+        case FileDetector::ImageFormat::AVIF:
+        case FileDetector::ImageFormat::HEIC:
+        case FileDetector::ImageFormat::RAW:
+            // RAW previews come from LibRaw, which knows the vendor specific layouts
+            break;
+    }
+
+    if (image.isNull() || std::max(image.width(), image.height()) < MIN_PREVIEW_EDGE) {
+        return {};
+    }
+    if (maxEdge > 0 && (image.width() > maxEdge || image.height() > maxEdge)) {
+        image = image.scaled(maxEdge, maxEdge, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    // 16 bit only where it carries HDR code values
+    if (!probe.isHDR && image.depth() == 64) {
+        image = image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+    }
+
+    qDebug() << "Extracted embedded preview for" << localPath << image.size() << "in" << timer.elapsed() << "ms";
+    return image;
+}
+
+QByteArrayView EmbeddedPreview::largestTiffJpeg(QByteArrayView tiffData)
+{
+    const std::optional<TiffReader> tiff = TiffReader::open(tiffData);
+    if (!tiff) {
+        return {};
+    }
+
+    QByteArrayView largest;
+    const auto consider = [&](quint64 offset, quint64 length) {
+        if (offset == 0 || length == 0 || offset >= quint64(tiffData.size()) || length > quint64(tiffData.size()) - offset) {
+            return;
+        }
+        const QByteArrayView candidate = tiffData.sliced(static_cast<qsizetype>(offset), static_cast<qsizetype>(length));
+        if (candidate.size() > largest.size() && isDecodableJpeg(candidate)) {
+            largest = candidate;
+        }
+    };
+
+    // IFD chains still to walk: the main chain, then the SubIFDs found along the way
+    QList<quint64> chains{tiff->firstIfd};
+    int visited = 0;
+    while (!chains.isEmpty() && visited < TiffReader::MAX_IFDS) {
+        quint64 ifd = chains.takeFirst();
+        for (; ifd != 0 && visited < TiffReader::MAX_IFDS; ++visited) {
+            quint64 jpegOffset = 0;
+            quint64 jpegLength = 0;
+            quint64 stripOffset = 0;
+            quint64 stripLength = 0;
+            qint64 stripCount = 0;
+            quint64 compression = 0;
+
+            ifd = tiff->forEachEntry(ifd, [&](const TiffReader::Entry &entry) {
+                switch (entry.tag) {
+                    case TiffReader::TAG_COMPRESSION: compression = tiff->value(entry); break;
+                    case TiffReader::TAG_JPEG_INTERCHANGE_FORMAT: jpegOffset = tiff->value(entry); break;
+                    case TiffReader::TAG_JPEG_INTERCHANGE_FORMAT_LENGTH: jpegLength = tiff->value(entry); break;
+                    case TiffReader::TAG_STRIP_OFFSETS:
+                        stripCount = entry.count;
+                        stripOffset = tiff->value(entry);
+                        break;
+                    case TiffReader::TAG_STRIP_BYTE_COUNTS: stripLength = tiff->value(entry); break;
+                    case TiffReader::TAG_SUB_IFDS:
+                        for (qint64 i = 0; i < entry.count && chains.size() < TiffReader::MAX_IFDS; ++i) {
+                            chains.append(tiff->value(entry, i));
+                        }
+                        break;
+                }
+                return true;
+            });
+
+            // Old style JPEG (EXIF thumbnails, CR2 and NEF previews) points at a complete JPEG stream
+            consider(jpegOffset, jpegLength);
+            // A single JPEG compressed strip is a complete stream as well (DNG previews)
+            if ((compression == TIFF_COMPRESSION_JPEG || compression == TIFF_COMPRESSION_OLD_JPEG) && stripCount == 1) {
+                consider(stripOffset, stripLength);
+            }
+        }
+    }
+    return largest;
+}
+
+QByteArrayView EmbeddedPreview::jpegExifBlock(QByteArrayView data)
+{
+    if (data.size() < 4 || static_cast<quint8>(data[0]) != 0xFF || static_cast<quint8>(data[1]) != 0xD8) {
+        return {};
+    }
+
+    // APP1 "Exif\0\0" comes before the first scan, the TIFF header follows the identifier
+    qint64 offset = 2;
+    while (offset + 4 <= data.size() && static_cast<quint8>(data[offset]) == 0xFF) {
+        const quint8 marker = static_cast<quint8>(data[offset + 1]);
+        const qint64 length = readJpegMarkerLength(data, offset + 2);
+        if (marker == 0xDA || length < 2 || offset + 2 + length > data.size()) {
+            break;
+        }
+        if (marker == 0xE1 && length > 8 && data.sliced(offset + 4).startsWith(QByteArrayView("Exif\0\0", 6))) {
+            return data.sliced(offset + 10, length - 8);
+        }
+        offset += 2 + length;
+    }
+    return {};
+}
+
+QImage EmbeddedPreview::decodeJpeg(QByteArrayView jpeg, int maxEdge, QImageIOHandler::Transformations transformations)
+{
+    if (jpeg.isEmpty()) {
+        return {};
+    }
+
+    // Decoded straight from the mapping, without copying the stream
+    const QByteArray bytes = QByteArray::fromRawData(jpeg.data(), jpeg.size());
+    QBuffer buffer;
+    buffer.setData(bytes);
+    buffer.open(QIODevice::ReadOnly);
+
+    // The orientation is stored in the container, not in the embedded stream
+    QImageReader reader(&buffer, "jpeg");
+    reader.setAutoTransform(false);
+
+    // DCT scaling: a 24 MP preview decodes at 1/2, 1/4 or 1/8 of its size
+    const QSize size = reader.size();
+    if (maxEdge > 0 && size.isValid() && (size.width() > maxEdge || size.height() > maxEdge)) {
+        reader.setScaledSize(size.scaled(maxEdge, maxEdge, Qt::KeepAspectRatio));
+    }
+
+    QImage image;
+    if (!reader.read(&image)) {
+        return {};
+    }
+    return applyTransformations(image, transformations);
+}
+
+QImage EmbeddedPreview::decodeJpegXlPreview(QByteArrayView data)
+{
+    auto dec = JxlDecoderMake(nullptr);
+    if (!dec || data.isEmpty()) {
+        return {};
+    }
+    if (JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_PREVIEW_IMAGE) != JXL_DEC_SUCCESS) {
+        return {};
+    }
+    // The preview follows the header, the whole input is available (mapped or a bounded prefix)
+    if (JxlDecoderSetInput(dec.get(), reinterpret_cast<const uint8_t *>(data.data()), data.size()) != JXL_DEC_SUCCESS) {
+        return {};
+    }
+    JxlDecoderCloseInput(dec.get());
+
+    // 16 bit keeps PQ and HLG code values intact
+    const JxlPixelFormat format{4, JXL_TYPE_UINT16, JXL_NATIVE_ENDIAN, 0};
+    JxlBasicInfo info;
+    QImage image;
+
+    while (true) {
+        const JxlDecoderStatus status = JxlDecoderProcessInput(dec.get());
+        if (status == JXL_DEC_BASIC_INFO) {
+            if (JxlDecoderGetBasicInfo(dec.get(), &info) != JXL_DEC_SUCCESS || !info.have_preview) {
+                return {};
+            }
+        } else if (status == JXL_DEC_NEED_PREVIEW_OUT_BUFFER) {
+            // The preview header holds the stored size, the output is oriented
+            QSize size(static_cast<int>(info.preview.xsize), static_cast<int>(info.preview.ysize));
+            if (info.orientation >= JXL_ORIENT_TRANSPOSE) {
+                size.transpose();
+            }
+            image = QImage(size, info.alpha_bits ? QImage::Format_RGBA64 : QImage::Format_RGBX64);
+
+            size_t bufferSize = 0;
+            if (image.isNull() ||
+                JxlDecoderPreviewOutBufferSize(dec.get(), &format, &bufferSize) != JXL_DEC_SUCCESS ||
+                bufferSize != static_cast<size_t>(image.sizeInBytes()) ||
+                JxlDecoderSetPreviewOutBuffer(dec.get(), &format, image.bits(), bufferSize) != JXL_DEC_SUCCESS) {
+                return {};
+            }
+        } else if (status == JXL_DEC_PREVIEW_IMAGE) {
+            return image;
+        } else {
+            // Error, or the input ended before the preview
+            return {};
+        }
+    }
+}
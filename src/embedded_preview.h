@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QImage>
+#include <QString>
+
+#include "file_detector.h"
+
+// Low resolution versions stored inside image files, which are available long before the full
+// image is decoded: the JPEG previews of TIFF files, the EXIF thumbnail of JPEGs and
+// the preview frame of JPEG XL.
+class EmbeddedPreview
+{
+public:
+    // Returns the largest preview, scaled down to fit into maxEdge and oriented like the full image,
+    // or a null image when the file has none. Thread safe.
+    static QImage extract(const QString &localPath, const FileDetector::ImageProbe &probe, int maxEdge);
+
+private:
+    // Largest baseline or progressive JPEG referenced from any IFD or SubIFD
+    static QByteArrayView largestTiffJpeg(QByteArrayView tiffData);
+    // TIFF structure inside the EXIF APP1 segment of a JPEG
+    static QByteArrayView jpegExifBlock(QByteArrayView data);
+    static QImage decodeJpeg(QByteArrayView jpeg, int maxEdge, QImageIOHandler::Transformations transformations);
+    static QImage decodeJpegXlPreview(QByteArrayView data);
+};
@@ -1,158 +1,268 @@
 #include "file_detector.h"
+#include "metrics.h"
+#include "probe_cache.h"
+#include "raw_decoder.h"
+#include "tiff_reader.h"
+#include "trace.h"
 
 #include <QFile>
 #include <QDebug>
 #include <QUrl>
-#include <QFileInfo>
 #include <QImageReader>
+#include <QtEndian>
 #include <jxl/decode.h>
 #include <jxl/decode_cxx.h>
 #include <jxl/types.h>
 
-// Helper function to read big-endian 32-bit integer
-static quint32 readBigEndian32(const QByteArray &data, int offset) {
-    if (offset + 4 > data.size()) return 0;
-    return (static_cast<unsigned char>(data[offset]) << 24) |
-           (static_cast<unsigned char>(data[offset + 1]) << 16) |
-           (static_cast<unsigned char>(data[offset + 2]) << 8) |
-           static_cast<unsigned char>(data[offset + 3]);
+#include <algorithm>
+#include <optional>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    // Read limit when a file cannot be memory mapped
+    constexpr qint64 PROBE_PREFIX_LIMIT = 16 * 1024 * 1024;
+    // libjxl is fed the header in chunks of this size until the color encoding is known
+    constexpr qsizetype JXL_PROBE_CHUNK_SIZE = 64 * 1024;
+}
+
+// Big-endian readers on a view, returning 0 when out of bounds. No allocation, no copy.
+static quint16 readBigEndian16(QByteArrayView data, qsizetype offset) {
+    if (offset < 0 || offset + 2 > data.size()) return 0;
+    return qFromBigEndian<quint16>(data.data() + offset);
+}
+
+static quint32 readBigEndian32(QByteArrayView data, qsizetype offset) {
+    if (offset < 0 || offset + 4 > data.size()) return 0;
+    return qFromBigEndian<quint32>(data.data() + offset);
+}
+
+static quint64 readBigEndian64(QByteArrayView data, qsizetype offset) {
+    if (offset < 0 || offset + 8 > data.size()) return 0;
+    return qFromBigEndian<quint64>(data.data() + offset);
 }
 
-// Helper function to parse ISO Base Media File Format boxes (used by AVIF and HEIC)
-static bool parseIsoMediaBoxesForHDR(QFile &file, qint64 maxEnd = -1) {
-    if (maxEnd == -1) {
-        maxEnd = file.size();
+// Box and chunk types compared as integers
+static constexpr quint32 fourcc(const char (&code)[5]) {
+    return (static_cast<quint32>(static_cast<unsigned char>(code[0])) << 24) |
+           (static_cast<quint32>(static_cast<unsigned char>(code[1])) << 16) |
+           (static_cast<quint32>(static_cast<unsigned char>(code[2])) << 8) |
+           static_cast<quint32>(static_cast<unsigned char>(code[3]));
+}
+
+// Maps ITU-T H.273 (CICP) code points, as used by PNG cICP and ISO BMFF nclx
+static FileDetector::TransferFunction transferFromCicp(int transferCharacteristics) {
+    switch (transferCharacteristics) {
+        case 13: return FileDetector::TransferFunction::SRGB;
+        case 16: return FileDetector::TransferFunction::PQ;
+        case 18: return FileDetector::TransferFunction::HLG;
+        case 0:
+        case 2: return FileDetector::TransferFunction::Unknown;
+        default: return FileDetector::TransferFunction::Other;
     }
-    
-    while (file.pos() < maxEnd && !file.atEnd()) {
-        qint64 boxStart = file.pos();
-        
-        // Read box size (4 bytes)
-        QByteArray sizeBytes = file.read(4);
-        if (sizeBytes.size() < 4) break;
-        
-        quint32 boxSize = readBigEndian32(sizeBytes, 0);
-        
-        // Read box type (4 bytes)
-        QByteArray boxType = file.read(4);
-        if (boxType.size() < 4) break;
-        
+}
+
+static FileDetector::ColorPrimaries primariesFromCicp(int colorPrimaries) {
+    switch (colorPrimaries) {
+        case 1: return FileDetector::ColorPrimaries::BT709;
+        case 9: return FileDetector::ColorPrimaries::BT2020;
+        case 12: return FileDetector::ColorPrimaries::DisplayP3;
+        case 0:
+        case 2: return FileDetector::ColorPrimaries::Unknown;
+        default: return FileDetector::ColorPrimaries::Other;
+    }
+}
+
+// Derives transfer and primaries from an ICC profile description found by name matching
+static void applyIccProfileName(QLatin1StringView profileStr, FileDetector::ImageProbe &probe) {
+    if (profileStr.contains("PQ"_L1)) {
+        probe.transfer = FileDetector::TransferFunction::PQ;
+    }
+    if (profileStr.contains("2020"_L1)) {
+        probe.primaries = FileDetector::ColorPrimaries::BT2020;
+    }
+}
+
+// Maps an EXIF orientation value (1-8) to Qt's transformation flags
+static QImageIOHandler::Transformations transformationsFromExif(int orientation) {
+    switch (orientation) {
+        case 2: return QImageIOHandler::TransformationMirror;
+        case 3: return QImageIOHandler::TransformationRotate180;
+        case 4: return QImageIOHandler::TransformationFlip;
+        case 5: return QImageIOHandler::TransformationFlipAndRotate90;
+        case 6: return QImageIOHandler::TransformationRotate90;
+        case 7: return QImageIOHandler::TransformationMirrorAndRotate90;
+        case 8: return QImageIOHandler::TransformationRotate270;
+        default: return QImageIOHandler::TransformationNone;
+    }
+}
+
+// Boxes of an ISO Base Media File Format image (AVIF, HEIC) that describe its items, collected in
+// one walk. Views point into the mapped file.
+struct IsoMediaItems {
+    std::optional<quint32> primaryItem;
+    // Children of 'ipco' in order, 'ipma' refers to them by 1-based index
+    QList<std::pair<quint32, QByteArrayView>> properties;
+    // Item ID and property index pairs from every 'ipma'
+    QList<std::pair<quint32, quint16>> associations;
+    // Property boxes outside 'ipco', e.g. in image sequences
+    QList<std::pair<quint32, QByteArrayView>> looseProperties;
+};
+
+// 'pitm': version/flags, then the primary item ID, 16 bit in version 0 and 32 bit after
+static void parsePrimaryItem(QByteArrayView boxData, IsoMediaItems &items) {
+    if (boxData.size() < 6) return;
+    const quint8 version = static_cast<quint8>(boxData[0]);
+    items.primaryItem = version == 0 ? readBigEndian16(boxData, 4) : readBigEndian32(boxData, 4);
+}
+
+// 'ipma': version/flags, entry count, then per item its ID (16 bit in version 0), an association
+// count and the associations: 1 bit essential and a 7 bit index, or 15 bits with flag 1
+static void parsePropertyAssociations(QByteArrayView boxData, IsoMediaItems &items) {
+    if (boxData.size() < 8) return;
+    const quint8 version = static_cast<quint8>(boxData[0]);
+    const bool wideIndices = static_cast<quint8>(boxData[3]) & 0x01;
+    const quint32 entryCount = readBigEndian32(boxData, 4);
+    qsizetype pos = 8;
+    for (quint32 entry = 0; entry < entryCount; ++entry) {
+        const qsizetype idSize = version == 0 ? 2 : 4;
+        if (pos + idSize + 1 > boxData.size()) return;
+        const quint32 itemId = version == 0 ? readBigEndian16(boxData, pos) : readBigEndian32(boxData, pos);
+        pos += idSize;
+        const int associationCount = static_cast<quint8>(boxData[pos]);
+        pos += 1;
+        for (int i = 0; i < associationCount; ++i) {
+            if (pos + (wideIndices ? 2 : 1) > boxData.size()) return;
+            const quint16 index = wideIndices ? readBigEndian16(boxData, pos) & 0x7FFF : static_cast<quint8>(boxData[pos]) & 0x7F;
+            pos += wideIndices ? 2 : 1;
+            // Index 0 means no property
+            if (index > 0) {
+                items.associations.append({itemId, index});
+            }
+        }
+    }
+}
+
+// Collects 'pitm', 'ipma' and the item properties from the box tree
+static void collectIsoMediaBoxes(QByteArrayView data, IsoMediaItems &items, bool inPropertyContainer = false) {
+    qsizetype pos = 0;
+
+    while (pos + 8 <= data.size()) {
+        const qsizetype boxStart = pos;
+
+        // Box size (4 bytes) and box type (4 bytes)
+        const quint32 boxSize = readBigEndian32(data, pos);
+        const quint32 boxType = readBigEndian32(data, pos + 4);
+        pos += 8;
+
         // Handle extended size
         qint64 actualSize = boxSize;
         if (boxSize == 1) {
-            QByteArray extSizeBytes = file.read(8);
-            if (extSizeBytes.size() < 8) break;
-            actualSize = 0;
-            for (int i = 0; i < 8; i++) {
-                actualSize = (actualSize << 8) | static_cast<unsigned char>(extSizeBytes[i]);
-            }
+            if (pos + 8 > data.size()) break;
+            actualSize = static_cast<qint64>(readBigEndian64(data, pos));
+            pos += 8;
         } else if (boxSize == 0) {
-            actualSize = maxEnd - boxStart;
+            actualSize = data.size() - boxStart;
         }
-        
-        qint64 dataStart = file.pos();
-        qint64 dataEnd = boxStart + actualSize;
-        
-        // Check for 'colr' box (Color Information Box)
-        if (boxType == "colr") {
-            QByteArray colrData = file.read(qMin(actualSize - 8, (qint64)20));
-            
-            if (colrData.size() >= 11) {
-                // colr box structure:
-                // 4 bytes: color_type (e.g., "nclx" for MPEG color parameters, "prof" for ICC profile)
-                QString colorType = QString::fromLatin1(colrData.left(4));
-                
-                if (colorType == "nclx" || colorType == "rncl") { // Some encoders write it reversed
-                    // NCLX color parameters:
-                    // 2 bytes: color_primaries
-                    // 2 bytes: transfer_characteristics
-                    // 2 bytes: matrix_coefficients
-                    // 1 byte: full_range_flag
-                    
-                    if (colrData.size() >= 11) {
-                        quint16 colorPrimaries = (static_cast<unsigned char>(colrData[4]) << 8) |
-                                                 static_cast<unsigned char>(colrData[5]);
-                        quint16 transferCharacteristics = (static_cast<unsigned char>(colrData[6]) << 8) |
-                                                          static_cast<unsigned char>(colrData[7]);
-                        
-                        // Transfer Characteristics = 16 is PQ (SMPTE ST 2084)
-                        // Color Primaries = 9 is BT.2020
-                        if (transferCharacteristics == 16 || colorPrimaries == 9) {
-                            return true;
-                        }
-                    }
-                } else if (colorType == "prof") {
-                    // ICC profile embedded - search for HDR indicators in the profile
-                    qint64 savedPos = file.pos();
-                    // Read more of the profile - skip the first 4 bytes (which is the colorType "prof")
-                    // and read up to 8KB of the profile
-                    QByteArray profileData = file.read(qMin(actualSize - 8, (qint64)8192));
-                    QString profileStr = QString::fromLatin1(profileData);
-                    
-                    // Look for Rec. 2020 PQ profile name
-                    if (profileStr.contains("Rec. 2020 PQ", Qt::CaseInsensitive) || 
-                        profileStr.contains("Rec. 2020", Qt::CaseInsensitive) ||
-                        profileStr.contains("BT.2020", Qt::CaseInsensitive)) {
-                        return true;
-                    }
-                    
-                    // Also check for "2020" and "PQ" separately  
-                    if (profileStr.contains("2020") && profileStr.contains("PQ")) {
-                        return true;
-                    }
-                    
-                    file.seek(savedPos);
-                }
-            }
-        }
-        
-        // Recursively parse container boxes
-        if (boxType == "meta" || boxType == "iprp" || boxType == "ipco" || 
-            boxType == "moov" || boxType == "trak" || boxType == "mdia") {
-            qint64 savedPos = file.pos();
-            
+        if (actualSize < pos - boxStart) break;
+
+        // Clamp to the available data, a truncated prefix still yields the boxes it contains
+        const qsizetype boxEnd = boxStart + qMin<qint64>(actualSize, data.size() - boxStart);
+        const QByteArrayView boxData = data.sliced(pos, boxEnd - pos);
+
+        if (inPropertyContainer) {
+            // Every child counts for the indices, also the ones the probe does not read
+            items.properties.append({boxType, boxData});
+        } else if (boxType == fourcc("meta")) {
             // 'meta' box has 4 bytes version/flags, skip them
-            if (boxType == "meta") {
-                file.seek(savedPos + 4);
-            }
-            
-            if (parseIsoMediaBoxesForHDR(file, dataEnd)) {
-                return true;
+            if (boxData.size() > 4) {
+                collectIsoMediaBoxes(boxData.sliced(4), items);
             }
+        } else if (boxType == fourcc("pitm")) {
+            parsePrimaryItem(boxData, items);
+        } else if (boxType == fourcc("ipma")) {
+            parsePropertyAssociations(boxData, items);
+        } else if (boxType == fourcc("ipco")) {
+            collectIsoMediaBoxes(boxData, items, true);
+        } else if (boxType == fourcc("iprp") || boxType == fourcc("moov") || boxType == fourcc("trak") ||
+                   boxType == fourcc("mdia")) {
+            collectIsoMediaBoxes(boxData, items);
+        } else if (boxType == fourcc("colr") || boxType == fourcc("ispe") || boxType == fourcc("irot")) {
+            items.looseProperties.append({boxType, boxData});
         }
-        
+
         // Move to next box
-        if (dataEnd > file.pos()) {
-            file.seek(dataEnd);
-        } else {
-            break;
-        }
+        pos = boxEnd;
     }
-    
-    return false;
 }
 
+// Applies one 'colr' box, returns whether it describes HDR content
+static bool applyIsoMediaColor(QByteArrayView boxData, FileDetector::ImageProbe &probe) {
+    if (boxData.size() < 11) return false;
+    // 4 bytes: color_type (e.g., "nclx" for MPEG color parameters, "prof" for ICC profile)
+    const quint32 colorType = readBigEndian32(boxData, 0);
 
-bool FileDetector::isSupportedImageFormat(const QString &filePath)
-{
-    ImageFormat format = detectImageFormat(filePath);
-    if (format != ImageFormat::Unknown) {
-        return true;
-    }
+    if (colorType == fourcc("nclx") || colorType == fourcc("rncl")) { // Some encoders write it reversed
+        // NCLX color parameters:
+        // 2 bytes: color_primaries
+        // 2 bytes: transfer_characteristics
+        // 2 bytes: matrix_coefficients
+        // 1 byte: full_range_flag
+        const quint16 colorPrimaries = readBigEndian16(boxData, 4);
+        const quint16 transferCharacteristics = readBigEndian16(boxData, 6);
+        probe.transfer = transferFromCicp(transferCharacteristics);
+        probe.primaries = primariesFromCicp(colorPrimaries);
 
-    // Fallback: Ask Qt if it could decode the file. This enables support for additional file types,
-    // like RAW files, that the magic-byte based detector does not recognize explicitly.
-    QImageReader reader(filePath);
-    if (reader.canRead()) {
-        qDebug() << "Qt reports supported image format for" << filePath
-                 << "even though magic bytes are unknown";
-        return true;
+        // Transfer Characteristics = 16 is PQ (SMPTE ST 2084)
+        // Color Primaries = 9 is BT.2020
+        return transferCharacteristics == 16 || colorPrimaries == 9;
     }
+    if (colorType == fourcc("prof")) {
+        // ICC profile embedded - search the first 8 KB of the profile for HDR indicators
+        const QLatin1StringView profileStr(boxData.sliced(4).first(qMin<qsizetype>(boxData.size() - 4, 8192)));
+        applyIccProfileName(profileStr, probe);
 
+        // Look for Rec. 2020 PQ profile name, or "2020" and "PQ" separately
+        return profileStr.contains("Rec. 2020"_L1, Qt::CaseInsensitive) ||
+               profileStr.contains("BT.2020"_L1, Qt::CaseInsensitive) ||
+               (profileStr.contains("2020"_L1) && profileStr.contains("PQ"_L1));
+    }
     return false;
 }
 
-bool FileDetector::isImageHDR(const QString &imagePath)
+// Applies the properties of one item, or of the whole file when the item associations are missing.
+// Returns whether a 'colr' box describes HDR content.
+static bool applyIsoMediaProperties(const QList<std::pair<quint32, QByteArrayView>> &properties, FileDetector::ImageProbe &probe) {
+    bool hdr = false;
+    bool haveNclx = false;
+    for (const auto &[boxType, boxData] : properties) {
+        if (boxType == fourcc("colr")) {
+            // An item may carry both nclx and an ICC profile, nclx takes precedence
+            const quint32 colorType = readBigEndian32(boxData, 0);
+            const bool nclx = colorType == fourcc("nclx") || colorType == fourcc("rncl");
+            if (haveNclx && !nclx) continue;
+            if (nclx && !haveNclx) hdr = false;
+            haveNclx = haveNclx || nclx;
+            hdr = applyIsoMediaColor(boxData, probe) || hdr;
+        } else if (boxType == fourcc("irot") && !boxData.isEmpty()) {
+            // 'irot' (Image Rotation): 1 byte, lower two bits are anti-clockwise quarter turns
+            static constexpr QImageIOHandler::Transformation rotations[] = {
+                QImageIOHandler::TransformationNone,
+                QImageIOHandler::TransformationRotate270,
+                QImageIOHandler::TransformationRotate180,
+                QImageIOHandler::TransformationRotate90,
+            };
+            probe.transformations = rotations[static_cast<unsigned char>(boxData[0]) & 0x03];
+        } else if (boxType == fourcc("ispe") && boxData.size() >= 12 && !probe.size.isValid()) {
+            // 'ispe' (Image Spatial Extents): 4 bytes version/flags, 4 bytes width, 4 bytes height
+            probe.size = QSize(static_cast<int>(readBigEndian32(boxData, 4)),
+                               static_cast<int>(readBigEndian32(boxData, 8)));
+        }
+    }
+    return hdr;
+}
+
+FileDetector::ImageProbe FileDetector::probe(const QString &imagePath)
 {
     // Convert URL to local file path if needed
     QString localPath = imagePath;
@@ -160,45 +270,176 @@ bool FileDetector::isImageHDR(const QString &imagePath)
         localPath = QUrl(imagePath).toLocalFile();
     }
 
+    // A stat is much cheaper than opening and parsing the file again
+    const std::optional<ProbeCache::FileKey> key = ProbeCache::keyForFile(localPath);
+    if (!key) {
+        qWarning() << "Cannot stat file for probing:" << localPath;
+        return {};
+    }
+
+    TraceSpan span("probe", "FileDetector::probe");
+    span.setDetail(localPath);
+
+    auto &cache = ProbeCache::instance();
+    auto &metrics = Metrics::instance();
+    if (const auto cached = cache.find(*key)) {
+        metrics.probeCacheHits.add();
+        return *cached;
+    }
+
+    Metrics::ScopedTimer probeTimer(metrics.probeTime);
+    const ImageProbe result = probeFile(localPath);
+    cache.insert(*key, result);
+    return result;
+}
+
+FileDetector::ImageProbe FileDetector::probeFile(const QString &localPath)
+{
+    TraceSpan span("probe", "FileDetector::probeFile");
+    span.setDetail(localPath);
+    ImageProbe probe;
+
+    QFile file(localPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open file for probing:" << localPath;
+        return probe;
+    }
+
+    // Map the file once, the parsers then read only the pages they touch, without further syscalls or copies.
+    // Files that cannot be mapped (e.g. on some FUSE filesystems) are read once into a bounded buffer.
+    QByteArray prefix;
+    QByteArrayView data;
+    uchar *mapped = file.size() > 0 ? file.map(0, file.size()) : nullptr;
+    if (mapped) {
+        data = QByteArrayView(mapped, file.size());
+    } else {
+        prefix = file.read(12);
+    }
+
     // Use magic bytes for format detection
-    ImageFormat format = detectImageFormat(localPath);
-    
-    QString formatName;
-    bool isHDR = false;
-    
-    switch (format) {
+    probe.format = detectImageFormat(mapped ? data.first(qMin<qsizetype>(data.size(), 12)) : QByteArrayView(prefix));
+    probe.isSupported = probe.format != ImageFormat::Unknown;
+
+    // RAW files look like TIFF or have vendor specific magic, they are recognized by their suffix
+    if ((probe.format == ImageFormat::TIFF || probe.format == ImageFormat::Unknown) && RawDecoder::isRawFile(localPath)) {
+        probe.format = ImageFormat::RAW;
+        probe.isSupported = true;
+    }
+
+    // JPEG XL streams its header from the file and LibRaw reads RAW files itself, the other parsers need the bounded prefix
+    if (!mapped && probe.format != ImageFormat::JPEG_XL && probe.format != ImageFormat::RAW) {
+        prefix += file.read(PROBE_PREFIX_LIMIT - prefix.size());
+        data = prefix;
+    }
+
+    // Format specific parsing of color information, and of dimensions where the container has them
+    switch (probe.format) {
         case ImageFormat::PNG:
-            formatName = QStringLiteral("PNG");
-            isHDR = isPngHDR(localPath);
+            probePng(data, probe);
             break;
         case ImageFormat::AVIF:
-            formatName = QStringLiteral("AVIF");
-            isHDR = isAvifHDR(localPath);
-            break;
         case ImageFormat::HEIC:
-            formatName = QStringLiteral("HEIC");
-            isHDR = isHeicHDR(localPath);
+            probeIsoMedia(data, probe);
             break;
         case ImageFormat::JPEG_XL:
-            formatName = QStringLiteral("JPEG-XL");
-            isHDR = isJpegXlHDR(localPath);
+            probeJpegXl(file, data, probe);
             break;
         case ImageFormat::JPEG:
-            formatName = QStringLiteral("JPEG");
-            isHDR = isJpegHDR(localPath);
+            // JPEG is always SDR
+            probe.transfer = TransferFunction::SRGB;
             break;
         case ImageFormat::TIFF:
-            formatName = QStringLiteral("TIFF");
-            isHDR = isTiffHDR(localPath);
+            probeTiff(data, probe);
+            break;
+        case ImageFormat::RAW:
+            RawDecoder::probe(localPath, probe);
             break;
         case ImageFormat::Unknown:
-            qWarning() << "Unknown image format (magic bytes not recognized):" << localPath;
-            return false;
+            break;
     }
-    
-    qDebug() << "Detected format (via magic bytes):" << formatName << "| HDR:" << (isHDR ? "Yes" : "No") << "| File:" << localPath;
-    
-    return isHDR;
+
+    // Remaining metadata from the Qt image plugin, reading from the already open file.
+    // Skipped when the parsers above found the size, some plugins (e.g. HEIF) read the whole file.
+    if (!probe.size.isValid() || probe.format == ImageFormat::JPEG) {
+        file.seek(0);
+        QImageReader reader(&file);
+        if (!probe.isSupported) {
+            // Fallback: Ask Qt if it could decode the file. This enables support for additional file types,
+            // like RAW files, that the magic-byte based detector does not recognize explicitly.
+            if (!reader.canRead()) {
+                return probe;
+            }
+            qDebug() << "Qt reports supported image format for" << localPath
+                     << "even though magic bytes are unknown";
+            probe.isSupported = true;
+        }
+        probe.size = reader.size();
+        probe.transformations = reader.transformation();
+        const QImage::Format imageFormat = reader.imageFormat();
+        if (probe.bitDepth == 0 && imageFormat != QImage::Format_Invalid) {
+            const QPixelFormat pixelFormat = QImage::toPixelFormat(imageFormat);
+            probe.bitDepth = pixelFormat.channelCount() > 0 ? pixelFormat.bitsPerPixel() / pixelFormat.channelCount() : 0;
+        }
+    }
+
+    return probe;
+}
+
+const char *FileDetector::formatName(ImageFormat format)
+{
+    switch (format) {
+        case ImageFormat::PNG: return "PNG";
+        case ImageFormat::AVIF: return "AVIF";
+        case ImageFormat::HEIC: return "HEIC";
+        case ImageFormat::JPEG_XL: return "JPEG-XL";
+        case ImageFormat::JPEG: return "JPEG";
+        case ImageFormat::TIFF: return "TIFF";
+        case ImageFormat::RAW: return "RAW";
+        case ImageFormat::Unknown: break;
+    }
+    return "Unknown";
+}
+
+const char *FileDetector::transferFunctionName(TransferFunction transfer)
+{
+    switch (transfer) {
+        case TransferFunction::SRGB: return "sRGB";
+        case TransferFunction::PQ: return "PQ";
+        case TransferFunction::HLG: return "HLG";
+        case TransferFunction::Other: return "Other";
+        case TransferFunction::Unknown: break;
+    }
+    return "Unknown";
+}
+
+const char *FileDetector::colorPrimariesName(ColorPrimaries primaries)
+{
+    switch (primaries) {
+        case ColorPrimaries::BT709: return "BT.709";
+        case ColorPrimaries::BT2020: return "BT.2020";
+        case ColorPrimaries::DisplayP3: return "Display P3";
+        case ColorPrimaries::Other: return "Other";
+        case ColorPrimaries::Unknown: break;
+    }
+    return "Unknown";
+}
+
+bool FileDetector::isSupportedImageFormat(const QString &filePath)
+{
+    return probe(filePath).isSupported;
+}
+
+bool FileDetector::isImageHDR(const QString &imagePath)
+{
+    const ImageProbe result = probe(imagePath);
+    if (result.format == ImageFormat::Unknown) {
+        qWarning() << "Unknown image format (magic bytes not recognized):" << imagePath;
+        return false;
+    }
+
+    qDebug() << "Detected format (via magic bytes):" << formatName(result.format)
+             << "| HDR:" << (result.isHDR ? "Yes" : "No") << "| File:" << imagePath;
+    return result.isHDR;
 }
 
 FileDetector::ImageFormat FileDetector::detectImageFormat(const QString &filePath)
@@ -210,9 +451,11 @@ FileDetector::ImageFormat FileDetector::detectImageFormat(const QString &filePat
     }
 
     // Read first 12 bytes for magic number detection
-    QByteArray header = file.read(12);
-    file.close();
+    return detectImageFormat(file.read(12));
+}
 
+FileDetector::ImageFormat FileDetector::detectImageFormat(QByteArrayView header)
+{
     if (header.size() < 4) {
         return ImageFormat::Unknown;
     }
@@ -290,140 +533,167 @@ FileDetector::ImageFormat FileDetector::detectImageFormat(const QString &filePat
     return ImageFormat::Unknown;
 }
 
-bool FileDetector::isPngHDR(const QString &filePath)
+void FileDetector::probePng(QByteArrayView data, ImageProbe &probe)
 {
     // PNG HDR detection: Check for cICP chunk (color information) or iCCP profile name
     // cICP chunk format: Color Primaries (1 byte), Transfer Characteristics (1 byte), Matrix Coefficients (1 byte), Full Range Flag (1 byte)
     // Transfer Characteristics = 16 indicates PQ (HDR10/HDR)
     // Also check iCCP profile name for "PQ" or "Rec. 2020"
-    
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    
+
     // Skip PNG signature (8 bytes)
-    file.seek(8);
-    
-    while (!file.atEnd()) {
-        // Read chunk length (4 bytes, big-endian)
-        QByteArray lengthBytes = file.read(4);
-        if (lengthBytes.size() < 4) break;
-        
-        quint32 chunkLength = (static_cast<unsigned char>(lengthBytes[0]) << 24) |
-                              (static_cast<unsigned char>(lengthBytes[1]) << 16) |
-                              (static_cast<unsigned char>(lengthBytes[2]) << 8) |
-                              static_cast<unsigned char>(lengthBytes[3]);
-        
-        // Read chunk type (4 bytes)
-        QByteArray chunkType = file.read(4);
-        if (chunkType.size() < 4) break;
-        
+    qsizetype pos = 8;
+
+    while (pos + 8 <= data.size()) {
+        // Chunk length (4 bytes, big-endian) and chunk type (4 bytes)
+        const quint32 chunkLength = readBigEndian32(data, pos);
+        const quint32 chunkType = readBigEndian32(data, pos + 4);
+
+        const qsizetype chunkDataStart = pos + 8;
+        const QByteArrayView chunkData = data.sliced(chunkDataStart, qMin<qint64>(chunkLength, data.size() - chunkDataStart));
+
+        // IHDR: width (4 bytes), height (4 bytes), bit depth (1 byte), ...
+        if (chunkType == fourcc("IHDR") && chunkData.size() >= 9) {
+            probe.size = QSize(static_cast<int>(readBigEndian32(chunkData, 0)),
+                               static_cast<int>(readBigEndian32(chunkData, 4)));
+            probe.bitDepth = static_cast<unsigned char>(chunkData[8]);
+        }
+
         // Check for cICP chunk (Coding-Independent Code Points)
-        if (chunkType == "cICP") {
-            QByteArray chunkData = file.read(qMin(chunkLength, 4u));
-            if (chunkData.size() >= 2) {
-                // Byte 1: Transfer Characteristics
-                unsigned char transferCharacteristics = static_cast<unsigned char>(chunkData[1]);
-                // Transfer Characteristics = 16 is PQ (SMPTE ST 2084)
-                if (transferCharacteristics == 16) {
-                    file.close();
-                    return true;
-                }
+        if (chunkType == fourcc("cICP") && chunkData.size() >= 2) {
+            probe.primaries = primariesFromCicp(static_cast<unsigned char>(chunkData[0]));
+            // Byte 1: Transfer Characteristics
+            unsigned char transferCharacteristics = static_cast<unsigned char>(chunkData[1]);
+            probe.transfer = transferFromCicp(transferCharacteristics);
+            // Transfer Characteristics = 16 is PQ (SMPTE ST 2084)
+            if (transferCharacteristics == 16) {
+                probe.isHDR = true;
+                return;
             }
         }
-        
+
         // Check for iCCP chunk (embedded ICC profile)
-        if (chunkType == "iCCP") {
-            QByteArray chunkData = file.read(chunkLength);
-            QString profileData = QString::fromLatin1(chunkData);
-            
+        if (chunkType == fourcc("iCCP")) {
+            const QLatin1StringView profileData(chunkData);
+            applyIccProfileName(profileData, probe);
+
             // Check if profile name contains HDR indicators
-            if (profileData.contains("PQ", Qt::CaseInsensitive) || 
-                profileData.contains("Rec. 2020", Qt::CaseInsensitive) ||
-                profileData.contains("BT.2020", Qt::CaseInsensitive)) {
-                file.close();
-                return true;
+            if (profileData.contains("PQ"_L1, Qt::CaseInsensitive) ||
+                profileData.contains("Rec. 2020"_L1, Qt::CaseInsensitive) ||
+                profileData.contains("BT.2020"_L1, Qt::CaseInsensitive)) {
+                probe.isHDR = true;
+                return;
             }
-            
-            // Skip CRC (already read as part of chunk data if needed)
-            file.seek(file.pos() + 4);
-            continue;
         }
-        
+
         // Check for IEND chunk (end of PNG)
-        if (chunkType == "IEND") {
+        if (chunkType == fourcc("IEND")) {
             break;
         }
-        
-        // Skip chunk data and CRC (4 bytes)
-        file.seek(file.pos() + chunkLength + 4);
+
+        // Skip to the end of the chunk data and CRC (4 bytes)
+        pos = chunkDataStart + static_cast<qint64>(chunkLength) + 4;
     }
-    
-    file.close();
-    return false;
 }
 
-bool FileDetector::isAvifHDR(const QString &filePath)
+void FileDetector::probeIsoMedia(QByteArrayView data, ImageProbe &probe)
 {
-    // AVIF HDR detection: Parse ISO Base Media File Format (MP4 container)
-    // Look for 'colr' box (Color Information Box) inside 'ipco' (Item Property Container)
+    // AVIF/HEIC HDR detection: Parse ISO Base Media File Format (MP4 container)
+    // Size, rotation and 'colr' (Color Information Box) are the properties of the primary item
+    // ('pitm'), found through its associations ('ipma') in 'ipco' (Item Property Container). For grid
+    // images, which most phones write, the tiles have their own smaller 'ispe'.
     // Transfer Characteristics = 16 (PQ) or Color Primaries = 9 (BT.2020) indicates HDR
-    
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        return false;
+    IsoMediaItems items;
+    collectIsoMediaBoxes(data, items);
+
+    QList<std::pair<quint32, QByteArrayView>> primaryProperties;
+    if (items.primaryItem) {
+        for (const auto &[itemId, index] : std::as_const(items.associations)) {
+            if (itemId == *items.primaryItem && index <= items.properties.size()) {
+                primaryProperties.append(items.properties[index - 1]);
+            }
+        }
     }
-    
-    // Parse boxes recursively
-    bool isHDR = parseIsoMediaBoxesForHDR(file);
-    
-    file.close();
-    return isHDR;
-}
 
-bool FileDetector::isHeicHDR(const QString &filePath)
-{
-    // HEIC uses the same format as AVIF (ISO Base Media File Format)
-    // Both use the same HDR detection method
-    return isAvifHDR(filePath);
+    if (primaryProperties.isEmpty()) {
+        // No usable item structure, e.g. a truncated prefix or an image sequence: first of every property
+        probe.isHDR = applyIsoMediaProperties(items.properties + items.looseProperties, probe);
+        return;
+    }
+
+    probe.isHDR = applyIsoMediaProperties(primaryProperties, probe);
+    // Some encoders associate 'colr' with the tiles of a grid only, they share the color of the image
+    const bool primaryHasColor = std::ranges::any_of(primaryProperties, [](const auto &property) {
+        return property.first == fourcc("colr");
+    });
+    if (!primaryHasColor) {
+        QList<std::pair<quint32, QByteArrayView>> colors;
+        for (const auto &property : std::as_const(items.properties)) {
+            if (property.first == fourcc("colr")) {
+                colors.append(property);
+            }
+        }
+        probe.isHDR = applyIsoMediaProperties(colors, probe);
+    }
 }
 
-bool FileDetector::isJpegXlHDR(const QString &filePath)
+void FileDetector::probeJpegXl(QFile &file, QByteArrayView data, ImageProbe &probe)
 {
     // JPEG-XL HDR detection using libjxl library
-    // This properly decodes the JXL header to extract color encoding information
-    
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    
-    QByteArray fileData = file.readAll();
-    file.close();
-    
-    if (fileData.isEmpty()) {
-        return false;
-    }
-    
+    // This properly decodes the JXL header to extract color encoding information.
+    // The decoder is fed in small chunks and stops at the color encoding, so the cost does not
+    // depend on the file size.
+
     // Create JXL decoder
     auto dec = JxlDecoderMake(nullptr);
     if (!dec) {
-        return false;
+        return;
     }
     
     // Subscribe to basic info to get color encoding
     if (JxlDecoderSubscribeEvents(dec.get(), JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING) != JXL_DEC_SUCCESS) {
-        return false;
+        return;
     }
-    
-    // Set input data
-    if (JxlDecoderSetInput(dec.get(), 
-                           reinterpret_cast<const uint8_t*>(fileData.constData()), 
-                           fileData.size()) != JXL_DEC_SUCCESS) {
-        return false;
+
+    // Chunks come from the mapping when there is one, otherwise they are read from the file
+    const bool streamFromFile = data.isEmpty();
+    if (streamFromFile) {
+        file.seek(0);
     }
-    
+    QByteArray buffer;
+    qsizetype offset = 0;
+
+    auto feedNextChunk = [&]() -> bool {
+        // Bytes the decoder has not consumed yet must be passed again, followed by the next chunk
+        const qsizetype unconsumed = static_cast<qsizetype>(JxlDecoderReleaseInput(dec.get()));
+        const uint8_t *input = nullptr;
+        qsizetype inputSize = 0;
+
+        if (streamFromFile) {
+            buffer.remove(0, buffer.size() - unconsumed);
+            const QByteArray chunk = file.read(JXL_PROBE_CHUNK_SIZE);
+            if (chunk.isEmpty()) {
+                return false;
+            }
+            buffer.append(chunk);
+            input = reinterpret_cast<const uint8_t *>(buffer.constData());
+            inputSize = buffer.size();
+        } else {
+            if (offset >= data.size()) {
+                return false;
+            }
+            const qsizetype start = offset - unconsumed;
+            offset = qMin(data.size(), offset + JXL_PROBE_CHUNK_SIZE);
+            input = reinterpret_cast<const uint8_t *>(data.data() + start);
+            inputSize = offset - start;
+        }
+
+        return JxlDecoderSetInput(dec.get(), input, inputSize) == JXL_DEC_SUCCESS;
+    };
+
+    if (!feedNextChunk()) {
+        return;
+    }
+
     bool isHDR = false;
     JxlBasicInfo info;
     
@@ -434,18 +704,34 @@ bool FileDetector::isJpegXlHDR(const QString &filePath)
         if (status == JXL_DEC_ERROR) {
             break;
         } else if (status == JXL_DEC_NEED_MORE_INPUT) {
-            break;
+            if (!feedNextChunk()) {
+                break; // Truncated file
+            }
         } else if (status == JXL_DEC_BASIC_INFO) {
             // Get basic info
             if (JxlDecoderGetBasicInfo(dec.get(), &info) == JXL_DEC_SUCCESS) {
-                // Check bits per sample - HDR typically uses > 8 bits
-                // However, this alone doesn't determine HDR
-                // We need to check the color encoding
+                // Bits per sample alone doesn't determine HDR, we need to check the color encoding
+                probe.size = QSize(static_cast<int>(info.xsize), static_cast<int>(info.ysize));
+                probe.bitDepth = static_cast<int>(info.bits_per_sample);
+                probe.transformations = transformationsFromExif(info.orientation);
             }
         } else if (status == JXL_DEC_COLOR_ENCODING) {
             // Get color encoding
             JxlColorEncoding color_encoding;
             if (JxlDecoderGetColorAsEncodedProfile(dec.get(), JXL_COLOR_PROFILE_TARGET_DATA, &color_encoding) == JXL_DEC_SUCCESS) {
+                switch (color_encoding.transfer_function) {
+                    case JXL_TRANSFER_FUNCTION_SRGB: probe.transfer = TransferFunction::SRGB; break;
+                    case JXL_TRANSFER_FUNCTION_PQ: probe.transfer = TransferFunction::PQ; break;
+                    case JXL_TRANSFER_FUNCTION_HLG: probe.transfer = TransferFunction::HLG; break;
+                    default: probe.transfer = TransferFunction::Other; break;
+                }
+                switch (color_encoding.primaries) {
+                    case JXL_PRIMARIES_SRGB: probe.primaries = ColorPrimaries::BT709; break;
+                    case JXL_PRIMARIES_2100: probe.primaries = ColorPrimaries::BT2020; break;
+                    case JXL_PRIMARIES_P3: probe.primaries = ColorPrimaries::DisplayP3; break;
+                    default: probe.primaries = ColorPrimaries::Other; break;
+                }
+
                 // Check transfer function
                 // PQ (Perceptual Quantizer) = JXL_TRANSFER_FUNCTION_PQ
                 // HLG (Hybrid Log-Gamma) = JXL_TRANSFER_FUNCTION_HLG
@@ -466,88 +752,117 @@ bool FileDetector::isJpegXlHDR(const QString &filePath)
         }
     }
     
-    return isHDR;
+    probe.isHDR = isHDR;
 }
 
-bool FileDetector::isJpegHDR(const QString &filePath)
-{
-    // JPEG is always SDR
-    return false;
-}
+// Reads an ICC profile description, either a v2 'desc' (ASCII) or a v4 'mluc' (UTF-16BE) tag
+static QString iccProfileDescription(QByteArrayView icc, qint64 offset, qint64 size) {
+    if (offset < 0 || size < 12 || offset + size > icc.size()) return {};
+    const QByteArrayView tag = icc.sliced(offset, size);
 
-bool FileDetector::isTiffHDR(const QString &filePath)
-{
-    // TIFF HDR detection: Look for ICC profile with HDR indicators
-    // TIFF files store ICC profiles in tag 34675 (0x8773)
-    // We search for "PQ", "Rec. 2020", or "BT.2020" in the profile
-    // Note: TIFF files can be very large, so we search in chunks
-    
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        return false;
+    const quint32 type = readBigEndian32(tag, 0);
+    if (type == fourcc("desc")) {
+        const qint64 length = readBigEndian32(tag, 8);
+        return QString::fromLatin1(tag.sliced(12, qMin(length, static_cast<qint64>(tag.size()) - 12)));
     }
-    
-    // Read TIFF header (first 8 bytes)
-    QByteArray header = file.read(8);
-    if (header.size() < 8) {
-        file.close();
-        return false;
+    if (type == fourcc("mluc") && readBigEndian32(tag, 8) > 0) {
+        // First record: language (2 bytes), country (2 bytes), length (4 bytes), offset (4 bytes)
+        const qint64 length = readBigEndian32(tag, 20);
+        const qint64 stringOffset = readBigEndian32(tag, 24);
+        if (stringOffset + length > tag.size()) return {};
+        QString description;
+        for (qint64 i = 0; i + 1 < length; i += 2) {
+            description += QChar(readBigEndian16(tag, stringOffset + i));
+        }
+        return description;
     }
-    
-    // Check byte order (II = little-endian, MM = big-endian)
-    bool littleEndian = (header[0] == 'I' && header[1] == 'I');
-    bool bigEndian = (header[0] == 'M' && header[1] == 'M');
-    
-    if (!littleEndian && !bigEndian) {
-        file.close();
+    return {};
+}
+
+// Reads transfer and primaries from an ICC profile: the 'cicp' tag when present (ICC v4.4),
+// otherwise the profile description. Returns true for a PQ or HLG profile.
+static bool probeIccProfile(QByteArrayView icc, FileDetector::ImageProbe &probe) {
+    // 128 byte header, then the tag count and 12 byte entries: signature, offset, size
+    const qint64 tagCount = readBigEndian32(icc, 128);
+    if (tagCount <= 0 || 132 + tagCount * 12 > icc.size()) {
         return false;
     }
-    
-    // Strategy: Read from beginning and end of file to find ICC profile
-    // ICC profiles are usually near the end in TIFF files
-    
-    // Read first 5 MB
-    file.seek(0);
-    QByteArray dataBegin = file.read(5 * 1024 * 1024);
-    QString contentBegin = QString::fromLatin1(dataBegin);
-    
-    // Check first part
-    if (contentBegin.contains("Rec. 2020 PQ", Qt::CaseInsensitive) ||
-        contentBegin.contains("BT.2020", Qt::CaseInsensitive)) {
-        file.close();
-        return true;
+
+    QString description;
+    for (qint64 i = 0; i < tagCount; ++i) {
+        const qint64 entry = 132 + i * 12;
+        const quint32 signature = readBigEndian32(icc, entry);
+        const qint64 offset = readBigEndian32(icc, entry + 4);
+        const qint64 size = readBigEndian32(icc, entry + 8);
+
+        // 'cicp' type: signature (4 bytes), reserved (4 bytes), primaries, transfer, matrix, full range
+        if (signature == fourcc("cicp") && size >= 12 && offset + 12 <= icc.size()) {
+            const int primaries = static_cast<unsigned char>(icc[offset + 8]);
+            const int transfer = static_cast<unsigned char>(icc[offset + 9]);
+            probe.primaries = primariesFromCicp(primaries);
+            probe.transfer = transferFromCicp(transfer);
+            return probe.transfer == FileDetector::TransferFunction::PQ ||
+                   probe.transfer == FileDetector::TransferFunction::HLG;
+        }
+        if (signature == fourcc("desc")) {
+            description = iccProfileDescription(icc, offset, size);
+        }
     }
-    
-    bool has2020 = contentBegin.contains("2020", Qt::CaseInsensitive);
-    bool hasPQ = contentBegin.contains("PQ", Qt::CaseInsensitive);
-    
-    if (has2020 && hasPQ) {
-        file.close();
+
+    // Profile names like "Rec. 2020 PQ" or "ITU-R BT.2100 PQ"
+    const bool hasPQ = description.contains("PQ"_L1);
+    const bool has2020 = description.contains("2020"_L1) || description.contains("2100"_L1);
+    if (hasPQ && has2020) {
+        probe.transfer = FileDetector::TransferFunction::PQ;
+        probe.primaries = FileDetector::ColorPrimaries::BT2020;
         return true;
     }
-    
-    // Read last 5 MB (where ICC profile usually is)
-    qint64 fileSize = file.size();
-    if (fileSize > 5 * 1024 * 1024) {
-        file.seek(fileSize - 5 * 1024 * 1024);
-        QByteArray dataEnd = file.read(5 * 1024 * 1024);
-        QString contentEnd = QString::fromLatin1(dataEnd);
-        
-        if (contentEnd.contains("Rec. 2020 PQ", Qt::CaseInsensitive) ||
-            contentEnd.contains("BT.2020", Qt::CaseInsensitive)) {
-            file.close();
-            return true;
-        }
-        
-        has2020 = contentEnd.contains("2020", Qt::CaseInsensitive);
-        hasPQ = contentEnd.contains("PQ", Qt::CaseInsensitive);
-        
-        if (has2020 && hasPQ) {
-            file.close();
+    if (has2020) {
+        probe.primaries = FileDetector::ColorPrimaries::BT2020;
+    }
+    return false;
+}
+
+void FileDetector::probeTiff(QByteArrayView data, ImageProbe &probe)
+{
+    // TIFF HDR detection: Walk the IFDs to the ICC profile in tag 34675 (0x8773) and parse it.
+    // Only the header, the IFDs and the profile itself are touched, independent of the file size.
+    const std::optional<TiffReader> tiff = TiffReader::open(data);
+    if (!tiff) {
+        return;
+    }
+
+    quint64 ifd = tiff->firstIfd;
+    for (int ifdIndex = 0; ifdIndex < TiffReader::MAX_IFDS && ifd != 0; ++ifdIndex) {
+        bool profileFound = false;
+        ifd = tiff->forEachEntry(ifd, [&](const TiffReader::Entry &entry) {
+            // Dimensions, bit depth and orientation of the main image (first IFD)
+            if (ifdIndex == 0) {
+                switch (entry.tag) {
+                    case TiffReader::TAG_IMAGE_WIDTH: probe.size.setWidth(static_cast<int>(tiff->value(entry))); break;
+                    case TiffReader::TAG_IMAGE_LENGTH: probe.size.setHeight(static_cast<int>(tiff->value(entry))); break;
+                    case TiffReader::TAG_ORIENTATION: probe.transformations = transformationsFromExif(static_cast<int>(tiff->value(entry))); break;
+                    case TiffReader::TAG_BITS_PER_SAMPLE:
+                        // All samples have the same depth in practice
+                        probe.bitDepth = static_cast<int>(tiff->value(entry));
+                        break;
+                }
+            }
+
+            if (entry.tag == TiffReader::TAG_ICC_PROFILE) {
+                // UNDEFINED bytes, stored at the offset unless they fit in the value field
+                const qint64 profileOffset = tiff->valueOffset(entry, 1);
+                if (profileOffset >= 0 && entry.count > 0 && profileOffset <= data.size()
+                    && entry.count <= data.size() - profileOffset) {
+                    probe.isHDR = probeIccProfile(data.sliced(profileOffset, entry.count), probe);
+                }
+                profileFound = true;
+                return false;
+            }
             return true;
+        });
+        if (profileFound) {
+            return;
         }
     }
-    
-    file.close();
-    return false;
 }
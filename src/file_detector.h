@@ -1,7 +1,12 @@
 #pragma once
 
+#include <QByteArrayView>
+#include <QImageIOHandler>
+#include <QSize>
 #include <QString>
 
+class QFile;
+
 class FileDetector
 {
 public:
@@ -12,18 +17,72 @@ public:
         JPEG_XL,
         JPEG,
         TIFF,
+        // Camera RAW, decoded with LibRaw
+        RAW,
         Unknown
     };
 
+    enum class TransferFunction {
+        Unknown,
+        SRGB,
+        PQ,
+        HLG,
+        Other
+    };
+
+    enum class ColorPrimaries {
+        Unknown,
+        BT709,
+        BT2020,
+        DisplayP3,
+        Other
+    };
+
+    // Everything the viewer needs to know about a file before decoding it, filled in by a single open
+    struct ImageProbe {
+        bool isSupported = false;
+        ImageFormat format = ImageFormat::Unknown;
+        bool isHDR = false;
+        TransferFunction transfer = TransferFunction::Unknown;
+        ColorPrimaries primaries = ColorPrimaries::Unknown;
+        // Stored size, before applying the orientation
+        QSize size;
+        int bitDepth = 0;
+        QImageIOHandler::Transformations transformations = QImageIOHandler::TransformationNone;
+
+        // Size as displayed, with the orientation applied
+        QSize displaySize() const
+        {
+            return transformations.testFlag(QImageIOHandler::TransformationRotate90) ? size.transposed() : size;
+        }
+    };
+
+    // Probes the file once, the result is kept in the persistent ProbeCache until the file changes.
+    // Accepts local paths and "file://" URLs.
+    static ImageProbe probe(const QString &imagePath);
+
     static bool isImageHDR(const QString &imagePath);
     static bool isSupportedImageFormat(const QString &filePath);
     static ImageFormat detectImageFormat(const QString &filePath);
+    // Magic byte detection on the first 12 bytes of a file
+    static ImageFormat detectImageFormat(QByteArrayView header);
+
+    // Display names, also used as values of the --probe output
+    static const char *formatName(ImageFormat format);
+    static const char *transferFunctionName(TransferFunction transfer);
+    static const char *colorPrimariesName(ColorPrimaries primaries);
 
 private:
-    static bool isPngHDR(const QString &filePath);
-    static bool isAvifHDR(const QString &filePath);
-    static bool isHeicHDR(const QString &filePath);
-    static bool isJpegXlHDR(const QString &filePath);
-    static bool isJpegHDR(const QString &filePath);
-    static bool isTiffHDR(const QString &filePath);
+    // Measures the parsers without the ProbeCache in front of them
+    friend class FileDetectorBenchmark;
+    friend class FileDetectorTest;
+
+    static ImageProbe probeFile(const QString &localPath);
+
+    // The parsers work on the mapped file (or a bounded prefix of it) without copying
+    static void probePng(QByteArrayView data, ImageProbe &probe);
+    static void probeIsoMedia(QByteArrayView data, ImageProbe &probe);
+    // Streams the header from the file when data is empty (file not mapped)
+    static void probeJpegXl(QFile &file, QByteArrayView data, ImageProbe &probe);
+    static void probeTiff(QByteArrayView data, ImageProbe &probe);
 };
@@ -0,0 +1,257 @@
+#include "image_decoder.h"
+#include "embedded_preview.h"
+#include "file_detector.h"
+#include "image_pyramid.h"
+#include "metrics.h"
+#include "raw_decoder.h"
+#include "thumbnail_cache.h"
+#include "tone_mapper.h"
+#include "trace.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QUrl>
+
+#include <cmath>
+
+namespace {
+    // Leaves some slack below the budget for estimation errors
+    constexpr double REDUCED_DECODE_MARGIN = 0.9;
+}
+
+QImage ImageDecoder::decode(const QString &localPath, const QSize &requestedSize, QString *errorString)
+{
+    // LibRaw directly, with half size decoding and the processed output cache
+    if (FileDetector::probe(localPath).format == FileDetector::ImageFormat::RAW) {
+        return RawDecoder::decode(localPath, requestedSize, errorString);
+    }
+
+    TraceSpan span("decode", "ImageDecoder::decode");
+    span.setDetail(localPath);
+    QElapsedTimer timer;
+    timer.start();
+
+    QImageReader reader(localPath);
+    reader.setAutoTransform(true);
+
+    // Scaled decoding: JPEG decodes at 1/2, 1/4 or 1/8 DCT scale right away, other plugins scale after
+    // decoding. The stored size is before the orientation, requestedSize is in display orientation.
+    if (requestedSize.isValid() && !requestedSize.isEmpty()) {
+        const QSize fullSize = reader.size();
+        const QSize bounds = reader.transformation().testFlag(QImageIOHandler::TransformationRotate90)
+            ? requestedSize.transposed()
+            : requestedSize;
+        if (fullSize.isValid() && (fullSize.width() > bounds.width() || fullSize.height() > bounds.height())) {
+            reader.setScaledSize(fullSize.scaled(bounds, Qt::KeepAspectRatio));
+        }
+    }
+
+    QImage image;
+    if (!reader.read(&image)) {
+        const QString error = reader.errorString();
+        qWarning() << "Failed to decode image:" << localPath << "-" << error;
+        if (errorString) {
+            *errorString = error;
+        }
+        return {};
+    }
+
+    qDebug() << "Decoded" << localPath << image.size() << "in" << timer.elapsed() << "ms";
+    return image;
+}
+
+DecodedFrame ImageDecoder::decodeFrame(const QString &localPath, const QSize &requestedSize, QString *errorString,
+                                       MemoryBudget::Priority priority)
+{
+    // Taken before reading, a rewrite during the decode then makes the frame stale rather than the new file
+    const std::optional<ProbeCache::FileKey> fileKey = ProbeCache::keyForFile(localPath);
+    const FileDetector::ImageProbe probe = FileDetector::probe(localPath);
+
+    QSize targetSize = probe.displaySize();
+    if (requestedSize.isValid() && !requestedSize.isEmpty() && targetSize.isValid()) {
+        targetSize = targetSize.scaled(requestedSize.boundedTo(targetSize), Qt::KeepAspectRatio);
+    }
+
+    // Reserve the peak before decoding, so that two large images in a row cannot exhaust the memory
+    auto &budget = MemoryBudget::instance();
+    const qint64 estimate = estimateFrameBytes(probe, targetSize);
+    std::shared_ptr<MemoryBudget::Reservation> memory = budget.reserve(estimate, priority);
+    QSize decodeSize = requestedSize;
+    if (!memory && priority == MemoryBudget::Priority::Display && estimate > 0) {
+        // Decode at the resolution that fits, bytes scale with the area
+        const qint64 available = budget.makeRoom(estimate, priority);
+        const double scale = std::sqrt(double(available) / double(estimate)) * REDUCED_DECODE_MARGIN;
+        const QSize reducedSize = (QSizeF(targetSize) * scale).toSize();
+        if (!reducedSize.isEmpty()) {
+            qWarning() << "Over the memory budget, decoding" << localPath << "at" << reducedSize << "instead of" << targetSize;
+            memory = budget.reserve(estimateFrameBytes(probe, reducedSize), priority);
+            decodeSize = reducedSize;
+        }
+    }
+    if (!memory) {
+        if (errorString) {
+            *errorString = QStringLiteral("Not enough memory within the budget");
+        }
+        return {};
+    }
+
+    QImage image;
+    {
+        Metrics::ScopedTimer decodeTimer(Metrics::instance().decodeTime);
+        image = decode(localPath, decodeSize, errorString);
+    }
+    if (image.isNull()) {
+        return {};
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QImage::Format decodedFormat = image.format();
+    const int decodedBytesPerPixel = image.depth() / 8;
+    // Without PQ support in the compositor, PQ images become SDR before the pyramid
+    if (ToneMapper::appliesTo(probe)) {
+        image = ToneMapper::toneMapPQToSRGB(image, probe.primaries);
+        if (image.isNull()) {
+            if (errorString) {
+                *errorString = QStringLiteral("Tone mapping failed");
+            }
+            return {};
+        }
+    }
+    const ImagePyramid::TransferFunction transfer = textureTransfer(probe);
+
+    // Moved in, so that the conversion to the texture format can reuse the decoded buffer
+    DecodedFrame frame{ImagePyramid::build(std::move(image), transfer), decodedFormat, memory};
+    Metrics::instance().pyramidTime.record(std::chrono::nanoseconds(timer.nsecsElapsed()));
+    // A full resolution decode defines the size, scaled ones refer to the probed size
+    const QSize probedSize = probe.displaySize();
+    frame.fullSize = decodeSize.isValid() && probedSize.isValid() ? probedSize : frame.image().size();
+    frame.fileKey = fileKey;
+    // The transient decode buffers are gone, keep what stays resident
+    memory->resize(frame.sizeInBytes());
+
+    qDebug() << "Built" << frame.levels.size() << "pyramid levels for" << localPath << "in" << timer.elapsed() << "ms";
+    // Predictable memory per image: the plugin output, the texture format level 0 and the whole pyramid
+    qDebug().nospace() << "Memory per stage for " << localPath << ": decoded " << decodedBytesPerPixel
+                       << " B/px, texture " << frame.image().depth() / 8 << " B/px, pyramid "
+                       << frame.bytesPerPixel() << " B/px = " << frame.sizeInBytes() / (1024 * 1024) << " MiB";
+    return frame;
+}
+
+qint64 ImageDecoder::estimateFrameBytes(const FileDetector::ImageProbe &probe, const QSize &size)
+{
+    if (!size.isValid()) {
+        return 0;
+    }
+    const qint64 pixels = qint64(size.width()) * size.height();
+
+    // Plugins output 8 bit or 16 bit per channel; LibRaw holds its 16 bit working image next to the output
+    const int decodedBytesPerPixel = probe.format == FileDetector::ImageFormat::RAW ? 11 : (probe.bitDepth > 8 ? 8 : 4);
+    const int textureBytesPerPixel = textureTransfer(probe) == ImagePyramid::TransferFunction::PQ ? 8 : 4;
+
+    // The pyramid adds a third. The decoded buffer is converted in place when the depth matches,
+    // otherwise both exist at the same time.
+    const qint64 pyramid = pixels * textureBytesPerPixel * 4 / 3;
+    qint64 decoded = decodedBytesPerPixel != textureBytesPerPixel ? pixels * decodedBytesPerPixel : 0;
+
+    // Plugins without scaled decoding hold the full image before scaling it down
+    const QSize fullSize = probe.displaySize();
+    const bool scaledDecoding = probe.format == FileDetector::ImageFormat::JPEG || probe.format == FileDetector::ImageFormat::RAW;
+    if (!scaledDecoding && fullSize.isValid() && qint64(fullSize.width()) * fullSize.height() > pixels) {
+        decoded = qint64(fullSize.width()) * fullSize.height() * decodedBytesPerPixel;
+    }
+    return pyramid + decoded;
+}
+
+PreviewFrame ImageDecoder::decodePreview(const QString &localPath, int maxEdge)
+{
+    TraceSpan span("decode", "ImageDecoder::decodePreview");
+    span.setDetail(localPath);
+    const FileDetector::ImageProbe probe = FileDetector::probe(localPath);
+    if (!probe.isSupported) {
+        return {};
+    }
+
+    // HEIC and AVIF thumbnail items are not read by the plugins, the thumbnail cache covers them
+    QImage image = probe.format == FileDetector::ImageFormat::RAW
+        ? RawDecoder::preview(localPath, maxEdge)
+        : EmbeddedPreview::extract(localPath, probe, maxEdge);
+    if (image.isNull()) {
+        image = ThumbnailCache::cached(localPath);
+    }
+    if (image.isNull()) {
+        return {};
+    }
+
+    // Same texture format as the full image, so that the scene graph does not convert it either
+    if (ToneMapper::appliesTo(probe)) {
+        image = ToneMapper::toneMapPQToSRGB(image, probe.primaries);
+        if (image.isNull()) {
+            return {};
+        }
+    }
+    ImagePyramid::convertToTextureFormat(image, textureTransfer(probe));
+
+    // Previews are small and already decoded, they count without displacing anything
+    auto memory = MemoryBudget::instance().reserve(image.sizeInBytes(), MemoryBudget::Priority::Thumbnail);
+    if (!memory) {
+        return {};
+    }
+
+    const QSize fullSize = probe.displaySize();
+    return {image, fullSize.isValid() ? fullSize : image.size(), memory};
+}
+
+ImagePyramid::TransferFunction ImageDecoder::textureTransfer(const FileDetector::ImageProbe &probe)
+{
+    // Without PQ surfaces, PQ images are tone mapped and HLG ones are shown as SDR, which HLG allows
+    return probe.isHDR && !ToneMapper::isEnabled() ? ImagePyramid::TransferFunction::PQ : ImagePyramid::TransferFunction::SRGB;
+}
+
+QString ImageDecoder::toLocalPath(const QString &imagePath)
+{
+    if (imagePath.startsWith(QStringLiteral("file://"))) {
+        return QUrl(imagePath).toLocalFile();
+    }
+    return imagePath;
+}
+
+qint64 DecodedFrame::sizeInBytes() const
+{
+    qint64 bytes = 0;
+    for (const QImage &level : levels) {
+        bytes += level.sizeInBytes();
+    }
+    return bytes;
+}
+
+double DecodedFrame::bytesPerPixel() const
+{
+    const qint64 pixels = levels.isEmpty() ? 0 : qint64(levels.first().width()) * levels.first().height();
+    return pixels > 0 ? double(sizeInBytes()) / pixels : 0.0;
+}
+
+bool DecodedFrame::isFullResolution() const
+{
+    return !levels.isEmpty() && levels.first().size() == fullSize;
+}
+
+bool DecodedFrame::satisfies(const QSize &requestedSize) const
+{
+    if (isNull()) {
+        return false;
+    }
+    if (isFullResolution()) {
+        return true;
+    }
+    if (!requestedSize.isValid() || requestedSize.isEmpty() || !fullSize.isValid()) {
+        return false;
+    }
+
+    // What a decode for requestedSize would produce, give or take rounding
+    const QSize target = fullSize.scaled(requestedSize.boundedTo(fullSize), Qt::KeepAspectRatio);
+    const QSize size = levels.first().size();
+    return size.width() + 1 >= target.width() && size.height() + 1 >= target.height();
+}
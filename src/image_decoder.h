@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <QSize>
+#include <QString>
+
+#include <memory>
+#include <optional>
+
+#include "file_detector.h"
+#include "image_pyramid.h"
+#include "memory_budget.h"
+#include "probe_cache.h"
+
+// A decoded image together with its downsampled pyramid levels
+struct DecodedFrame {
+    // levels[0] is the full resolution image, all levels are in ImagePyramid::textureFormat()
+    QList<QImage> levels;
+    // Format the image plugin produced, before the conversion to the texture format
+    QImage::Format decodedFormat = QImage::Format_Invalid;
+    // Held by every copy, the bytes return to the MemoryBudget when the last one is gone
+    std::shared_ptr<MemoryBudget::Reservation> memory;
+    // Display size of the full image; level 0 is smaller when decoded for a smaller target
+    QSize fullSize;
+    // The file as it was when decoding started, the frame is stale once the file no longer matches
+    std::optional<ProbeCache::FileKey> fileKey;
+
+    bool isNull() const { return levels.isEmpty(); }
+    bool isFullResolution() const;
+    // Whether level 0 has the resolution that a decode for requestedSize (invalid = full) would produce
+    bool satisfies(const QSize &requestedSize) const;
+    QImage image() const { return levels.isEmpty() ? QImage() : levels.first(); }
+    qint64 sizeInBytes() const;
+    // Bytes held per pixel of the full resolution image, including all pyramid levels
+    double bytesPerPixel() const;
+};
+
+// A low resolution stand-in shown until the full image is decoded
+struct PreviewFrame {
+    QImage image;
+    // Display size of the full image, so that the layout stays put when it replaces the preview
+    QSize fullSize;
+    std::shared_ptr<MemoryBudget::Reservation> memory;
+
+    bool isNull() const { return image.isNull(); }
+};
+
+class ImageDecoder
+{
+public:
+    // Decodes the file at localPath. An invalid requestedSize decodes at full resolution,
+    // otherwise images larger than requestedSize are scaled (preserving aspect ratio) to fit into it.
+    static QImage decode(const QString &localPath, const QSize &requestedSize = {}, QString *errorString = nullptr);
+    // Decodes and builds the pyramid, filtered in linear light of the file's transfer function.
+    // The peak memory is reserved up front: over budget, display requests decode at reduced
+    // resolution and lower priorities fail, instead of exhausting the system memory.
+    static DecodedFrame decodeFrame(const QString &localPath, const QSize &requestedSize = {}, QString *errorString = nullptr,
+                                    MemoryBudget::Priority priority = MemoryBudget::Priority::Display);
+    // Peak bytes of decoding the probed file at the given size and building its pyramid
+    static qint64 estimateFrameBytes(const FileDetector::ImageProbe &probe, const QSize &size);
+    // Embedded preview of the file (RAW/TIFF JPEG, EXIF thumbnail, JPEG XL preview frame), falling back to
+    // an already cached thumbnail. Null when neither exists. Never decodes the full image, RAW files
+    // without an embedded preview get a half size decode.
+    static PreviewFrame decodePreview(const QString &localPath, int maxEdge);
+
+    // Transfer function of the texture levels of the probed file
+    static ImagePyramid::TransferFunction textureTransfer(const FileDetector::ImageProbe &probe);
+
+    // Converts "file://" URLs to local paths, leaves plain paths untouched
+    static QString toLocalPath(const QString &imagePath);
+};
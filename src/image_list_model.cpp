@@ -0,0 +1,110 @@
+#include "image_list_model.h"
+
+#include <QUrl>
+
+#include <algorithm>
+
+ImageListModel::ImageListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int ImageListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : count();
+}
+
+QVariant ImageListModel::data(const QModelIndex &index, int role) const
+{
+    if (!checkIndex(index, CheckIndexOption::IndexIsValid | CheckIndexOption::ParentIsInvalid)) {
+        return {};
+    }
+
+    switch (role) {
+        case Qt::DisplayRole:
+        case FileNameRole:
+            return m_fileNames[index.row()];
+        case UrlRole:
+            return url(index.row());
+        case ThumbnailUrlRole:
+            return QStringLiteral("image://thumbnail/") + QString::fromLatin1(QUrl::toPercentEncoding(url(index.row())));
+    }
+    return {};
+}
+
+QHash<int, QByteArray> ImageListModel::roleNames() const
+{
+    return {
+        {FileNameRole, "fileName"},
+        {UrlRole, "url"},
+        {ThumbnailUrlRole, "thumbnailUrl"},
+    };
+}
+
+QString ImageListModel::url(int row) const
+{
+    return QUrl::fromLocalFile(localPath(row)).toString();
+}
+
+void ImageListModel::reset(const QDir &directory, const QStringList &sortedFileNames)
+{
+    beginResetModel();
+    m_directory = directory;
+    m_fileNames = sortedFileNames;
+    endResetModel();
+}
+
+qsizetype ImageListModel::insertSorted(const QStringList &sortedFileNames)
+{
+    qsizetype inserted = 0;
+    qsizetype next = 0;
+    while (next < sortedFileNames.size()) {
+        // Collect the run of new names that all go to the same row
+        const int row = lowerBound(sortedFileNames[next]);
+        QStringList run;
+        while (next < sortedFileNames.size() && lowerBound(sortedFileNames[next]) == row) {
+            const QString &fileName = sortedFileNames[next++];
+            if ((row >= count() || m_fileNames[row] != fileName) && (run.isEmpty() || run.constLast() != fileName)) {
+                run.append(fileName);
+            }
+        }
+        if (run.isEmpty()) {
+            continue;
+        }
+
+        beginInsertRows({}, row, row + static_cast<int>(run.size()) - 1);
+        if (run.size() == 1) {
+            m_fileNames.insert(row, run.constFirst());
+        } else {
+            m_fileNames = m_fileNames.first(row) + run + m_fileNames.sliced(row);
+        }
+        endInsertRows();
+        inserted += run.size();
+    }
+    return inserted;
+}
+
+int ImageListModel::remove(const QString &fileName)
+{
+    const int row = indexOf(fileName);
+    if (row < 0) {
+        return -1;
+    }
+    beginRemoveRows({}, row, row);
+    m_fileNames.removeAt(row);
+    endRemoveRows();
+    return row;
+}
+
+int ImageListModel::indexOf(const QString &fileName) const
+{
+    const int row = lowerBound(fileName);
+    return row < count() && m_fileNames[row] == fileName ? row : -1;
+}
+
+int ImageListModel::lowerBound(const QString &fileName) const
+{
+    return static_cast<int>(std::lower_bound(m_fileNames.cbegin(), m_fileNames.cend(), fileName) - m_fileNames.cbegin());
+}
+
+#include "moc_image_list_model.cpp"
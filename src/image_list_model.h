@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QDir>
+#include <QString>
+#include <QStringList>
+
+// Supported images of one directory, sorted by file name. Owned by ImageNavigator, which keeps it
+// up to date while the directory is scanned and watched; exposed to QML for the filmstrip.
+class ImageListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    enum Roles {
+        FileNameRole = Qt::UserRole + 1,
+        UrlRole,
+        ThumbnailUrlRole,
+    };
+
+    explicit ImageListModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = {}) const override;
+    QVariant data(const QModelIndex &index, int role) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    void reset(const QDir &directory, const QStringList &sortedFileNames);
+    // Inserts names that are not listed yet, in runs where they are adjacent. Returns the number inserted.
+    qsizetype insertSorted(const QStringList &sortedFileNames);
+    // Returns the row the name had, or -1
+    int remove(const QString &fileName);
+
+    // Binary search, -1 when not listed
+    int indexOf(const QString &fileName) const;
+    // Row at which the name is or would be inserted
+    int lowerBound(const QString &fileName) const;
+
+    int count() const { return static_cast<int>(m_fileNames.size()); }
+    bool isEmpty() const { return m_fileNames.isEmpty(); }
+    const QStringList &fileNames() const { return m_fileNames; }
+    QString fileName(int row) const { return m_fileNames.value(row); }
+    QString localPath(int row) const { return m_directory.absoluteFilePath(m_fileNames.value(row)); }
+    QString url(int row) const;
+    const QDir &directory() const { return m_directory; }
+
+private:
+    QDir m_directory;
+    QStringList m_fileNames;
+};
@@ -0,0 +1,71 @@
+#include "image_prefetcher.h"
+#include "decoded_image_cache.h"
+#include "image_decoder.h"
+
+#include <QDebug>
+#include <QGuiApplication>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QScreen>
+#include <QThread>
+
+ImagePrefetcher::ImagePrefetcher(QObject *parent)
+    : QObject(parent)
+    , m_wanted(std::make_shared<WantedSet>())
+{
+    // One low priority worker: prefetching must never compete with the image on screen
+    m_pool.setMaxThreadCount(1);
+    m_pool.setThreadPriority(QThread::LowPriority);
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void ImagePrefetcher::prefetch(const QStringList &localPaths)
+{
+    {
+        QMutexLocker locker(&m_wanted->mutex);
+        m_wanted->paths = QSet<QString>(localPaths.cbegin(), localPaths.cend());
+    }
+
+    // Drop queued work from the previous position, running decodes finish on their own
+    m_pool.clear();
+
+    // Neighbours are decoded to fit the screen, zooming in refines them to full resolution
+    QSize screenSize;
+    if (const QScreen *screen = QGuiApplication::primaryScreen()) {
+        screenSize = (QSizeF(screen->size()) * screen->devicePixelRatio()).toSize();
+    }
+
+    auto &cache = DecodedImageCache::instance();
+    int priority = localPaths.size();
+    for (const QString &localPath : localPaths) {
+        if (cache.contains(localPath)) {
+            --priority;
+            continue;
+        }
+
+        m_pool.start([localPath, screenSize, wanted = m_wanted]() {
+            {
+                QMutexLocker locker(&wanted->mutex);
+                if (!wanted->paths.contains(localPath)) {
+                    return;
+                }
+            }
+
+            auto &cache = DecodedImageCache::instance();
+            if (cache.contains(localPath) || !cache.beginDecode(localPath)) {
+                return;
+            }
+
+            qDebug() << "Prefetching" << localPath;
+            // Never displaces the image on screen, skipped when it does not fit into the budget
+            cache.endDecode(localPath, ImageDecoder::decodeFrame(localPath, screenSize, nullptr, MemoryBudget::Priority::Prefetch));
+        }, priority--);
+    }
+}
+
+#include "moc_image_prefetcher.cpp"
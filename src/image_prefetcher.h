@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+
+#include <memory>
+
+// Decodes neighbor images in the background into the DecodedImageCache
+class ImagePrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImagePrefetcher(QObject *parent = nullptr);
+    ~ImagePrefetcher() override;
+
+    // Replaces the set of wanted images. Paths are in priority order, queued
+    // decodes that are no longer wanted are skipped.
+    void prefetch(const QStringList &localPaths);
+
+private:
+    struct WantedSet {
+        QMutex mutex;
+        QSet<QString> paths;
+    };
+
+    QThreadPool m_pool;
+    std::shared_ptr<WantedSet> m_wanted;
+};
@@ -0,0 +1,190 @@
+#include "image_provider.h"
+#include "decoded_image_cache.h"
+#include "image_decoder.h"
+#include "trace.h"
+
+#include <QDebug>
+#include <QQuickTextureFactory>
+#include <QThread>
+#include <QUrl>
+
+#include <algorithm>
+
+namespace {
+    // Large images are decoded by plugins that are mostly single threaded, a few
+    // workers are enough to keep the latest request going while stale ones drain.
+    constexpr int MAX_DECODE_THREADS = 4;
+}
+
+DecodeTask::DecodeTask(const QString &localPath,
+                       const QSize &requestedSize,
+                       quint64 generation,
+                       std::shared_ptr<const std::atomic<quint64>> latestGeneration,
+                       std::shared_ptr<std::atomic_bool> cancelled)
+    : m_localPath(localPath)
+    , m_requestedSize(requestedSize)
+    , m_generation(generation)
+    , m_latestGeneration(std::move(latestGeneration))
+    , m_cancelled(std::move(cancelled))
+{
+    setAutoDelete(true);
+}
+
+bool DecodeTask::isObsolete() const
+{
+    return m_cancelled->load() || m_generation < m_latestGeneration->load();
+}
+
+void DecodeTask::run()
+{
+    if (isObsolete()) {
+        Q_EMIT done({}, QStringLiteral("Decode request was superseded"));
+        return;
+    }
+
+    TraceSpan span("decode", "DecodeTask::run");
+    span.setDetail(m_localPath);
+
+    QString errorString;
+    DecodedFrame frame;
+
+    auto &cache = DecodedImageCache::instance();
+    if (cache.beginDecode(m_localPath)) {
+        frame = ImageDecoder::decodeFrame(m_localPath, m_requestedSize, &errorString);
+        cache.endDecode(m_localPath, frame);
+    } else {
+        // A prefetch of this file is already running, take over its result unless it is too small
+        frame = cache.waitForDecode(m_localPath);
+        if (!frame.satisfies(m_requestedSize)) {
+            frame = ImageDecoder::decodeFrame(m_localPath, m_requestedSize, &errorString);
+            cache.insert(m_localPath, frame);
+        }
+    }
+
+    if (isObsolete()) {
+        // Drop the pixels right here instead of handing them to the GUI thread
+        Q_EMIT done({}, QStringLiteral("Decode request was superseded"));
+        return;
+    }
+
+    Q_EMIT done(frame, errorString);
+}
+
+ImageResponse::ImageResponse(DecodeTask *task, std::shared_ptr<std::atomic_bool> cancelled)
+    : m_cancelled(std::move(cancelled))
+{
+    connect(task, &DecodeTask::done, this, &ImageResponse::handleDone, Qt::QueuedConnection);
+}
+
+ImageResponse::ImageResponse(const DecodedFrame &cachedFrame)
+    : m_cancelled(std::make_shared<std::atomic_bool>(false))
+{
+    // finished() must not be emitted before the engine had a chance to connect to it
+    QMetaObject::invokeMethod(this, [this, cachedFrame]() {
+        handleDone(cachedFrame, {});
+    }, Qt::QueuedConnection);
+}
+
+QQuickTextureFactory *ImageResponse::textureFactory() const
+{
+    return QQuickTextureFactory::textureFactoryForImage(m_frame.image());
+}
+
+QString ImageResponse::errorString() const
+{
+    return m_errorString;
+}
+
+void ImageResponse::cancel()
+{
+    m_cancelled->store(true);
+}
+
+void ImageResponse::handleDone(const DecodedFrame &frame, const QString &errorString)
+{
+    m_frame = frame;
+    m_errorString = frame.isNull() && errorString.isEmpty()
+        ? QStringLiteral("Failed to decode image")
+        : errorString;
+    Q_EMIT finished();
+}
+
+ImageProvider::ImageProvider()
+{
+    m_pool.setMaxThreadCount(std::clamp(QThread::idealThreadCount() / 2, 1, MAX_DECODE_THREADS));
+}
+
+ImageProvider::~ImageProvider()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QQuickImageResponse *ImageProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    const auto [consumerId, localPath] = parseId(id);
+    auto latest = latestGeneration(consumerId);
+    const quint64 generation = latest->fetch_add(1) + 1;
+
+    // Frames of at least the requested resolution are shared, whoever decoded them
+    const DecodedFrame cachedFrame = DecodedImageCache::instance().find(localPath, requestedSize);
+    if (!cachedFrame.isNull()) {
+        return new ImageResponse(cachedFrame);
+    }
+
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    auto task = new DecodeTask(localPath, requestedSize, generation, std::move(latest), cancelled);
+    auto response = new ImageResponse(task, std::move(cancelled));
+    m_pool.start(task);
+
+    return response;
+}
+
+quint64 ImageProvider::createConsumerId()
+{
+    // 0 is the shared generation of requests without a consumer
+    static std::atomic<quint64> nextId = 1;
+    return nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+QString ImageProvider::idForSource(const QUrl &source, quint64 consumerId)
+{
+    const QString encoded = QString::fromUtf8(QUrl::toPercentEncoding(source.toString()));
+    return consumerId == 0 ? encoded : QString::number(consumerId) + u'/' + encoded;
+}
+
+QString ImageProvider::localPathFromId(const QString &id)
+{
+    return parseId(id).localPath;
+}
+
+ImageProvider::ParsedId ImageProvider::parseId(const QString &id)
+{
+    // The file URL is percent encoded, so the first slash can only separate the consumer
+    ParsedId parsed;
+    QStringView encoded(id);
+    const qsizetype slash = id.indexOf(u'/');
+    if (slash > 0) {
+        bool ok = false;
+        const quint64 consumerId = encoded.first(slash).toULongLong(&ok);
+        if (ok) {
+            parsed.consumerId = consumerId;
+            encoded = encoded.sliced(slash + 1);
+        }
+    }
+    // QML passes the file URL through encodeURIComponent() so that it survives as a single path segment
+    parsed.localPath = ImageDecoder::toLocalPath(QUrl::fromPercentEncoding(encoded.toUtf8()));
+    return parsed;
+}
+
+std::shared_ptr<std::atomic<quint64>> ImageProvider::latestGeneration(quint64 consumerId)
+{
+    QMutexLocker locker(&m_generationsMutex);
+    auto &latest = m_latestGenerations[consumerId];
+    if (!latest) {
+        latest = std::make_shared<std::atomic<quint64>>(0);
+    }
+    return latest;
+}
+
+#include "moc_image_provider.cpp"
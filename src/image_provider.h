@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QImage>
+#include <QObject>
+#include <QQuickAsyncImageProvider>
+#include <QQuickImageResponse>
+#include <QRunnable>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QUrl>
+
+#include <QMutex>
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+#include "image_decoder.h"
+
+// Decodes a single image on a pool thread and reports the result back to its ImageResponse
+class DecodeTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    DecodeTask(const QString &localPath,
+               const QSize &requestedSize,
+               quint64 generation,
+               std::shared_ptr<const std::atomic<quint64>> latestGeneration,
+               std::shared_ptr<std::atomic_bool> cancelled);
+
+    void run() override;
+
+Q_SIGNALS:
+    void done(const DecodedFrame &frame, const QString &errorString);
+
+private:
+    bool isObsolete() const;
+
+    QString m_localPath;
+    QSize m_requestedSize;
+    quint64 m_generation;
+    std::shared_ptr<const std::atomic<quint64>> m_latestGeneration;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+};
+
+class ImageResponse : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    explicit ImageResponse(DecodeTask *task, std::shared_ptr<std::atomic_bool> cancelled);
+    // Response for a frame that is already decoded, finishes on the next event loop iteration
+    explicit ImageResponse(const DecodedFrame &cachedFrame);
+
+    QQuickTextureFactory *textureFactory() const override;
+    QString errorString() const override;
+    void cancel() override;
+
+    // Full frame including pyramid levels, for items that render tiles themselves
+    const DecodedFrame &frame() const { return m_frame; }
+
+private:
+    void handleDone(const DecodedFrame &frame, const QString &errorString);
+
+    DecodedFrame m_frame;
+    QString m_errorString;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+};
+
+// Serves "image://hdr/[<consumer>/]<percent-encoded file URL>" off the GUI thread.
+// Only the most recent request of each consumer is decoded; its older ones that did not start yet
+// are dropped. Requests without a consumer share one generation. Full resolution requests are
+// answered from the DecodedImageCache when possible.
+class ImageProvider : public QQuickAsyncImageProvider
+{
+public:
+    ImageProvider();
+    ~ImageProvider() override;
+
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+    // Unique per call, e.g. one per TiledImage, so that two items do not supersede each other
+    static quint64 createConsumerId();
+    static QString idForSource(const QUrl &source, quint64 consumerId = 0);
+    static QString localPathFromId(const QString &id);
+
+private:
+    struct ParsedId {
+        quint64 consumerId = 0;
+        QString localPath;
+    };
+    static ParsedId parseId(const QString &id);
+    std::shared_ptr<std::atomic<quint64>> latestGeneration(quint64 consumerId);
+
+    QThreadPool m_pool;
+    // Consumers are long lived items, their counters are kept for the lifetime of the provider
+    QMutex m_generationsMutex;
+    std::unordered_map<quint64, std::shared_ptr<std::atomic<quint64>>> m_latestGenerations;
+};
@@ -0,0 +1,346 @@
+#include "image_pyramid.h"
+#include "trace.h"
+
+#include <QFloat16>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+    using TransferFunction = ImagePyramid::TransferFunction;
+
+    // Linear -> code value lookup is indexed by the float bit pattern: the exponent plus the top
+    // mantissa bits. This keeps a constant relative precision down to 2^-32, which matters for
+    // the very steep dark end of PQ.
+    constexpr int ENCODE_MANTISSA_BITS = 10;
+    constexpr int ENCODE_EXPONENT_RANGE = 32;
+    constexpr int ENCODE_TABLE_SIZE = ENCODE_EXPONENT_RANGE << ENCODE_MANTISSA_BITS;
+
+    // Output rows per parallel work item
+    constexpr int ROWS_PER_BAND = 32;
+
+    double toLinear(double value, TransferFunction transfer)
+    {
+        if (transfer == TransferFunction::PQ) {
+            // SMPTE ST 2084, 1.0 = 10000 nits
+            constexpr double m1 = 2610.0 / 16384.0;
+            constexpr double m2 = 2523.0 / 4096.0 * 128.0;
+            constexpr double c1 = 3424.0 / 4096.0;
+            constexpr double c2 = 2413.0 / 4096.0 * 32.0;
+            constexpr double c3 = 2392.0 / 4096.0 * 32.0;
+            const double p = std::pow(value, 1.0 / m2);
+            return std::pow(std::max(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+        }
+        return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+    }
+
+    double fromLinear(double linear, TransferFunction transfer)
+    {
+        if (transfer == TransferFunction::PQ) {
+            constexpr double m1 = 2610.0 / 16384.0;
+            constexpr double m2 = 2523.0 / 4096.0 * 128.0;
+            constexpr double c1 = 3424.0 / 4096.0;
+            constexpr double c2 = 2413.0 / 4096.0 * 32.0;
+            constexpr double c3 = 2392.0 / 4096.0 * 32.0;
+            const double p = std::pow(linear, m1);
+            return std::pow((c1 + c2 * p) / (1.0 + c3 * p), m2);
+        }
+        return linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+    }
+
+    struct TransferTables {
+        std::array<float, 256> decode8;
+        std::vector<float> decode16;
+        // Indexed by the bit pattern of a half float code value
+        std::vector<float> decodeHalf;
+        std::vector<quint16> encode;
+    };
+
+    TransferTables makeTables(TransferFunction transfer)
+    {
+        TransferTables tables;
+        for (int i = 0; i < 256; ++i) {
+            tables.decode8[i] = static_cast<float>(toLinear(i / 255.0, transfer));
+        }
+        tables.decode16.resize(65536);
+        tables.decodeHalf.resize(65536);
+        for (int i = 0; i < 65536; ++i) {
+            tables.decode16[i] = static_cast<float>(toLinear(i / 65535.0, transfer));
+            // Code values outside [0, 1] (and NaN) are clamped like the 16 bit integer ones
+            const float code = std::bit_cast<qfloat16>(static_cast<quint16>(i));
+            tables.decodeHalf[i] = static_cast<float>(toLinear(code > 0.0f ? std::min(code, 1.0f) : 0.0f, transfer));
+        }
+        tables.encode.resize(ENCODE_TABLE_SIZE);
+        for (int i = 0; i < ENCODE_TABLE_SIZE; ++i) {
+            // Center of the bucket
+            const int exponent = (i >> ENCODE_MANTISSA_BITS) - ENCODE_EXPONENT_RANGE;
+            const double mantissa = 1.0 + ((i & ((1 << ENCODE_MANTISSA_BITS) - 1)) + 0.5) / (1 << ENCODE_MANTISSA_BITS);
+            const double code = fromLinear(std::ldexp(mantissa, exponent), transfer);
+            tables.encode[i] = static_cast<quint16>(std::clamp(std::lround(code * 65535.0), 0L, 65535L));
+        }
+        return tables;
+    }
+
+    const TransferTables &tablesFor(TransferFunction transfer)
+    {
+        if (transfer == TransferFunction::PQ) {
+            static const TransferTables pq = makeTables(TransferFunction::PQ);
+            return pq;
+        }
+        static const TransferTables srgb = makeTables(TransferFunction::SRGB);
+        return srgb;
+    }
+
+    inline quint16 encode16(float linear, const quint16 *table)
+    {
+        if (!(linear > 0.0f)) {
+            return 0;
+        }
+        if (linear >= 1.0f) {
+            return 65535;
+        }
+        const quint32 bits = std::bit_cast<quint32>(linear);
+        const int exponent = static_cast<int>(bits >> 23) - (127 - ENCODE_EXPONENT_RANGE);
+        if (exponent < 0) {
+            return 0;
+        }
+        return table[(exponent << ENCODE_MANTISSA_BITS) | ((bits >> (23 - ENCODE_MANTISSA_BITS)) & ((1 << ENCODE_MANTISSA_BITS) - 1))];
+    }
+
+    // Averages 2x2 blocks of RGBA float pixels from two source rows into one destination row
+    void averageQuads(const float *top, const float *bottom, float *out, int srcWidth, int dstWidth)
+    {
+        int x = 0;
+        const int pairs = std::min(dstWidth, srcWidth / 2);
+#if defined(__SSE2__)
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        for (; x < pairs; ++x) {
+            const float *t = top + 8 * x;
+            const float *b = bottom + 8 * x;
+            const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(t), _mm_loadu_ps(t + 4)),
+                                          _mm_add_ps(_mm_loadu_ps(b), _mm_loadu_ps(b + 4)));
+            _mm_storeu_ps(out + 4 * x, _mm_mul_ps(sum, quarter));
+        }
+#elif defined(__ARM_NEON)
+        for (; x < pairs; ++x) {
+            const float *t = top + 8 * x;
+            const float *b = bottom + 8 * x;
+            const float32x4_t sum = vaddq_f32(vaddq_f32(vld1q_f32(t), vld1q_f32(t + 4)),
+                                              vaddq_f32(vld1q_f32(b), vld1q_f32(b + 4)));
+            vst1q_f32(out + 4 * x, vmulq_n_f32(sum, 0.25f));
+        }
+#endif
+        for (; x < dstWidth; ++x) {
+            const int x0 = std::min(2 * x, srcWidth - 1);
+            const int x1 = std::min(2 * x + 1, srcWidth - 1);
+            for (int c = 0; c < 4; ++c) {
+                out[4 * x + c] = 0.25f * (top[4 * x0 + c] + top[4 * x1 + c] + bottom[4 * x0 + c] + bottom[4 * x1 + c]);
+            }
+        }
+    }
+
+    // Channel is quint8 for 32 bit formats, quint16 for 64 bit integer formats and qfloat16 for the
+    // half float formats. Alpha (or padding) is always the fourth channel. Premultiplied formats are
+    // premultiplied in code values, like the scene graph blends them; the filter works on linear values
+    // premultiplied by alpha, so each pixel is unpremultiplied before decoding and the result premultiplied
+    // again after encoding.
+    template<typename Channel>
+    void downsampleRows(const QImage &src, uchar *dstBits, qsizetype dstBytesPerLine, int dstWidth,
+                        int firstRow, int lastRow, bool premultiplied, const TransferTables &tables)
+    {
+        constexpr bool half = std::is_same_v<Channel, qfloat16>;
+        constexpr bool wide = sizeof(Channel) == 2;
+        constexpr float channelMax = half ? 1.0f : (wide ? 65535.0f : 255.0f);
+        const float *decode = half ? tables.decodeHalf.data() : (wide ? tables.decode16.data() : tables.decode8.data());
+        const quint16 *encode = tables.encode.data();
+
+        // All three channel types index their decode table directly
+        const auto index = [](Channel value) -> quint16 {
+            if constexpr (half) {
+                return std::bit_cast<quint16>(value);
+            } else {
+                return value;
+            }
+        };
+        const auto alphaOf = [&](Channel value) -> float {
+            if constexpr (half) {
+                return std::clamp(static_cast<float>(value), 0.0f, 1.0f);
+            } else {
+                // Exact for the common opaque case
+                return value == static_cast<Channel>(channelMax) ? 1.0f : static_cast<float>(value) * (1.0f / channelMax);
+            }
+        };
+        const auto unpremultiply = [&](Channel value, float alpha) -> Channel {
+            if constexpr (half) {
+                return qfloat16(static_cast<float>(value) / alpha);
+            } else {
+                return static_cast<Channel>(std::min(static_cast<float>(value) / alpha + 0.5f, channelMax));
+            }
+        };
+
+        const int srcWidth = src.width();
+        const int srcHeight = src.height();
+
+        std::vector<float> top(4 * srcWidth);
+        std::vector<float> bottom(4 * srcWidth);
+        std::vector<float> out(4 * dstWidth);
+
+        // Linear, premultiplied by alpha
+        auto decodeRow = [&](int y, float *row) {
+            auto pixel = reinterpret_cast<const Channel *>(src.constScanLine(y));
+            for (int x = 0; x < srcWidth; ++x, pixel += 4, row += 4) {
+                const float alpha = alphaOf(pixel[3]);
+                row[3] = alpha;
+                if (alpha == 1.0f) {
+                    row[0] = decode[index(pixel[0])];
+                    row[1] = decode[index(pixel[1])];
+                    row[2] = decode[index(pixel[2])];
+                } else if (alpha > 0.0f) {
+                    for (int c = 0; c < 3; ++c) {
+                        row[c] = decode[index(premultiplied ? unpremultiply(pixel[c], alpha) : pixel[c])] * alpha;
+                    }
+                } else {
+                    row[0] = row[1] = row[2] = 0.0f;
+                }
+            }
+        };
+
+        for (int y = firstRow; y < lastRow; ++y) {
+            decodeRow(std::min(2 * y, srcHeight - 1), top.data());
+            decodeRow(std::min(2 * y + 1, srcHeight - 1), bottom.data());
+            averageQuads(top.data(), bottom.data(), out.data(), srcWidth, dstWidth);
+
+            auto pixel = reinterpret_cast<Channel *>(dstBits + y * dstBytesPerLine);
+            const float *value = out.data();
+            for (int x = 0; x < dstWidth; ++x, pixel += 4, value += 4) {
+                const float alpha = value[3];
+                // Back to straight alpha for the transfer function, then code values premultiplied again
+                const float toStraight = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+                const float codeScale = premultiplied ? alpha : 1.0f;
+                for (int c = 0; c < 3; ++c) {
+                    const quint16 code = encode16(value[c] * toStraight, encode);
+                    if constexpr (half) {
+                        pixel[c] = qfloat16(code * (codeScale / 65535.0f));
+                    } else if constexpr (wide) {
+                        pixel[c] = static_cast<Channel>(code * codeScale + 0.5f);
+                    } else {
+                        pixel[c] = static_cast<Channel>(code * (codeScale / 257.0f) + 0.5f);
+                    }
+                }
+                if constexpr (half) {
+                    pixel[3] = qfloat16(alpha);
+                } else {
+                    pixel[3] = static_cast<Channel>(alpha * channelMax + 0.5f);
+                }
+            }
+        }
+    }
+
+    bool isHalfFloat(QImage::Format format)
+    {
+        return format == QImage::Format_RGBA16FPx4 || format == QImage::Format_RGBA16FPx4_Premultiplied ||
+               format == QImage::Format_RGBX16FPx4;
+    }
+}
+
+QList<QImage> ImagePyramid::build(QImage image, TransferFunction transfer)
+{
+    if (image.isNull()) {
+        return {};
+    }
+
+    TraceSpan span("decode", "ImagePyramid::build");
+    convertToTextureFormat(image, transfer);
+    QList<QImage> levels = {image};
+    while (std::max(levels.last().width(), levels.last().height()) > COARSEST_LEVEL_SIZE) {
+        levels.append(downsample(levels.last(), transfer));
+    }
+    return levels;
+}
+
+QImage ImagePyramid::downsample(const QImage &image, TransferFunction transfer)
+{
+    const QImage src = normalizedFormat(image);
+    QImage dst(std::max(1, src.width() / 2), std::max(1, src.height() / 2), src.format());
+    if (dst.isNull()) {
+        return {};
+    }
+    dst.setColorSpace(src.colorSpace());
+
+    const TransferTables &tables = tablesFor(transfer);
+    const bool half = isHalfFloat(src.format());
+    const bool wide = src.depth() == 64;
+    const bool premultiplied = src.pixelFormat().premultiplied() == QPixelFormat::Premultiplied;
+    // Detach once here, QImage::scanLine() is not safe to call from several threads
+    uchar *dstBits = dst.bits();
+    const qsizetype dstBytesPerLine = dst.bytesPerLine();
+
+    std::vector<std::pair<int, int>> bands;
+    for (int row = 0; row < dst.height(); row += ROWS_PER_BAND) {
+        bands.emplace_back(row, std::min(row + ROWS_PER_BAND, dst.height()));
+    }
+
+    QtConcurrent::blockingMap(bands, [&](const std::pair<int, int> &band) {
+        if (half) {
+            downsampleRows<qfloat16>(src, dstBits, dstBytesPerLine, dst.width(), band.first, band.second, premultiplied, tables);
+        } else if (wide) {
+            downsampleRows<quint16>(src, dstBits, dstBytesPerLine, dst.width(), band.first, band.second, premultiplied, tables);
+        } else {
+            downsampleRows<quint8>(src, dstBits, dstBytesPerLine, dst.width(), band.first, band.second, premultiplied, tables);
+        }
+    });
+
+    return dst;
+}
+
+QImage ImagePyramid::normalizedFormat(const QImage &image)
+{
+    // Formats with four channels of equal size and alpha (or padding) in the last one
+    switch (image.format()) {
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+    case QImage::Format_RGBA64_Premultiplied:
+    case QImage::Format_RGBX16FPx4:
+    case QImage::Format_RGBA16FPx4:
+    case QImage::Format_RGBA16FPx4_Premultiplied:
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+    case QImage::Format_RGBA8888_Premultiplied:
+        return image;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_ARGB32_Premultiplied:
+        return image;
+#endif
+    default:
+        break;
+    }
+
+    return image.convertToFormat(image.depth() > 32 ? QImage::Format_RGBA64 : QImage::Format_RGBA8888);
+}
+
+QImage::Format ImagePyramid::textureFormat(TransferFunction transfer)
+{
+    return transfer == TransferFunction::PQ ? QImage::Format_RGBA16FPx4_Premultiplied : QImage::Format_RGBA8888_Premultiplied;
+}
+
+void ImagePyramid::convertToTextureFormat(QImage &image, TransferFunction transfer)
+{
+    const QImage::Format format = textureFormat(transfer);
+    if (image.format() != format) {
+        image.convertTo(format);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+
+class ImagePyramid
+{
+public:
+    enum class TransferFunction {
+        SRGB,
+        PQ
+    };
+
+    // Largest dimension of the coarsest level
+    static constexpr int COARSEST_LEVEL_SIZE = 1024;
+
+    // Level 0 is the input converted to textureFormat(), every further level halves both dimensions.
+    // Filtering is done in linear light of the given transfer function.
+    static QList<QImage> build(QImage image, TransferFunction transfer);
+
+    // Format the levels are kept in, chosen so that the scene graph uploads it without converting:
+    // RGBA16F textures for PQ, where 8 bit would band, RGBA8 for SDR. Both premultiplied.
+    static QImage::Format textureFormat(TransferFunction transfer);
+    // Converts in place where Qt can (same depth), so that no second full size buffer is allocated
+    static void convertToTextureFormat(QImage &image, TransferFunction transfer);
+
+    // 2x2 box filter in linear light, rows are processed in parallel
+    static QImage downsample(const QImage &image, TransferFunction transfer);
+
+private:
+    static QImage normalizedFormat(const QImage &image);
+};
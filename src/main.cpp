@@ -6,6 +6,7 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QIcon>
+#include <QImageReader>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
 #include <QQuickStyle>
@@ -13,11 +14,22 @@
 
 #include "app.h"
 #include "file_detector.h"
+#include "image_provider.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "probe_command.h"
+#include "thumbnail_provider.h"
+#include "trace.h"
 #include "version-hdr-image-viewer.h"
 #include <KAboutData>
 #include <KLocalizedContext>
 #include <KLocalizedString>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
 using namespace Qt::Literals::StringLiterals;
 
 namespace {
@@ -27,6 +39,25 @@ namespace {
     constexpr int UNSUPPORTED_FORMAT = 3;
     constexpr int ENGINE_FAILED = 4;
     
+    // Decoded images are limited by the MemoryBudget, a single image may use all of it
+    bool setupMemoryBudget(const QString &limitMiB) {
+        auto &budget = MemoryBudget::instance();
+        if (!limitMiB.isEmpty()) {
+            bool ok = false;
+            const qint64 mib = limitMiB.toLongLong(&ok);
+            if (!ok || mib <= 0) {
+                qCritical() << "Error: Invalid memory limit:" << limitMiB;
+                return false;
+            }
+            budget.setLimit(mib * 1024 * 1024);
+        }
+
+        const qint64 limitMiBValue = budget.limit() / (1024 * 1024);
+        QImageReader::setAllocationLimit(static_cast<int>(std::min<qint64>(limitMiBValue, std::numeric_limits<int>::max())));
+        qDebug() << "Memory budget for decoded images:" << limitMiBValue << "MiB";
+        return true;
+    }
+
     QString processImagePath(const QString &filePath) {
         QFileInfo fileInfo(filePath);
         
@@ -42,10 +73,7 @@ namespace {
         }
     }
     
-    void setupApplication() {
-        // Optimize for large HDR images (8GB allocation limit)
-        qputenv("QT_IMAGEIO_MAXALLOC", "8192");
-
+    void setupPluginPaths() {
         // Prefer app-bundled Qt/KDE plugins (e.g. imageformats) over system plugins.
         // This is the key mechanism to override the system kimg_raw.so (and its linked libraw)
         // with a plugin shipped next to the application.
@@ -70,6 +98,10 @@ namespace {
         if (!newLibraryPaths.isEmpty()) {
             QCoreApplication::setLibraryPaths(newLibraryPaths);
         }
+    }
+
+    void setupApplication() {
+        setupPluginPaths();
 
         // Use KDE desktop style unless overridden
         if (qEnvironmentVariableIsEmpty("QT_QUICK_CONTROLS_STYLE")) {
@@ -96,10 +128,71 @@ namespace {
         KAboutData::setApplicationData(aboutData);
         QGuiApplication::setWindowIcon(QIcon(u":/icons/app-icon.svg"_s));
     }
+
+    // Checked before any application object exists: probing must not need a display
+    bool isProbeMode(int argc, char *argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--probe") == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Headless --probe mode: no QML, no Wayland, NDJSON on stdout and the summary on stderr
+    int runProbe(int argc, char *argv[]) {
+        QCoreApplication app(argc, argv);
+        setupPluginPaths();
+        QCoreApplication::setOrganizationName(u"KDE"_s);
+        QCoreApplication::setApplicationName(u"hdr-image-viewer"_s);
+
+        QCommandLineParser parser;
+        parser.setApplicationDescription(u"Probes image files and prints one JSON object per file"_s);
+        parser.addHelpOption();
+        QCommandLineOption probeOption(u"probe"_s, u"Probe the given files and directories (recursively)"_s);
+        parser.addOption(probeOption);
+        QCommandLineOption threadsOption(u"threads"_s, u"Probe threads (default: one per core)"_s, u"count"_s);
+        parser.addOption(threadsOption);
+        QCommandLineOption traceOption(u"trace"_s, u"Write a Chrome trace of the probes to the file"_s, u"file"_s);
+        parser.addOption(traceOption);
+        parser.addPositionalArgument(u"paths"_s, u"Image files and directories"_s, u"<paths...>"_s);
+        parser.process(app);
+
+        int threads = 0;
+        if (parser.isSet(threadsOption)) {
+            bool ok = false;
+            threads = parser.value(threadsOption).toInt(&ok);
+            if (!ok || threads <= 0) {
+                qCritical() << "Error: Invalid thread count:" << parser.value(threadsOption);
+                return INVALID_ARGS;
+            }
+        }
+
+        const QStringList paths = parser.positionalArguments();
+        if (paths.isEmpty()) {
+            qCritical() << "Error: No files or directories to probe.";
+            qCritical() << "Usage:" << QCoreApplication::applicationName() << "--probe <paths...>";
+            return INVALID_ARGS;
+        }
+
+        if (parser.isSet(traceOption)) {
+            Trace::start(parser.value(traceOption));
+        }
+        const ProbeCommand::Summary summary = ProbeCommand::run(paths, threads, stdout);
+        Trace::stop();
+        std::fprintf(stderr, "Probed %lld files (%lld supported, %lld HDR) in %.2f s, %.0f files/s\n",
+                     static_cast<long long>(summary.files), static_cast<long long>(summary.supported),
+                     static_cast<long long>(summary.hdr), summary.elapsedMs / 1000.0, summary.filesPerSecond());
+        return summary.missing > 0 ? FILE_NOT_FOUND : SUCCESS;
+    }
 }
 
 int main(int argc, char *argv[])
 {
+    if (isProbeMode(argc, argv)) {
+        return runProbe(argc, argv);
+    }
+
     QApplication app(argc, argv);
     
     setupApplication();
@@ -112,6 +205,20 @@ int main(int argc, char *argv[])
     QCommandLineOption helpOption({u"h"_s, u"help"_s}, i18n("Display help information"));
     parser.addOption(helpOption);
     parser.addVersionOption();
+    QCommandLineOption memoryLimitOption(u"memory-limit"_s,
+        i18n("Memory for decoded images in MiB (default: half the RAM, at most three quarters of the available memory)"),
+        u"MiB"_s);
+    parser.addOption(memoryLimitOption);
+    // Handled by runProbe(), listed here for --help
+    QCommandLineOption probeOption(u"probe"_s, i18n("Probe the given files and directories without opening a window, printing one JSON object per file"));
+    parser.addOption(probeOption);
+    QCommandLineOption traceOption(u"trace"_s,
+        i18n("Record load latency spans and write them as Chrome trace JSON (Perfetto, chrome://tracing) on exit"),
+        u"file"_s);
+    parser.addOption(traceOption);
+    QCommandLineOption statsOption(u"stats"_s,
+        i18n("Print decode, probe, cache, texture upload and frame timing statistics on exit"));
+    parser.addOption(statsOption);
     
     parser.addPositionalArgument(u"image"_s, i18n("Image file to display"));
     parser.process(app);
@@ -121,6 +228,14 @@ int main(int argc, char *argv[])
         return SUCCESS;
     }
 
+    if (!setupMemoryBudget(parser.value(memoryLimitOption))) {
+        return INVALID_ARGS;
+    }
+
+    if (parser.isSet(traceOption)) {
+        Trace::start(parser.value(traceOption));
+    }
+
     // Validate arguments
     const QStringList args = parser.positionalArguments();
     if (args.isEmpty()) {
@@ -146,6 +261,9 @@ int main(int argc, char *argv[])
     QQmlApplicationEngine engine;
     engine.rootContext()->setContextObject(new KLocalizedContext(&engine));
     engine.rootContext()->setContextProperty(u"imagePath"_s, imagePath);
+    // Decodes images on a worker pool, engine takes ownership
+    engine.addImageProvider(u"hdr"_s, new ImageProvider);
+    engine.addImageProvider(u"thumbnail"_s, new ThumbnailProvider);
 
     engine.loadFromModule("de.aaronrust.hdrimageviewer", u"Main");
 
@@ -154,5 +272,10 @@ int main(int argc, char *argv[])
         return ENGINE_FAILED;
     }
 
-    return app.exec();
+    const int result = app.exec();
+    Trace::stop();
+    if (parser.isSet(statsOption)) {
+        std::fputs(qPrintable(Metrics::instance().report()), stderr);
+    }
+    return result;
 }
@@ -0,0 +1,144 @@
+#include "memory_budget.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <unistd.h>
+
+namespace {
+    // Leaves room for the rest of the system on small machines
+    constexpr qint64 MINIMUM_LIMIT = 1LL * 1024 * 1024 * 1024;
+
+    // MemAvailable from /proc/meminfo, the kernel's estimate of what can be allocated without swapping
+    qint64 availableMemory()
+    {
+        QFile meminfo(QStringLiteral("/proc/meminfo"));
+        if (!meminfo.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            return -1;
+        }
+        while (!meminfo.atEnd()) {
+            const QByteArray line = meminfo.readLine();
+            if (line.startsWith("MemAvailable:")) {
+                // "MemAvailable:   12345678 kB"
+                return line.mid(13).trimmed().split(' ').first().toLongLong() * 1024;
+            }
+        }
+        return -1;
+    }
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    MemoryBudget::instance().release(m_bytes);
+}
+
+void MemoryBudget::Reservation::resize(qint64 bytes)
+{
+    auto &budget = MemoryBudget::instance();
+    QMutexLocker locker(&budget.m_mutex);
+    budget.m_used += bytes - m_bytes;
+    m_bytes = bytes;
+}
+
+MemoryBudget &MemoryBudget::instance()
+{
+    static MemoryBudget budget;
+    return budget;
+}
+
+MemoryBudget::MemoryBudget()
+    : m_limit(defaultLimit())
+{
+}
+
+qint64 MemoryBudget::defaultLimit()
+{
+    const qint64 physical = qint64(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+    qint64 limit = physical > 0 ? physical / 2 : MINIMUM_LIMIT;
+    if (const qint64 available = availableMemory(); available > 0) {
+        limit = std::min(limit, available / 4 * 3);
+    }
+    return std::max(limit, MINIMUM_LIMIT);
+}
+
+qint64 MemoryBudget::limit() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_limit;
+}
+
+void MemoryBudget::setLimit(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_limit = bytes;
+}
+
+qint64 MemoryBudget::used() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_used;
+}
+
+std::shared_ptr<MemoryBudget::Reservation> MemoryBudget::reserve(qint64 bytes, Priority priority)
+{
+    bytes = std::max<qint64>(bytes, 0);
+    while (true) {
+        Evictor evictor;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (tryReserveLocked(bytes)) {
+                return std::shared_ptr<Reservation>(new Reservation(bytes));
+            }
+            evictor = m_evictor;
+        }
+
+        // Evicting releases reservations, which takes the lock again
+        if (!evictor || !evictor(priority)) {
+            qDebug() << "Memory budget exceeded:" << bytes / (1024 * 1024) << "MiB requested,"
+                     << used() / (1024 * 1024) << "of" << limit() / (1024 * 1024) << "MiB in use";
+            return nullptr;
+        }
+    }
+}
+
+qint64 MemoryBudget::makeRoom(qint64 bytes, Priority priority)
+{
+    while (true) {
+        Evictor evictor;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_used + bytes <= m_limit) {
+                return m_limit - m_used;
+            }
+            evictor = m_evictor;
+        }
+
+        if (!evictor || !evictor(priority)) {
+            QMutexLocker locker(&m_mutex);
+            return std::max<qint64>(m_limit - m_used, 0);
+        }
+    }
+}
+
+void MemoryBudget::setEvictor(Evictor evictor)
+{
+    QMutexLocker locker(&m_mutex);
+    m_evictor = std::move(evictor);
+}
+
+bool MemoryBudget::tryReserveLocked(qint64 bytes)
+{
+    if (m_used + bytes > m_limit) {
+        return false;
+    }
+    m_used += bytes;
+    return true;
+}
+
+void MemoryBudget::release(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_used -= bytes;
+}
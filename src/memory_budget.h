@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QMutex>
+#include <QtGlobal>
+
+#include <functional>
+#include <memory>
+
+// Process-wide budget for decoded pixel memory. Every decoded frame (with its pyramid), preview and
+// thumbnail being generated holds a Reservation for its bytes while it is alive, so the budget sees
+// what is actually resident, no matter which cache or item keeps it.
+//
+// When a reservation does not fit, the registered evictor drops cached frames according to the
+// priority of the request; callers then decode at reduced resolution or skip the work instead of
+// running into the OOM killer. All methods are thread safe.
+class MemoryBudget
+{
+public:
+    // Higher priorities may evict more
+    enum class Priority {
+        Thumbnail,
+        Prefetch,
+        Display
+    };
+
+    // Returns its bytes to the budget when destroyed; shared by all copies of a frame
+    class Reservation
+    {
+    public:
+        ~Reservation();
+        Reservation(const Reservation &) = delete;
+        Reservation &operator=(const Reservation &) = delete;
+
+        qint64 bytes() const { return m_bytes; }
+        // Adjusts an estimate to the actual size, without checking the limit
+        void resize(qint64 bytes);
+
+    private:
+        friend class MemoryBudget;
+        explicit Reservation(qint64 bytes) : m_bytes(bytes) {}
+
+        qint64 m_bytes;
+    };
+
+    // Frees one cached item that a request of the given priority may displace, returns false when there is none
+    using Evictor = std::function<bool(Priority priority)>;
+
+    static MemoryBudget &instance();
+
+    // Half the physical memory, and at most three quarters of what is available right now
+    static qint64 defaultLimit();
+
+    qint64 limit() const;
+    void setLimit(qint64 bytes);
+    qint64 used() const;
+
+    // Reserves bytes, evicting as needed. Returns null when they do not fit even after evicting.
+    std::shared_ptr<Reservation> reserve(qint64 bytes, Priority priority);
+    // Evicts until bytes would fit or nothing evictable is left, returns the bytes that are free then
+    qint64 makeRoom(qint64 bytes, Priority priority);
+
+    void setEvictor(Evictor evictor);
+
+private:
+    MemoryBudget();
+
+    bool tryReserveLocked(qint64 bytes);
+    void release(qint64 bytes);
+
+    mutable QMutex m_mutex;
+    qint64 m_limit;
+    qint64 m_used = 0;
+    Evictor m_evictor;
+};
@@ -0,0 +1,145 @@
+#include "metrics.h"
+#include "decoded_image_cache.h"
+#include "memory_budget.h"
+
+#include <QTextStream>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    constexpr double MIB = 1024.0 * 1024.0;
+
+    QVariantMap toVariantMap(const Metrics::Histogram::Summary &summary)
+    {
+        return {
+            {u"count"_s, summary.count},
+            {u"mean"_s, summary.meanMs},
+            {u"p50"_s, summary.p50Ms},
+            {u"p95"_s, summary.p95Ms},
+            {u"p99"_s, summary.p99Ms},
+            {u"max"_s, summary.maxMs},
+        };
+    }
+}
+
+void Metrics::Histogram::record(std::chrono::nanoseconds duration)
+{
+    const quint64 us = static_cast<quint64>(std::max<qint64>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), 0));
+
+    // Octave from the highest set bit, then the quarter within the octave from the next two bits
+    int bucket = 0;
+    if (us > 0) {
+        const int octave = std::bit_width(us) - 1;
+        const int fraction = octave >= 2 ? static_cast<int>((us >> (octave - 2)) & 0x3) : static_cast<int>((us << (2 - octave)) & 0x3);
+        bucket = std::min(octave * BUCKETS_PER_OCTAVE + fraction, BUCKET_COUNT - 1);
+    }
+
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sumUs.fetch_add(us, std::memory_order_relaxed);
+    quint64 max = m_maxUs.load(std::memory_order_relaxed);
+    while (us > max && !m_maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+void Metrics::Histogram::recordMs(double milliseconds)
+{
+    record(std::chrono::nanoseconds(static_cast<qint64>(milliseconds * 1'000'000.0)));
+}
+
+Metrics::Histogram::Summary Metrics::Histogram::summary() const
+{
+    const quint64 count = m_count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return {};
+    }
+    return {
+        .count = count,
+        .meanMs = m_sumUs.load(std::memory_order_relaxed) / 1000.0 / count,
+        .p50Ms = percentileMs(count, 0.50),
+        .p95Ms = percentileMs(count, 0.95),
+        .p99Ms = percentileMs(count, 0.99),
+        .maxMs = m_maxUs.load(std::memory_order_relaxed) / 1000.0,
+    };
+}
+
+double Metrics::Histogram::percentileMs(quint64 count, double fraction) const
+{
+    const quint64 rank = static_cast<quint64>(std::ceil(count * fraction));
+    quint64 seen = 0;
+    for (int bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+        seen += m_buckets[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // Lower bound of the bucket: 2^octave * (1 + quarter / 4)
+            const int octave = bucket / BUCKETS_PER_OCTAVE;
+            const int quarter = bucket % BUCKETS_PER_OCTAVE;
+            return std::ldexp(1.0 + quarter / double(BUCKETS_PER_OCTAVE), octave) / 1000.0;
+        }
+    }
+    return m_maxUs.load(std::memory_order_relaxed) / 1000.0;
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+QVariantMap Metrics::snapshot() const
+{
+    const auto cache = DecodedImageCache::instance().statistics();
+    const quint64 lookups = cache.hits + cache.misses;
+    const auto frames = frameInterval.summary();
+
+    return {
+        {u"decodeTime"_s, toVariantMap(decodeTime.summary())},
+        {u"pyramidTime"_s, toVariantMap(pyramidTime.summary())},
+        {u"probeTime"_s, toVariantMap(probeTime.summary())},
+        {u"probeCacheHits"_s, probeCacheHits.value()},
+        {u"textureUploadTime"_s, toVariantMap(textureUploadTime.summary())},
+        {u"tilesUploaded"_s, tilesUploaded.value()},
+        {u"frameInterval"_s, toVariantMap(frames)},
+        // Spread of the frame pacing, independent of the refresh rate
+        {u"frameJitter"_s, frames.p99Ms - frames.p50Ms},
+        {u"cacheHitRate"_s, lookups > 0 ? double(cache.hits) / lookups : 0.0},
+        {u"cacheImages"_s, cache.imageCount},
+        {u"bytesResident"_s, cache.bytesResident},
+        {u"memoryUsed"_s, MemoryBudget::instance().used()},
+        {u"memoryLimit"_s, cache.memoryLimit},
+    };
+}
+
+QString Metrics::report() const
+{
+    QString text;
+    QTextStream out(&text);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(2);
+
+    const auto line = [&out](const char *name, const Histogram &histogram) {
+        const Histogram::Summary s = histogram.summary();
+        out << qSetFieldWidth(20) << Qt::left << name << qSetFieldWidth(0)
+            << "count " << s.count << "  mean " << s.meanMs << "  p50 " << s.p50Ms << "  p95 " << s.p95Ms
+            << "  p99 " << s.p99Ms << "  max " << s.maxMs << " ms\n";
+    };
+
+    out << "Performance statistics\n";
+    line("Decode", decodeTime);
+    line("Pyramid", pyramidTime);
+    line("Probe", probeTime);
+    line("Texture upload", textureUploadTime);
+    line("Frame interval", frameInterval);
+
+    const QVariantMap values = snapshot();
+    out << "Frame jitter (p99 - p50): " << values[u"frameJitter"_s].toDouble() << " ms\n";
+    out << "Probe cache hits: " << probeCacheHits.value() << ", tiles uploaded: " << tilesUploaded.value() << '\n';
+    out << "Decoded image cache: hit rate " << values[u"cacheHitRate"_s].toDouble() * 100.0 << " %, "
+        << values[u"cacheImages"_s].toInt() << " images, " << values[u"bytesResident"_s].toLongLong() / MIB << " MiB resident\n";
+    out << "Memory budget: " << values[u"memoryUsed"_s].toLongLong() / MIB << " of "
+        << values[u"memoryLimit"_s].toLongLong() / MIB << " MiB\n";
+    return text;
+}
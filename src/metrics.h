@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QString>
+#include <QVariantMap>
+#include <QtGlobal>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+// Process-wide performance counters, always on: recording is a few relaxed atomic operations, so the
+// decode pipeline, the probes and the render thread can update them without locks. Read live by the
+// stats overlay (App.performanceStatistics()) and printed at exit with --stats.
+class Metrics
+{
+public:
+    class Counter
+    {
+    public:
+        void add(qint64 value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+        qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<qint64> m_value = 0;
+    };
+
+    // Durations in logarithmic buckets, four per power of two (at most 19 % apart), from 1 µs to about
+    // 70 minutes. Percentiles are read from the buckets, count, mean and maximum are exact.
+    class Histogram
+    {
+    public:
+        struct Summary {
+            quint64 count = 0;
+            double meanMs = 0.0;
+            double p50Ms = 0.0;
+            double p95Ms = 0.0;
+            double p99Ms = 0.0;
+            double maxMs = 0.0;
+        };
+
+        void record(std::chrono::nanoseconds duration);
+        void recordMs(double milliseconds);
+        Summary summary() const;
+
+    private:
+        static constexpr int BUCKETS_PER_OCTAVE = 4;
+        static constexpr int BUCKET_COUNT = 32 * BUCKETS_PER_OCTAVE;
+
+        double percentileMs(quint64 count, double fraction) const;
+
+        std::array<std::atomic<quint64>, BUCKET_COUNT> m_buckets{};
+        std::atomic<quint64> m_count = 0;
+        std::atomic<quint64> m_sumUs = 0;
+        std::atomic<quint64> m_maxUs = 0;
+    };
+
+    // Records the time from construction to destruction
+    class ScopedTimer
+    {
+    public:
+        explicit ScopedTimer(Histogram &histogram)
+            : m_histogram(histogram)
+            , m_start(std::chrono::steady_clock::now())
+        {
+        }
+        ~ScopedTimer() { m_histogram.record(std::chrono::steady_clock::now() - m_start); }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Histogram &m_histogram;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    static Metrics &instance();
+
+    // Plugin decode, including LibRaw, without the pyramid
+    Histogram decodeTime;
+    // Conversion to the texture format and downsampling
+    Histogram pyramidTime;
+    // Probes that read the file, ProbeCache hits are only counted
+    Histogram probeTime;
+    Counter probeCacheHits;
+    // Tile uploads of one updatePaintNode() call
+    Histogram textureUploadTime;
+    Counter tilesUploaded;
+    // Time between two presented frames while rendering continuously
+    Histogram frameInterval;
+
+    // Cache and memory figures are owned by DecodedImageCache and MemoryBudget and merged in here
+    QVariantMap snapshot() const;
+    QString report() const;
+
+private:
+    Metrics() = default;
+};
@@ -0,0 +1,271 @@
+#include "probe_cache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QLockFile>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace {
+    constexpr char LOG_MAGIC[8] = {'H', 'D', 'R', 'P', 'R', 'O', 'B', 'E'};
+    // Bump when Record or the meaning of its fields changes
+    constexpr quint32 LOG_VERSION = 3;
+    // Compact once the log holds this many more records than live entries
+    constexpr qsizetype COMPACTION_SLACK = 4096;
+    // Oldest entries are dropped on compaction beyond this count
+    constexpr qsizetype MAX_ENTRIES = 200000;
+    constexpr int LOCK_TIMEOUT_MS = 200;
+
+    struct LogHeader {
+        char magic[8];
+        quint32 version;
+        quint32 recordSize;
+    };
+
+    // On-disk record in native byte order, the cache never leaves the machine
+    struct Record {
+        quint64 device;
+        quint64 inode;
+        qint64 size;
+        qint64 mtimeNs;
+        qint32 width;
+        qint32 height;
+        quint16 bitDepth;
+        quint8 format;
+        quint8 transfer;
+        quint8 primaries;
+        quint8 transformations;
+        quint8 flags;
+        quint8 reserved[5];
+        // Detects records torn by a crash or a full disk
+        quint32 checksum;
+    };
+    static_assert(sizeof(Record) == 56);
+
+    constexpr quint8 FLAG_SUPPORTED = 0x01;
+    constexpr quint8 FLAG_HDR = 0x02;
+
+    quint32 recordChecksum(const Record &record)
+    {
+        return qChecksum(QByteArrayView(reinterpret_cast<const char *>(&record), offsetof(Record, checksum)));
+    }
+
+    Record toRecord(const ProbeCache::FileKey &key, const FileDetector::ImageProbe &probe)
+    {
+        Record record{};
+        record.device = key.device;
+        record.inode = key.inode;
+        record.size = key.size;
+        record.mtimeNs = key.mtimeNs;
+        record.width = probe.size.width();
+        record.height = probe.size.height();
+        record.bitDepth = static_cast<quint16>(probe.bitDepth);
+        record.format = static_cast<quint8>(probe.format);
+        record.transfer = static_cast<quint8>(probe.transfer);
+        record.primaries = static_cast<quint8>(probe.primaries);
+        record.transformations = static_cast<quint8>(probe.transformations.toInt());
+        record.flags = (probe.isSupported ? FLAG_SUPPORTED : 0) | (probe.isHDR ? FLAG_HDR : 0);
+        record.checksum = recordChecksum(record);
+        return record;
+    }
+
+    FileDetector::ImageProbe toProbe(const Record &record)
+    {
+        FileDetector::ImageProbe probe;
+        probe.isSupported = record.flags & FLAG_SUPPORTED;
+        probe.isHDR = record.flags & FLAG_HDR;
+        probe.format = static_cast<FileDetector::ImageFormat>(record.format);
+        probe.transfer = static_cast<FileDetector::TransferFunction>(record.transfer);
+        probe.primaries = static_cast<FileDetector::ColorPrimaries>(record.primaries);
+        probe.size = QSize(record.width, record.height);
+        probe.bitDepth = record.bitDepth;
+        probe.transformations = QImageIOHandler::Transformations::fromInt(record.transformations);
+        return probe;
+    }
+}
+
+ProbeCache &ProbeCache::instance()
+{
+    static ProbeCache cache;
+    return cache;
+}
+
+ProbeCache::ProbeCache()
+{
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (!cacheDir.isEmpty() && QDir().mkpath(cacheDir)) {
+        m_path = cacheDir + QStringLiteral("/probes.bin");
+    }
+}
+
+std::optional<ProbeCache::FileKey> ProbeCache::keyForFile(const QString &localPath)
+{
+    struct stat info;
+    if (::stat(QFile::encodeName(localPath).constData(), &info) != 0) {
+        return std::nullopt;
+    }
+    return FileKey{
+        .device = static_cast<quint64>(info.st_dev),
+        .inode = static_cast<quint64>(info.st_ino),
+        .size = static_cast<qint64>(info.st_size),
+        .mtimeNs = static_cast<qint64>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec,
+    };
+}
+
+std::optional<FileDetector::ImageProbe> ProbeCache::find(const FileKey &key)
+{
+    QMutexLocker locker(&m_mutex);
+    loadLocked();
+
+    const auto it = m_entries.constFind({key.device, key.inode});
+    if (it == m_entries.constEnd() || it->key != key) {
+        return std::nullopt;
+    }
+    return it->probe;
+}
+
+void ProbeCache::insert(const FileKey &key, const FileDetector::ImageProbe &probe)
+{
+    QMutexLocker locker(&m_mutex);
+    loadLocked();
+
+    m_entries.insert({key.device, key.inode}, {key, probe});
+    appendLocked(key, probe);
+}
+
+void ProbeCache::loadLocked()
+{
+    if (m_loaded) {
+        return;
+    }
+    m_loaded = true;
+    if (m_path.isEmpty()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // The log is only ever replaced by a rename, so this sees a whole log even while another process
+    // rewrites it. The lock is only needed to write a new one.
+    LogStatus status = readLogLocked();
+    if (status.needsRewrite) {
+        QLockFile lock(m_path + QStringLiteral(".lock"));
+        if (lock.tryLock(LOCK_TIMEOUT_MS)) {
+            // Another process may have rewritten or appended to the log since, keep its records too
+            status = readLogLocked();
+            if (status.needsRewrite) {
+                if (!rewriteLocked()) {
+                    return;
+                }
+                status.appendable = true;
+            }
+        } else if (status.appendable) {
+            qDebug() << "Probe cache is locked by another process, compacting it another time";
+        } else {
+            qWarning() << "Probe cache is locked by another process, not persisting probes this session";
+            return;
+        }
+    }
+
+    // Unbuffered, so that every record goes out in one write() that O_APPEND keeps atomic
+    m_log.setFileName(m_path);
+    if (!m_log.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+        qWarning() << "Cannot open probe cache:" << m_path << "-" << m_log.errorString();
+        return;
+    }
+
+    qDebug() << "Loaded" << m_entries.size() << "cached probes from" << status.recordCount << "records in" << timer.elapsed() << "ms";
+}
+
+ProbeCache::LogStatus ProbeCache::readLogLocked()
+{
+    LogStatus status;
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() < static_cast<qint64>(sizeof(LogHeader))) {
+        return status;
+    }
+
+    // Mapped up to the current end, records appended later are not seen
+    const qint64 fileSize = file.size();
+    const uchar *data = file.map(0, fileSize);
+    if (!data) {
+        return status;
+    }
+    LogHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+        header.version != LOG_VERSION || header.recordSize != sizeof(Record)) {
+        return status;
+    }
+
+    const qint64 payload = fileSize - static_cast<qint64>(sizeof(LogHeader));
+    status.recordCount = payload / static_cast<qint64>(sizeof(Record));
+    // A partial record at the end would shift every later append
+    status.appendable = payload % static_cast<qint64>(sizeof(Record)) == 0;
+    bool allValid = status.appendable;
+    for (qsizetype i = 0; i < status.recordCount; ++i) {
+        Record record;
+        std::memcpy(&record, data + sizeof(LogHeader) + i * sizeof(Record), sizeof(Record));
+        if (record.checksum != recordChecksum(record)) {
+            allValid = false;
+            continue;
+        }
+        const FileKey key{record.device, record.inode, record.size, record.mtimeNs};
+        m_entries.insert({key.device, key.inode}, {key, toProbe(record)});
+    }
+    status.needsRewrite = !allValid || status.recordCount > m_entries.size() + COMPACTION_SLACK || m_entries.size() > MAX_ENTRIES;
+    return status;
+}
+
+void ProbeCache::appendLocked(const FileKey &key, const FileDetector::ImageProbe &probe)
+{
+    if (!m_log.isOpen()) {
+        return;
+    }
+    const Record record = toRecord(key, probe);
+    m_log.write(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+bool ProbeCache::rewriteLocked()
+{
+    // Drop the oldest entries beyond the limit. QHash has no order, so order by mtime instead.
+    if (m_entries.size() > MAX_ENTRIES) {
+        QList<qint64> mtimes;
+        mtimes.reserve(m_entries.size());
+        for (const Entry &entry : std::as_const(m_entries)) {
+            mtimes.append(entry.key.mtimeNs);
+        }
+        std::nth_element(mtimes.begin(), mtimes.end() - MAX_ENTRIES, mtimes.end());
+        const qint64 cutoff = *(mtimes.end() - MAX_ENTRIES);
+        for (auto it = m_entries.begin(); it != m_entries.end();) {
+            it = it->key.mtimeNs < cutoff ? m_entries.erase(it) : std::next(it);
+        }
+    }
+
+    // Written to a temporary file and renamed, so readers see either the old or the new log.
+    // Appends of other processes to the old log after this point are lost, which only costs a reprobe.
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write probe cache:" << m_path << "-" << file.errorString();
+        return false;
+    }
+
+    LogHeader header{};
+    std::memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header.version = LOG_VERSION;
+    header.recordSize = sizeof(Record);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const Entry &entry : std::as_const(m_entries)) {
+        const Record record = toRecord(entry.key, entry.probe);
+        file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+    }
+    return file.commit();
+}
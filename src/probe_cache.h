@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+
+#include <optional>
+
+#include "file_detector.h"
+
+// Persistent cache of FileDetector probes, so that warm starts on large directories skip the file I/O.
+//
+// Entries are keyed by device, inode, size and mtime and stored as fixed size records in an
+// append-only log under QStandardPaths::CacheLocation. Records are appended with single O_APPEND
+// writes, which lets several viewer processes share the log. Creation and compaction replace the log
+// by an atomic rename and are serialized with a lock file; reading needs no lock. All methods are
+// thread safe.
+class ProbeCache
+{
+public:
+    struct FileKey {
+        quint64 device = 0;
+        quint64 inode = 0;
+        qint64 size = 0;
+        qint64 mtimeNs = 0;
+
+        friend bool operator==(const FileKey &, const FileKey &) = default;
+    };
+
+    static ProbeCache &instance();
+
+    // Stats the file, returns nothing if it does not exist
+    static std::optional<FileKey> keyForFile(const QString &localPath);
+
+    std::optional<FileDetector::ImageProbe> find(const FileKey &key);
+    void insert(const FileKey &key, const FileDetector::ImageProbe &probe);
+
+private:
+    ProbeCache();
+
+    struct Entry {
+        FileKey key;
+        FileDetector::ImageProbe probe;
+    };
+
+    struct LogStatus {
+        qsizetype recordCount = 0;
+        // Valid header and whole records, appends line up with the existing ones
+        bool appendable = false;
+        // Missing, damaged, or due for compaction
+        bool needsRewrite = true;
+    };
+
+    void loadLocked();
+    // Merges the records of the log on disk into m_entries, later records superseding earlier ones
+    LogStatus readLogLocked();
+    void appendLocked(const FileKey &key, const FileDetector::ImageProbe &probe);
+    bool rewriteLocked();
+
+    mutable QMutex m_mutex;
+    bool m_loaded = false;
+    QString m_path;
+    QFile m_log;
+    // Keyed by (device, inode), the entry is only valid while size and mtime match
+    QHash<QPair<quint64, quint64>, Entry> m_entries;
+};
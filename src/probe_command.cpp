@@ -0,0 +1,114 @@
+#include "probe_command.h"
+
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+#include <QThreadPool>
+
+#include <atomic>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    // Files per task; also how often results reach the output, so that a pipe sees them early
+    constexpr qsizetype PROBE_BATCH_SIZE = 64;
+}
+
+ProbeCommand::Summary ProbeCommand::run(const QStringList &paths, int threads, FILE *out)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+
+    QMutex outputMutex;
+    std::atomic<qint64> supported = 0;
+    std::atomic<qint64> hdr = 0;
+    Summary summary;
+
+    const auto writeLines = [&outputMutex, out](const QByteArray &lines) {
+        QMutexLocker locker(&outputMutex);
+        std::fwrite(lines.constData(), 1, lines.size(), out);
+        std::fflush(out);
+    };
+
+    QStringList batch;
+    const auto flushBatch = [&]() {
+        if (batch.isEmpty()) {
+            return;
+        }
+        pool.start([batch = std::move(batch), &supported, &hdr, &writeLines]() {
+            QByteArray lines;
+            for (const QString &path : batch) {
+                const FileDetector::ImageProbe probe = FileDetector::probe(path);
+                supported += probe.isSupported ? 1 : 0;
+                hdr += probe.isHDR ? 1 : 0;
+                lines += toJson(path, probe);
+                lines += '\n';
+            }
+            writeLines(lines);
+        });
+        batch = {};
+    };
+    const auto addFile = [&](const QString &path) {
+        ++summary.files;
+        batch.append(path);
+        if (batch.size() >= PROBE_BATCH_SIZE) {
+            flushBatch();
+        }
+    };
+
+    // Directories are listed while the pool already probes the first batches
+    for (const QString &path : paths) {
+        const QFileInfo info(path);
+        if (!info.exists()) {
+            ++summary.missing;
+            writeLines(errorJson(path, QStringLiteral("No such file or directory")) + '\n');
+        } else if (info.isDir()) {
+            QDirIterator it(info.absoluteFilePath(), QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+            while (it.hasNext()) {
+                addFile(it.next());
+            }
+        } else {
+            addFile(info.absoluteFilePath());
+        }
+    }
+    flushBatch();
+    pool.waitForDone();
+
+    summary.supported = supported.load();
+    summary.hdr = hdr.load();
+    summary.elapsedMs = timer.elapsed();
+    return summary;
+}
+
+QByteArray ProbeCommand::toJson(const QString &path, const FileDetector::ImageProbe &probe)
+{
+    QJsonObject object{
+        {u"path"_s, path},
+        {u"format"_s, QString::fromLatin1(FileDetector::formatName(probe.format))},
+        {u"supported"_s, probe.isSupported},
+        {u"hdr"_s, probe.isHDR},
+    };
+    if (probe.isSupported) {
+        // As displayed, with the orientation applied
+        const QSize size = probe.displaySize();
+        object.insert(u"width"_s, size.width());
+        object.insert(u"height"_s, size.height());
+        object.insert(u"bitDepth"_s, probe.bitDepth);
+        object.insert(u"transfer"_s, QString::fromLatin1(FileDetector::transferFunctionName(probe.transfer)));
+        object.insert(u"primaries"_s, QString::fromLatin1(FileDetector::colorPrimariesName(probe.primaries)));
+    }
+    return QJsonDocument(object).toJson(QJsonDocument::Compact);
+}
+
+QByteArray ProbeCommand::errorJson(const QString &path, const QString &error)
+{
+    return QJsonDocument(QJsonObject{{u"path"_s, path}, {u"error"_s, error}}).toJson(QJsonDocument::Compact);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include <cstdio>
+
+#include "file_detector.h"
+
+// Headless batch probing behind --probe: walks files and directories (recursively) and probes every
+// file on a thread pool, streaming one JSON object per file (NDJSON) as soon as its batch is done.
+// Lines arrive in completion order, not in path order.
+class ProbeCommand
+{
+public:
+    struct Summary {
+        qint64 files = 0;
+        qint64 supported = 0;
+        qint64 hdr = 0;
+        // Arguments that do not exist, reported as error lines
+        qint64 missing = 0;
+        qint64 elapsedMs = 0;
+
+        double filesPerSecond() const { return elapsedMs > 0 ? files * 1000.0 / elapsedMs : 0.0; }
+    };
+
+    // Blocks until every file is probed. threads <= 0 uses one per core.
+    static Summary run(const QStringList &paths, int threads, FILE *out);
+
+    // One compact line without the trailing newline
+    static QByteArray toJson(const QString &path, const FileDetector::ImageProbe &probe);
+    static QByteArray errorJson(const QString &path, const QString &error);
+};
@@ -0,0 +1,57 @@
+import QtQuick
+import de.aaronrust.hdrimageviewer
+
+// Thumbnails of the directory, served by the "thumbnail" image provider from the persistent cache
+ListView {
+    id: filmstrip
+
+    property int thumbnailSize: 96
+
+    height: thumbnailSize + 16
+    orientation: ListView.Horizontal
+    spacing: 4
+    clip: true
+    boundsBehavior: Flickable.StopAtBounds
+    highlightMoveDuration: 0
+    // Delegates are cheap, keep a screen's worth around on each side for smooth scrolling
+    cacheBuffer: width
+
+    model: App.imageListModel
+    currentIndex: App.currentIndex
+    onCurrentIndexChanged: positionViewAtIndex(currentIndex, ListView.Contain)
+
+    delegate: Item {
+        id: thumbnailDelegate
+
+        required property int index
+        required property string thumbnailUrl
+        required property string fileName
+
+        width: filmstrip.thumbnailSize
+        height: filmstrip.height
+
+        Rectangle {
+            anchors.fill: parent
+            anchors.margins: 2
+            color: thumbnailDelegate.ListView.isCurrentItem ? "#3daee9" : "#202020"
+            radius: 2
+
+            Image {
+                anchors.fill: parent
+                anchors.margins: 3
+                source: thumbnailDelegate.thumbnailUrl
+                // Thumbnails are generated at 256 px ("large" in the freedesktop thumbnail standard)
+                sourceSize: Qt.size(256, 256)
+                asynchronous: true
+                fillMode: Image.PreserveAspectFit
+                // Thumbnails are cached on disk, keep the pixmap cache for the full size images
+                cache: false
+            }
+        }
+
+        MouseArea {
+            anchors.fill: parent
+            onClicked: App.navigateToIndex(thumbnailDelegate.index)
+        }
+    }
+}
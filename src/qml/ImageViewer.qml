@@ -10,7 +10,7 @@ Item {
     property url source: ""
     // Status / loading flags of the currently visible image
     property int status: mainImageA.status
-    property bool isLoading: mainImageA.status === Image.Loading
+    property bool isLoading: mainImageA.status === TiledImage.Loading
     property bool isHDRMode: currentHDRMode  // Expose current HDR mode state
 
     // State management
@@ -29,6 +29,17 @@ Item {
         print("Loading new image:", newSource)
         mainImageA.source = newSource
     }
+
+    // The file on screen was rewritten, e.g. re-exported: decode it again, its color mode may have changed
+    Connections {
+        target: App
+        function onCurrentImageModified() {
+            print("Reloading modified image:", mainImageA.source)
+            mainImageA.presented = false
+            mainImageA.sourceIsHDR = App.prepareColorMode(hdrWindow, mainImageA.source)
+            mainImageA.reload()
+        }
+    }
     
     // Signals
     signal clicked()
@@ -91,6 +102,57 @@ Item {
     
     // Smooth rendering toggle for pixel art mode
     property bool smoothRendering: true
+
+    // Thumbnail filmstrip along the bottom edge
+    property bool showFilmstrip: false
+
+    // Performance counters overlay in the top left corner
+    property bool showStats: false
+
+    // A/B comparison: a pinned second image, kept decoded at full resolution and GPU resident
+    // underneath the current one, so flipping between them is a single frame with zoom and pan kept.
+    // An opaque cover between the two hides the one underneath: it is still drawn, so its tiles
+    // stay uploaded, but never shows through letterboxing or transparent pixels.
+    property url compareSource: ""
+    property bool compareIsHDR: false
+    property bool showingCompare: false
+    readonly property bool compareMode: compareSource.toString() !== ""
+
+    function applyColorMode(hdr) {
+        if (hdr) {
+            App.enablePQMode(hdrWindow)
+        } else {
+            App.disablePQMode(hdrWindow)
+        }
+        currentHDRMode = hdr
+    }
+
+    // Pins the current image as B, or leaves the comparison
+    function toggleCompare() {
+        if (compareMode) {
+            compareSource = ""
+            if (showingCompare) {
+                showingCompare = false
+                applyColorMode(mainImageA.sourceIsHDR)
+            }
+            print("Comparison ended")
+        } else if (mainImageA.status === TiledImage.Ready) {
+            compareIsHDR = mainImageA.sourceIsHDR
+            compareSource = mainImageA.source
+            print("Pinned for comparison:", compareSource)
+        }
+    }
+
+    function flipCompare() {
+        if (!compareMode || mainImageB.status !== TiledImage.Ready) {
+            return
+        }
+        showingCompare = !showingCompare
+        applyColorMode(showingCompare ? compareIsHDR : mainImageA.sourceIsHDR)
+        // The container follows the shown image, keep the view inside it
+        imageFlickable.contentX = Math.max(0, Math.min(imageFlickable.contentX, imageFlickable.contentWidth - imageFlickable.width))
+        imageFlickable.contentY = Math.max(0, Math.min(imageFlickable.contentY, imageFlickable.contentHeight - imageFlickable.height))
+    }
     
     function toggleHDRMode() {
         // Simply invert the current state
@@ -113,6 +175,11 @@ Item {
     property real _zoomCenterX: width / 2
     property real _zoomCenterY: height / 2
     property real smoothZoomVelocity: 0.0
+    // The tiled image picks its resident tiles from the on-screen scale
+    onZoomFactorChanged: {
+        mainImageA.update()
+        mainImageB.update()
+    }
     function resetZoom() {
         zoomFactor = 1.0
         smoothZoomVelocity = 0.0
@@ -286,25 +353,36 @@ Item {
                     clip: true
                     boundsBehavior: Flickable.StopAtBounds
                     interactive: root.zoomFactor > 1.0
+
+                    // Panning changes which tiles are visible
+                    onContentXChanged: {
+                        mainImageA.update()
+                        mainImageB.update()
+                    }
+                    onContentYChanged: {
+                        mainImageA.update()
+                        mainImageB.update()
+                    }
                     
                     Item {
                         id: imageContainer
-                        width: Math.max(mainImageA.paintedWidth * root.zoomFactor, imageFlickable.width)
-                        height: Math.max(mainImageA.paintedHeight * root.zoomFactor, imageFlickable.height)
+                        // Sized from the image on screen, A and B may have different aspect ratios
+                        readonly property TiledImage shownImage: root.showingCompare ? mainImageB : mainImageA
+                        width: Math.max(shownImage.paintedWidth * root.zoomFactor, imageFlickable.width)
+                        height: Math.max(shownImage.paintedHeight * root.zoomFactor, imageFlickable.height)
 
-                        // Image A
-                        Image {
+                        // Image A: tiled, only the visible part is resident on the GPU.
+                        // Keeps showing the previous image while the next one loads.
+                        TiledImage {
                             id: mainImageA
                             anchors.centerIn: parent
                             width: imageFlickable.width
                             height: imageFlickable.height
-                            fillMode: Image.PreserveAspectFit
                             smooth: root.smoothRendering
-                            mipmap: true
-                            cache: false
-                            asynchronous: false
-                            retainWhileLoading: true
-                            autoTransform: true
+                            viewport: imageFlickable
+                            // Drawn over the cover unless the pinned image is flipped to
+                            z: root.showingCompare ? 0 : 2
+                            decodeFullResolution: root.compareMode
                             
                             transform: Scale {
                                 xScale: root.zoomFactor
@@ -312,30 +390,52 @@ Item {
                                 origin.x: mainImageA.width / 2
                                 origin.y: mainImageA.height / 2
                             }
-                            onStatusChanged: {
-                                if (mainImageA.status === Image.Ready) {
-                                    const newSource = mainImageA.source
-                                    root.lastImagePath = newSource
-
-                                    print("Image loaded:", newSource)
-
-                                    if (App.isImageHDR(newSource)) {
-                                        print("Detected as HDR - enabling PQ mode")
-                                        App.enablePQMode(hdrWindow)
-                                        root.currentHDRMode = true
-                                    } else {
-                                        print("Detected as SDR - disabling PQ mode")
-                                        App.disablePQMode(hdrWindow)
-                                        root.currentHDRMode = false
-                                    }
+                            // Color mode and window are set up once per source, by the preview when there is one
+                            property bool presented: false
+                            // Classified from the probe while the image decodes, the PQ description is prepared meanwhile
+                            property bool sourceIsHDR: false
+                            onSourceChanged: {
+                                presented = false
+                                // Navigating shows the new image, the pinned one stays underneath
+                                root.showingCompare = false
+                                sourceIsHDR = App.prepareColorMode(hdrWindow, source)
+                            }
+                            function presentSource() {
+                                if (presented) {
+                                    return
+                                }
+                                presented = true
+                                const newSource = mainImageA.source
+                                root.lastImagePath = newSource
 
-                                    if (root.isFirstLoad) {
-                                        root.isFirstLoad = false
-                                        root.showParentWindow()
-                                    }
+                                // Applied with the frame that shows the new texture
+                                if (sourceIsHDR) {
+                                    print("Detected as HDR - enabling PQ mode")
+                                    App.enablePQMode(hdrWindow)
+                                    root.currentHDRMode = true
+                                } else {
+                                    print("Detected as SDR - disabling PQ mode")
+                                    App.disablePQMode(hdrWindow)
+                                    root.currentHDRMode = false
+                                }
 
+                                if (root.isFirstLoad) {
+                                    root.isFirstLoad = false
+                                    root.showParentWindow()
+                                }
+                            }
+                            onPreviewChanged: {
+                                if (mainImageA.preview) {
+                                    print("Preview shown:", mainImageA.source)
+                                    presentSource()
+                                }
+                            }
+                            onStatusChanged: {
+                                if (mainImageA.status === TiledImage.Ready) {
+                                    print("Image loaded:", mainImageA.source)
+                                    presentSource()
                                     root.imageReady()
-                                } else if (mainImageA.status === Image.Error) {
+                                } else if (mainImageA.status === TiledImage.Error) {
                                     if (root.isFirstLoad) {
                                         root.isFirstLoad = false
                                         root.showParentWindow()
@@ -345,6 +445,35 @@ Item {
                             }
 
                         }
+
+                        // Same color as the window background, between the shown and the hidden image
+                        Rectangle {
+                            anchors.fill: parent
+                            color: "black"
+                            visible: root.compareMode
+                            z: 1
+                        }
+
+                        // Image B: the pinned comparison image, same geometry and zoom as image A.
+                        // Stays in the scene underneath the cover so that its tiles are uploaded before a flip.
+                        TiledImage {
+                            id: mainImageB
+                            anchors.centerIn: parent
+                            width: imageFlickable.width
+                            height: imageFlickable.height
+                            smooth: root.smoothRendering
+                            viewport: imageFlickable
+                            source: root.compareSource
+                            decodeFullResolution: true
+                            z: root.showingCompare ? 2 : 0
+
+                            transform: Scale {
+                                xScale: root.zoomFactor
+                                yScale: root.zoomFactor
+                                origin.x: mainImageB.width / 2
+                                origin.y: mainImageB.height / 2
+                            }
+                        }
                     }
                 }
                 
@@ -467,6 +596,34 @@ Item {
                     }
                 }
                 
+                Filmstrip {
+                    id: filmstrip
+                    anchors.left: parent.left
+                    anchors.right: parent.right
+                    anchors.bottom: parent.bottom
+                    visible: root.showFilmstrip
+                }
+
+                // Which image of the comparison is on screen
+                QQC2.Label {
+                    anchors.right: parent.right
+                    anchors.top: parent.top
+                    anchors.margins: 12
+                    visible: root.compareMode
+                    text: root.showingCompare ? "B (pinned)" : "A"
+                    color: "white"
+                    font.bold: true
+                    style: Text.Outline
+                    styleColor: "black"
+                }
+
+                StatsOverlay {
+                    anchors.left: parent.left
+                    anchors.top: parent.top
+                    anchors.margins: 12
+                    visible: root.showStats
+                }
+
                 // Loading indicator
                 QQC2.BusyIndicator {
                     anchors.right: parent.right
@@ -572,6 +729,26 @@ Item {
                 root.smoothRendering = !root.smoothRendering
                 event.accepted = true
                 break
+
+            case Qt.Key_T:
+                root.showFilmstrip = !root.showFilmstrip
+                event.accepted = true
+                break
+
+            case Qt.Key_I:
+                root.showStats = !root.showStats
+                event.accepted = true
+                break
+
+            case Qt.Key_C:
+                root.toggleCompare()
+                event.accepted = true
+                break
+
+            case Qt.Key_X:
+                root.flipCompare()
+                event.accepted = true
+                break
                 
             default:
                 event.accepted = false
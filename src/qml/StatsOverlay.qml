@@ -0,0 +1,53 @@
+import QtQuick
+import de.aaronrust.hdrimageviewer
+
+// Live performance counters from App.performanceStatistics(), polled only while visible
+Rectangle {
+    id: overlay
+
+    property var stats: ({})
+
+    width: statsText.implicitWidth + 24
+    height: statsText.implicitHeight + 16
+    color: "#c0000000"
+    radius: 4
+
+    function histogramLine(name, histogram) {
+        if (!histogram || histogram.count === 0) {
+            return name + ": -"
+        }
+        return name + ": p50 " + histogram.p50.toFixed(1) + "  p95 " + histogram.p95.toFixed(1)
+            + "  max " + histogram.max.toFixed(1) + " ms  (" + histogram.count + ")"
+    }
+
+    function mebibytes(bytes) {
+        return (bytes / (1024 * 1024)).toFixed(0) + " MiB"
+    }
+
+    Timer {
+        interval: 500
+        running: overlay.visible
+        repeat: true
+        triggeredOnStart: true
+        onTriggered: overlay.stats = App.performanceStatistics()
+    }
+
+    Text {
+        id: statsText
+        anchors.centerIn: parent
+        color: "white"
+        font.family: "monospace"
+        font.pixelSize: 12
+        text: [
+            overlay.histogramLine("Decode", overlay.stats.decodeTime),
+            overlay.histogramLine("Pyramid", overlay.stats.pyramidTime),
+            overlay.histogramLine("Probe", overlay.stats.probeTime) + "  cached " + (overlay.stats.probeCacheHits ?? 0),
+            overlay.histogramLine("Upload", overlay.stats.textureUploadTime) + "  tiles " + (overlay.stats.tilesUploaded ?? 0),
+            overlay.histogramLine("Frame", overlay.stats.frameInterval),
+            "Jitter (p99 - p50): " + (overlay.stats.frameJitter ?? 0).toFixed(1) + " ms",
+            "Cache: " + ((overlay.stats.cacheHitRate ?? 0) * 100).toFixed(0) + " % hits, "
+                + (overlay.stats.cacheImages ?? 0) + " images, " + overlay.mebibytes(overlay.stats.bytesResident ?? 0),
+            "Memory: " + overlay.mebibytes(overlay.stats.memoryUsed ?? 0) + " of " + overlay.mebibytes(overlay.stats.memoryLimit ?? 0)
+        ].join("\n")
+    }
+}
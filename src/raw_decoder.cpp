@@ -0,0 +1,338 @@
+#include "raw_decoder.h"
+#include "probe_cache.h"
+
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QTransform>
+
+#include <libraw/libraw.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <memory>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    constexpr std::array RAW_SUFFIXES = {
+        "3fr"_L1, "ari"_L1, "arw"_L1, "cr2"_L1, "cr3"_L1, "crw"_L1, "dcr"_L1, "dng"_L1, "erf"_L1, "fff"_L1,
+        "iiq"_L1, "k25"_L1, "kdc"_L1, "mef"_L1, "mos"_L1, "mrw"_L1, "nef"_L1, "nrw"_L1, "orf"_L1, "pef"_L1,
+        "raf"_L1, "raw"_L1, "rw2"_L1, "rwl"_L1, "sr2"_L1, "srf"_L1, "srw"_L1, "x3f"_L1,
+    };
+
+    constexpr char CACHE_MAGIC[8] = {'H', 'D', 'R', 'R', 'A', 'W', 'P', 'X'};
+    // Bump when the stored pixels change for the same parameters (e.g. a different LibRaw setup)
+    constexpr quint32 CACHE_VERSION = 1;
+    // About 20 processed 60 MP images
+    constexpr qint64 CACHE_LIMIT = 4LL * 1024 * 1024 * 1024;
+    // Embedded thumbnails below this edge length are not worth showing, a half size decode is used instead
+    constexpr int MIN_PREVIEW_EDGE = 640;
+
+    struct CacheHeader {
+        char magic[8];
+        quint32 version;
+        qint32 width;
+        qint32 height;
+        qint32 bytesPerLine;
+    };
+
+    // Serializes evictions of concurrent stores within this process
+    QMutex cacheMutex;
+
+    // LibRaw's flip field: 3 = 180°, 5 = 90° counter-clockwise, 6 = 90° clockwise
+    QImageIOHandler::Transformations transformationsFromFlip(int flip)
+    {
+        switch (flip) {
+            case 3: return QImageIOHandler::TransformationRotate180;
+            case 5: return QImageIOHandler::TransformationRotate270;
+            case 6: return QImageIOHandler::TransformationRotate90;
+            default: return QImageIOHandler::TransformationNone;
+        }
+    }
+
+    std::unique_ptr<LibRaw> openRaw(const QString &localPath, QString *errorString)
+    {
+        // LibRaw is large, keep it off the stack of the worker threads
+        auto raw = std::make_unique<LibRaw>();
+        const int result = raw->open_file(QFile::encodeName(localPath).constData());
+        if (result != LIBRAW_SUCCESS) {
+            if (errorString) {
+                *errorString = QString::fromLatin1(libraw_strerror(result));
+            }
+            return nullptr;
+        }
+        return raw;
+    }
+
+    // Wraps LibRaw's output buffer without copying, it is released together with the image
+    QImage imageFromProcessed(libraw_processed_image_t *processed)
+    {
+        if (!processed || processed->type != LIBRAW_IMAGE_BITMAP || processed->colors != 3 || processed->bits != 8) {
+            LibRaw::dcraw_clear_mem(processed);
+            return {};
+        }
+        return QImage(processed->data, processed->width, processed->height, processed->width * 3, QImage::Format_RGB888,
+                      [](void *info) { LibRaw::dcraw_clear_mem(static_cast<libraw_processed_image_t *>(info)); },
+                      processed);
+    }
+}
+
+QByteArray RawDecoder::Parameters::cacheKey() const
+{
+    // Everything that influences the output, including the fixed settings of process()
+    return "camera-wb;srgb;8bit;"_ba + (halfSize ? "half"_ba : "ahd"_ba);
+}
+
+bool RawDecoder::isRawFile(const QString &localPath)
+{
+    const QString suffix = QFileInfo(localPath).suffix();
+    return std::ranges::any_of(RAW_SUFFIXES, [&suffix](QLatin1StringView rawSuffix) {
+        return suffix.compare(rawSuffix, Qt::CaseInsensitive) == 0;
+    });
+}
+
+void RawDecoder::probe(const QString &localPath, FileDetector::ImageProbe &probe)
+{
+    const std::unique_ptr<LibRaw> raw = openRaw(localPath, nullptr);
+    if (!raw) {
+        probe.isSupported = false;
+        return;
+    }
+
+    // Camera output is display referred sRGB after processing
+    const libraw_image_sizes_t &sizes = raw->imgdata.sizes;
+    probe.isSupported = true;
+    probe.transfer = FileDetector::TransferFunction::SRGB;
+    probe.primaries = FileDetector::ColorPrimaries::BT709;
+    probe.size = QSize(sizes.width, sizes.height);
+    probe.transformations = transformationsFromFlip(sizes.flip);
+    probe.bitDepth = raw->imgdata.color.maximum > 0 ? static_cast<int>(std::bit_width(raw->imgdata.color.maximum)) : 0;
+}
+
+QImage RawDecoder::decode(const QString &localPath, const QSize &requestedSize, QString *errorString)
+{
+    // Half size output is enough for anything up to half the sensor resolution
+    Parameters parameters;
+    if (requestedSize.isValid() && !requestedSize.isEmpty()) {
+        const QSize halfSize = FileDetector::probe(localPath).displaySize() / 2;
+        parameters.halfSize = halfSize.isValid() && halfSize.width() >= requestedSize.width() && halfSize.height() >= requestedSize.height();
+    }
+
+    const QString cacheFile = cacheFilePath(localPath, parameters);
+    QImage image = cacheFile.isEmpty() ? QImage() : loadCached(cacheFile);
+    if (image.isNull()) {
+        image = process(localPath, parameters, errorString);
+        if (!image.isNull() && !cacheFile.isEmpty()) {
+            // Written in the background, the image is shown without waiting for the disk
+            QThreadPool::globalInstance()->start([cacheFile, image]() {
+                store(cacheFile, image);
+            });
+        }
+    }
+
+    if (!image.isNull() && requestedSize.isValid() && !requestedSize.isEmpty() &&
+        (image.width() > requestedSize.width() || image.height() > requestedSize.height())) {
+        image = image.scaled(requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+    return image;
+}
+
+QImage RawDecoder::preview(const QString &localPath, int maxEdge)
+{
+    QImage image = embeddedThumbnail(localPath, maxEdge);
+    if (image.isNull()) {
+        image = decode(localPath, QSize(maxEdge, maxEdge));
+    }
+    return image;
+}
+
+QImage RawDecoder::process(const QString &localPath, const Parameters &parameters, QString *errorString)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const std::unique_ptr<LibRaw> raw = openRaw(localPath, errorString);
+    if (!raw) {
+        qWarning() << "Failed to open RAW file:" << localPath << "-" << (errorString ? *errorString : QString());
+        return {};
+    }
+
+    // Matches what cacheKey() describes
+    libraw_output_params_t &params = raw->imgdata.params;
+    params.use_camera_wb = 1;
+    params.output_color = 1;
+    params.output_bps = 8;
+    params.half_size = parameters.halfSize ? 1 : 0;
+    params.user_qual = 3;
+
+    int result = raw->unpack();
+    if (result == LIBRAW_SUCCESS) {
+        result = raw->dcraw_process();
+    }
+    if (result != LIBRAW_SUCCESS) {
+        const QString error = QString::fromLatin1(libraw_strerror(result));
+        qWarning() << "Failed to process RAW file:" << localPath << "-" << error;
+        if (errorString) {
+            *errorString = error;
+        }
+        return {};
+    }
+
+    // The output is rotated according to the flip field already
+    const QImage image = imageFromProcessed(raw->dcraw_make_mem_image(&result));
+    if (image.isNull() && errorString) {
+        *errorString = QString::fromLatin1(libraw_strerror(result));
+    }
+
+    qDebug() << "Processed RAW" << localPath << image.size() << (parameters.halfSize ? "(half size)" : "")
+             << "in" << timer.elapsed() << "ms";
+    return image;
+}
+
+QImage RawDecoder::embeddedThumbnail(const QString &localPath, int maxEdge)
+{
+    const std::unique_ptr<LibRaw> raw = openRaw(localPath, nullptr);
+    if (!raw || raw->unpack_thumb() != LIBRAW_SUCCESS) {
+        return {};
+    }
+
+    int result = LIBRAW_SUCCESS;
+    libraw_processed_image_t *thumbnail = raw->dcraw_make_mem_thumb(&result);
+    if (!thumbnail) {
+        return {};
+    }
+
+    QImage image;
+    if (thumbnail->type == LIBRAW_IMAGE_JPEG) {
+        QBuffer buffer;
+        buffer.setData(QByteArray::fromRawData(reinterpret_cast<const char *>(thumbnail->data), thumbnail->data_size));
+        buffer.open(QIODevice::ReadOnly);
+
+        // DCT scaling, camera previews are often full sensor resolution
+        QImageReader reader(&buffer, "jpeg");
+        reader.setAutoTransform(false);
+        const QSize size = reader.size();
+        if (maxEdge > 0 && size.isValid() && (size.width() > maxEdge || size.height() > maxEdge)) {
+            reader.setScaledSize(size.scaled(maxEdge, maxEdge, Qt::KeepAspectRatio));
+        }
+        reader.read(&image);
+        LibRaw::dcraw_clear_mem(thumbnail);
+    } else {
+        image = imageFromProcessed(thumbnail).copy();
+    }
+
+    if (image.isNull() || std::max(image.width(), image.height()) < std::min(MIN_PREVIEW_EDGE, maxEdge)) {
+        return {};
+    }
+    if (maxEdge > 0 && (image.width() > maxEdge || image.height() > maxEdge)) {
+        image = image.scaled(maxEdge, maxEdge, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // Thumbnails are stored unrotated
+    switch (raw->imgdata.sizes.flip) {
+        case 3: image = image.transformed(QTransform().rotate(180)); break;
+        case 5: image = image.transformed(QTransform().rotate(270)); break;
+        case 6: image = image.transformed(QTransform().rotate(90)); break;
+    }
+    return image;
+}
+
+QString RawDecoder::cacheFilePath(const QString &localPath, const Parameters &parameters)
+{
+    const std::optional<ProbeCache::FileKey> key = ProbeCache::keyForFile(localPath);
+    if (!key) {
+        return {};
+    }
+
+    // Any change to the file gives it a new identity, stale entries simply age out
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArrayView(reinterpret_cast<const char *>(&key->device), sizeof(key->device)));
+    hash.addData(QByteArrayView(reinterpret_cast<const char *>(&key->inode), sizeof(key->inode)));
+    hash.addData(QByteArrayView(reinterpret_cast<const char *>(&key->size), sizeof(key->size)));
+    hash.addData(QByteArrayView(reinterpret_cast<const char *>(&key->mtimeNs), sizeof(key->mtimeNs)));
+    hash.addData(parameters.cacheKey());
+
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + u"/raw/"_s
+        + QString::fromLatin1(hash.result().toHex()) + u".bin"_s;
+}
+
+QImage RawDecoder::loadCached(const QString &cacheFile)
+{
+    QFile file(cacheFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    CacheHeader header;
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) ||
+        std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION) {
+        return {};
+    }
+
+    QImage image(header.width, header.height, QImage::Format_RGB888);
+    if (image.isNull() || image.bytesPerLine() != header.bytesPerLine ||
+        file.read(reinterpret_cast<char *>(image.bits()), image.sizeInBytes()) != image.sizeInBytes()) {
+        return {};
+    }
+
+    // Least recently used entries are evicted first
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return image;
+}
+
+void RawDecoder::store(const QString &cacheFile, const QImage &image)
+{
+    const QString directory = QFileInfo(cacheFile).absolutePath();
+    if (!QDir().mkpath(directory)) {
+        return;
+    }
+
+    QSaveFile file(cacheFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    CacheHeader header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.width = image.width();
+    header.height = image.height();
+    header.bytesPerLine = static_cast<qint32>(image.bytesPerLine());
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(image.constBits()), image.sizeInBytes());
+    if (!file.commit()) {
+        qWarning() << "Failed to write RAW cache:" << cacheFile << "-" << file.errorString();
+        return;
+    }
+
+    evictCache(directory);
+}
+
+void RawDecoder::evictCache(const QString &directory)
+{
+    QMutexLocker locker(&cacheMutex);
+
+    // Newest first, everything beyond the limit goes
+    const QFileInfoList entries = QDir(directory).entryInfoList({u"*.bin"_s}, QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const QFileInfo &entry : entries) {
+        total += entry.size();
+        if (total > CACHE_LIMIT) {
+            QFile::remove(entry.absoluteFilePath());
+        }
+    }
+}
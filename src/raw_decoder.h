@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include "file_detector.h"
+
+// Decodes camera RAW files with LibRaw directly instead of through the kimg_raw plugin, which always
+// runs the full demosaic. Previews come from the embedded JPEG or a half size decode, and processed
+// output is kept in a disk cache keyed on the file identity plus the processing parameters, so that
+// revisiting a RAW costs a file read instead of a demosaic.
+class RawDecoder
+{
+public:
+    // Demosaic settings, part of the cache key
+    struct Parameters {
+        // Averages every 2x2 Bayer block instead of interpolating, a quarter of the pixels and several times faster
+        bool halfSize = false;
+
+        QByteArray cacheKey() const;
+    };
+
+    // RAW files are recognized by their suffix, most of them look like TIFF or nothing in particular
+    static bool isRawFile(const QString &localPath);
+    // Size and orientation from the RAW metadata, without unpacking the sensor data
+    static void probe(const QString &localPath, FileDetector::ImageProbe &probe);
+
+    // Full demosaic, or a half size one when requestedSize fits into it. Oriented, 8 bit sRGB.
+    static QImage decode(const QString &localPath, const QSize &requestedSize = {}, QString *errorString = nullptr);
+    // The embedded JPEG, or a half size decode when the file has none, scaled to fit into maxEdge
+    static QImage preview(const QString &localPath, int maxEdge);
+
+private:
+    static QImage process(const QString &localPath, const Parameters &parameters, QString *errorString);
+    static QImage embeddedThumbnail(const QString &localPath, int maxEdge);
+
+    static QString cacheFilePath(const QString &localPath, const Parameters &parameters);
+    static QImage loadCached(const QString &cacheFile);
+    static void store(const QString &cacheFile, const QImage &image);
+    static void evictCache(const QString &directory);
+};
@@ -0,0 +1,172 @@
+#include "thumbnail_cache.h"
+#include "image_decoder.h"
+#include "memory_budget.h"
+#include "raw_decoder.h"
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QUrl>
+
+namespace {
+    // Stored in HDR thumbnails in addition to the standard keys
+    constexpr auto TRANSFER_KEY = "X-HDR-Image-Viewer::Transfer";
+}
+
+QImage ThumbnailCache::thumbnail(const QString &localPath, const std::atomic_bool *cancelled)
+{
+    const QFileInfo fileInfo(localPath);
+    const QString uri = QString::fromLatin1(QUrl::fromLocalFile(fileInfo.absoluteFilePath()).toEncoded());
+    const qint64 mtime = fileInfo.lastModified().toSecsSinceEpoch();
+
+    const FileDetector::ImageProbe probe = FileDetector::probe(localPath);
+    if (!probe.isSupported) {
+        return {};
+    }
+
+    const QString cacheFile = cacheFilePath(uri, probe.isHDR);
+    QImage image = loadCached(cacheFile, uri, mtime);
+    if (!image.isNull()) {
+        return image;
+    }
+
+    if (cancelled && cancelled->load()) {
+        return {};
+    }
+
+    image = generate(localPath, probe);
+    if (!image.isNull()) {
+        store(cacheFile, image, uri, fileInfo, probe);
+    }
+    return image;
+}
+
+QImage ThumbnailCache::cached(const QString &localPath)
+{
+    const QFileInfo fileInfo(localPath);
+    const QString uri = QString::fromLatin1(QUrl::fromLocalFile(fileInfo.absoluteFilePath()).toEncoded());
+
+    const FileDetector::ImageProbe probe = FileDetector::probe(localPath);
+    if (!probe.isSupported) {
+        return {};
+    }
+    return loadCached(cacheFilePath(uri, probe.isHDR), uri, fileInfo.lastModified().toSecsSinceEpoch());
+}
+
+QString ThumbnailCache::cacheFilePath(const QString &uri, bool hdr)
+{
+    const QString root = hdr
+        ? QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+        : QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    const QByteArray hash = QCryptographicHash::hash(uri.toUtf8(), QCryptographicHash::Md5).toHex();
+    return root + QStringLiteral("/thumbnails/large/") + QString::fromLatin1(hash) + QStringLiteral(".png");
+}
+
+QImage ThumbnailCache::loadCached(const QString &cacheFile, const QString &uri, qint64 mtime)
+{
+    QImageReader reader(cacheFile, "png");
+    if (!reader.canRead()) {
+        return {};
+    }
+
+    // The text chunks precede the pixel data, so a stale thumbnail is rejected without decoding it
+    if (reader.text(QStringLiteral("Thumb::URI")) != uri ||
+        reader.text(QStringLiteral("Thumb::MTime")).toLongLong() != mtime) {
+        return {};
+    }
+    return reader.read();
+}
+
+QImage ThumbnailCache::generate(const QString &localPath, const FileDetector::ImageProbe &probe)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Scaled decoding keeps JPEG and RAW previews small, other plugins decode the full image first.
+    // Thumbnails never displace decoded frames, over budget they are retried on the next request.
+    const bool scaledDecode = probe.format == FileDetector::ImageFormat::JPEG || probe.format == FileDetector::ImageFormat::RAW;
+    const qint64 estimate = scaledDecode ? qint64(THUMBNAIL_SIZE) * THUMBNAIL_SIZE * 8
+                                         : ImageDecoder::estimateFrameBytes(probe, probe.displaySize());
+    const auto memory = MemoryBudget::instance().reserve(estimate, MemoryBudget::Priority::Thumbnail);
+    if (!memory) {
+        return {};
+    }
+
+    QImage image;
+    const QSize bounds(THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+    if (probe.format == FileDetector::ImageFormat::RAW) {
+        // The embedded preview instead of a full demosaic
+        image = RawDecoder::preview(localPath, THUMBNAIL_SIZE);
+        if (image.isNull()) {
+            qWarning() << "Failed to generate thumbnail:" << localPath;
+            return {};
+        }
+    } else {
+        QImageReader reader(localPath);
+        reader.setAutoTransform(true);
+
+        // Scaled decoding: JPEG decodes at 1/2, 1/4 or 1/8 DCT scale, other plugins at least skip
+        // the full resolution intermediate where they support it
+        const QSize fullSize = probe.size.isValid() ? probe.size : reader.size();
+        if (fullSize.isValid() && (fullSize.width() > THUMBNAIL_SIZE || fullSize.height() > THUMBNAIL_SIZE)) {
+            reader.setScaledSize(fullSize.scaled(bounds, Qt::KeepAspectRatio));
+        }
+
+        if (!reader.read(&image)) {
+            qWarning() << "Failed to generate thumbnail:" << localPath << "-" << reader.errorString();
+            return {};
+        }
+    }
+
+    // Plugins without scaled decoding return the full image
+    if (image.width() > THUMBNAIL_SIZE || image.height() > THUMBNAIL_SIZE) {
+        image = image.scaled(bounds, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // HDR keeps the PQ code values in 16 bit, SDR is stored as 8 bit like every other thumbnailer
+    image = image.convertToFormat(probe.isHDR
+        ? (image.hasAlphaChannel() ? QImage::Format_RGBA64 : QImage::Format_RGBX64)
+        : (image.hasAlphaChannel() ? QImage::Format_ARGB32 : QImage::Format_RGB32));
+
+    qDebug() << "Generated thumbnail for" << localPath << image.size() << "in" << timer.elapsed() << "ms";
+    return image;
+}
+
+void ThumbnailCache::store(const QString &cacheFile, QImage thumbnail, const QString &uri, const QFileInfo &fileInfo,
+                           const FileDetector::ImageProbe &probe)
+{
+    const QString directory = QFileInfo(cacheFile).absolutePath();
+    if (!QDir().mkpath(directory)) {
+        return;
+    }
+    QFile::setPermissions(directory, QFileDevice::ReadOwner | QFileDevice::WriteOwner | QFileDevice::ExeOwner);
+
+    thumbnail.setText(QStringLiteral("Thumb::URI"), uri);
+    thumbnail.setText(QStringLiteral("Thumb::MTime"), QString::number(fileInfo.lastModified().toSecsSinceEpoch()));
+    thumbnail.setText(QStringLiteral("Thumb::Size"), QString::number(fileInfo.size()));
+    thumbnail.setText(QStringLiteral("Thumb::Image::Width"), QString::number(probe.displaySize().width()));
+    thumbnail.setText(QStringLiteral("Thumb::Image::Height"), QString::number(probe.displaySize().height()));
+    thumbnail.setText(QStringLiteral("Software"), QStringLiteral("HDR Image Viewer"));
+    if (probe.isHDR) {
+        thumbnail.setText(QString::fromLatin1(TRANSFER_KEY), QStringLiteral("PQ"));
+    }
+
+    // Written to a temporary file and renamed, as the standard requires, readable by the owner only
+    QSaveFile file(cacheFile);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner);
+    QImageWriter writer(&file, "png");
+    if (!writer.write(thumbnail)) {
+        qWarning() << "Failed to write thumbnail:" << cacheFile << "-" << writer.errorString();
+        file.cancelWriting();
+    }
+    file.commit();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QFileInfo>
+#include <QImage>
+#include <QString>
+
+#include <atomic>
+
+#include "file_detector.h"
+
+// Thumbnails as described by the freedesktop.org Thumbnail Managing Standard: PNG files named after
+// the MD5 of the file URI, carrying Thumb::URI and Thumb::MTime so that stale entries are detected.
+//
+// SDR thumbnails go to the shared cache ($XDG_CACHE_HOME/thumbnails/large) and are reused by and from
+// other applications. HDR thumbnails keep their PQ encoding in 16 bit; since other applications would
+// show them as sRGB, they use the same layout inside the viewer's own cache directory.
+class ThumbnailCache
+{
+public:
+    // Edge length of the "large" flavor
+    static constexpr int THUMBNAIL_SIZE = 256;
+
+    // Returns the cached thumbnail, or generates and stores it. Uses scaled decoding, so full
+    // resolution frames are not decoded where the image plugin supports it. Thread safe.
+    static QImage thumbnail(const QString &localPath, const std::atomic_bool *cancelled = nullptr);
+    // Returns the thumbnail only if it is already cached and up to date
+    static QImage cached(const QString &localPath);
+
+private:
+    static QString cacheFilePath(const QString &uri, bool hdr);
+    static QImage loadCached(const QString &cacheFile, const QString &uri, qint64 mtime);
+    static QImage generate(const QString &localPath, const FileDetector::ImageProbe &probe);
+    static void store(const QString &cacheFile, QImage thumbnail, const QString &uri, const QFileInfo &fileInfo,
+                      const FileDetector::ImageProbe &probe);
+};
@@ -0,0 +1,91 @@
+#include "thumbnail_provider.h"
+#include "image_provider.h"
+#include "thumbnail_cache.h"
+#include "tone_mapper.h"
+
+#include <QQuickTextureFactory>
+#include <QThread>
+
+#include <algorithm>
+
+namespace {
+    // Thumbnail generation runs next to the main decode, leave it most of the cores
+    constexpr int MAX_THUMBNAIL_THREADS = 2;
+}
+
+ThumbnailTask::ThumbnailTask(const QString &localPath, std::shared_ptr<std::atomic_bool> cancelled)
+    : m_localPath(localPath)
+    , m_cancelled(std::move(cancelled))
+{
+    setAutoDelete(true);
+}
+
+void ThumbnailTask::run()
+{
+    if (m_cancelled->load()) {
+        Q_EMIT done({});
+        return;
+    }
+    QImage thumbnail = ThumbnailCache::thumbnail(m_localPath, m_cancelled.get());
+    // HDR thumbnails keep their PQ code values, which only a PQ surface shows correctly
+    if (!thumbnail.isNull() && ToneMapper::isEnabled()) {
+        const FileDetector::ImageProbe probe = FileDetector::probe(m_localPath);
+        if (ToneMapper::appliesTo(probe)) {
+            thumbnail = ToneMapper::toneMapPQToSRGB(thumbnail, probe.primaries);
+        }
+    }
+    Q_EMIT done(thumbnail);
+}
+
+ThumbnailResponse::ThumbnailResponse(ThumbnailTask *task, std::shared_ptr<std::atomic_bool> cancelled)
+    : m_cancelled(std::move(cancelled))
+{
+    connect(task, &ThumbnailTask::done, this, &ThumbnailResponse::handleDone, Qt::QueuedConnection);
+}
+
+QQuickTextureFactory *ThumbnailResponse::textureFactory() const
+{
+    return QQuickTextureFactory::textureFactoryForImage(m_image);
+}
+
+QString ThumbnailResponse::errorString() const
+{
+    return m_image.isNull() ? QStringLiteral("No thumbnail available") : QString();
+}
+
+void ThumbnailResponse::cancel()
+{
+    m_cancelled->store(true);
+}
+
+void ThumbnailResponse::handleDone(const QImage &image)
+{
+    m_image = image;
+    Q_EMIT finished();
+}
+
+ThumbnailProvider::ThumbnailProvider()
+{
+    m_pool.setMaxThreadCount(std::clamp(QThread::idealThreadCount() / 4, 1, MAX_THUMBNAIL_THREADS));
+    m_pool.setThreadPriority(QThread::LowPriority);
+}
+
+ThumbnailProvider::~ThumbnailProvider()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+QQuickImageResponse *ThumbnailProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    Q_UNUSED(requestedSize)
+
+    auto cancelled = std::make_shared<std::atomic_bool>(false);
+    auto task = new ThumbnailTask(ImageProvider::localPathFromId(id), cancelled);
+    auto response = new ThumbnailResponse(task, std::move(cancelled));
+    m_pool.start(task, m_nextPriority++);
+
+    return response;
+}
+
+#include "moc_thumbnail_provider.cpp"
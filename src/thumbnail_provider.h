@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QImage>
+#include <QObject>
+#include <QQuickAsyncImageProvider>
+#include <QQuickImageResponse>
+#include <QRunnable>
+#include <QString>
+#include <QThreadPool>
+
+#include <atomic>
+#include <memory>
+
+// Loads or generates one thumbnail on a pool thread
+class ThumbnailTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+    ThumbnailTask(const QString &localPath, std::shared_ptr<std::atomic_bool> cancelled);
+
+    void run() override;
+
+Q_SIGNALS:
+    void done(const QImage &image);
+
+private:
+    QString m_localPath;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+};
+
+class ThumbnailResponse : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    ThumbnailResponse(ThumbnailTask *task, std::shared_ptr<std::atomic_bool> cancelled);
+
+    QQuickTextureFactory *textureFactory() const override;
+    QString errorString() const override;
+    void cancel() override;
+
+private:
+    void handleDone(const QImage &image);
+
+    QImage m_image;
+    std::shared_ptr<std::atomic_bool> m_cancelled;
+};
+
+// Serves "image://thumbnail/<percent-encoded file URL>" from the ThumbnailCache.
+// The most recent requests are served first, so scrolling the filmstrip fills in what is on screen.
+class ThumbnailProvider : public QQuickAsyncImageProvider
+{
+public:
+    ThumbnailProvider();
+    ~ThumbnailProvider() override;
+
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+private:
+    QThreadPool m_pool;
+    // Newer requests get a higher priority
+    std::atomic<int> m_nextPriority = 0;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <QByteArrayView>
+#include <QtEndian>
+
+#include <optional>
+
+// Reads TIFF and BigTIFF structures in the file's byte order from a view of the file, or of an EXIF
+// block. Offsets are relative to the TIFF header at the start of the view, reads out of bounds return 0.
+struct TiffReader {
+    // An IFD entry: tag, field type, number of values and the position of the value/offset field
+    struct Entry {
+        quint16 tag = 0;
+        quint16 type = 0;
+        qint64 count = 0;
+        qint64 valueField = 0;
+    };
+
+    static constexpr quint16 TAG_NEW_SUBFILE_TYPE = 254;
+    static constexpr quint16 TAG_IMAGE_WIDTH = 256;
+    static constexpr quint16 TAG_IMAGE_LENGTH = 257;
+    static constexpr quint16 TAG_BITS_PER_SAMPLE = 258;
+    static constexpr quint16 TAG_COMPRESSION = 259;
+    static constexpr quint16 TAG_PHOTOMETRIC_INTERPRETATION = 262;
+    static constexpr quint16 TAG_STRIP_OFFSETS = 273;
+    static constexpr quint16 TAG_ORIENTATION = 274;
+    static constexpr quint16 TAG_STRIP_BYTE_COUNTS = 279;
+    static constexpr quint16 TAG_SUB_IFDS = 330;
+    static constexpr quint16 TAG_JPEG_INTERCHANGE_FORMAT = 513;
+    static constexpr quint16 TAG_JPEG_INTERCHANGE_FORMAT_LENGTH = 514;
+    static constexpr quint16 TAG_ICC_PROFILE = 34675;
+    static constexpr quint16 TYPE_SHORT = 3;
+    static constexpr quint16 TYPE_LONG8 = 16;
+    static constexpr quint16 TYPE_IFD8 = 18;
+    // Guards against IFD chains that loop
+    static constexpr int MAX_IFDS = 64;
+
+    QByteArrayView data;
+    bool littleEndian = true;
+    bool bigTiff = false;
+    quint64 firstIfd = 0;
+
+    // Parses the header: classic TIFF (magic 42), BigTIFF (43), and the variants of
+    // Olympus ORF ("RO", "RS") and Panasonic RW2 (0x55), which use regular IFDs
+    static std::optional<TiffReader> open(QByteArrayView data)
+    {
+        if (data.size() < 8) {
+            return std::nullopt;
+        }
+
+        // Check byte order (II = little-endian, MM = big-endian)
+        TiffReader tiff{data};
+        if (data[0] == 'I' && data[1] == 'I') {
+            tiff.littleEndian = true;
+        } else if (data[0] == 'M' && data[1] == 'M') {
+            tiff.littleEndian = false;
+        } else {
+            return std::nullopt;
+        }
+
+        // Classic TIFF: 4 byte offset to the first IFD
+        // BigTIFF: offset size 8, reserved 0, 8 byte offset to the first IFD
+        const quint16 magic = tiff.read<quint16>(2);
+        if (magic == 42 || magic == 0x4F52 || magic == 0x5352 || magic == 0x55) {
+            tiff.firstIfd = tiff.read<quint32>(4);
+        } else if (magic == 43 && tiff.read<quint16>(4) == 8) {
+            tiff.bigTiff = true;
+            tiff.firstIfd = tiff.read<quint64>(8);
+        } else {
+            return std::nullopt;
+        }
+        return tiff;
+    }
+
+    template<typename T>
+    T read(qint64 offset) const
+    {
+        if (offset < 0 || offset > data.size() - static_cast<qint64>(sizeof(T))) return 0;
+        return littleEndian ? qFromLittleEndian<T>(data.data() + offset) : qFromBigEndian<T>(data.data() + offset);
+    }
+
+    // Offsets and counts are 32 bit in classic TIFF and 64 bit in BigTIFF
+    quint64 readOffset(qint64 offset) const
+    {
+        return bigTiff ? read<quint64>(offset) : read<quint32>(offset);
+    }
+
+    // Value at index of a SHORT, LONG/IFD or LONG8/IFD8 field
+    quint64 value(const Entry &entry, qint64 index = 0) const
+    {
+        if (index < 0 || index >= entry.count) return 0;
+        const qint64 elementSize = elementSizeOf(entry);
+        // Both the stored offset and the count come from the file, so the sum is only formed once it fits
+        const qint64 base = valueOffset(entry, elementSize);
+        if (base < 0 || base > data.size() || index > (data.size() - base) / elementSize) return 0;
+        const qint64 offset = base + index * elementSize;
+        switch (elementSize) {
+            case 2: return read<quint16>(offset);
+            case 8: return read<quint64>(offset);
+            default: return read<quint32>(offset);
+        }
+    }
+
+    // Position of the values: the value field itself when they fit in it, otherwise the offset stored there
+    qint64 valueOffset(const Entry &entry, qint64 elementSize) const
+    {
+        const qint64 inlineSize = bigTiff ? 8 : 4;
+        // Counts are compared before multiplying, a BigTIFF count may be anything up to 2^64 - 1
+        const bool fitsInline = entry.count >= 0 && entry.count <= inlineSize / elementSize;
+        return fitsInline ? entry.valueField : static_cast<qint64>(readOffset(entry.valueField));
+    }
+
+    static qint64 elementSizeOf(const Entry &entry)
+    {
+        switch (entry.type) {
+            case TYPE_SHORT: return 2;
+            case TYPE_LONG8:
+            case TYPE_IFD8: return 8;
+            default: return 4;
+        }
+    }
+
+    // Calls visitor(entry) for every entry of the IFD at ifd, the visitor returns false to stop.
+    // Returns the offset of the next IFD, 0 at the end of the chain, on errors or when stopped.
+    template<typename Visitor>
+    quint64 forEachEntry(quint64 ifd, Visitor &&visitor) const
+    {
+        const qint64 countSize = bigTiff ? 8 : 2;
+        const qint64 entrySize = bigTiff ? 20 : 12;
+
+        const qint64 start = static_cast<qint64>(ifd);
+        if (start <= 0 || start > data.size() - countSize) {
+            return 0;
+        }
+        // The BigTIFF count is 64 bit, dividing keeps the check from overflowing
+        const qint64 entryCount = bigTiff ? static_cast<qint64>(read<quint64>(start)) : read<quint16>(start);
+        if (entryCount < 0 || entryCount > (data.size() - start - countSize) / entrySize) {
+            return 0;
+        }
+
+        for (qint64 i = 0; i < entryCount; ++i) {
+            // Entry: tag (2 bytes), type (2 bytes), count, value or offset to the value
+            const qint64 position = start + countSize + i * entrySize;
+            const Entry entry{
+                .tag = read<quint16>(position),
+                .type = read<quint16>(position + 2),
+                .count = static_cast<qint64>(readOffset(position + 4)),
+                .valueField = position + 4 + (bigTiff ? 8 : 4),
+            };
+            if (!visitor(entry)) {
+                return 0;
+            }
+        }
+
+        return readOffset(start + countSize + entryCount * entrySize);
+    }
+};
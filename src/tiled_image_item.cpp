@@ -0,0 +1,505 @@
+#include "tiled_image_item.h"
+#include "decoded_image_cache.h"
+#include "image_decoder.h"
+#include "image_provider.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QQuickAsyncImageProvider>
+#include <QQuickImageResponse>
+#include <QQuickTextureFactory>
+#include <QQuickWindow>
+#include <QSGNode>
+#include <QSGSimpleTextureNode>
+#include <QSGTexture>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+    constexpr int TILE_SIZE = 512;
+    // Extra ring of tiles kept around the viewport so that panning does not reveal holes
+    constexpr int TILE_MARGIN = 1;
+    // Spreads uploads over several frames instead of stalling one frame after a jump
+    constexpr int MAX_TILE_UPLOADS_PER_FRAME = 12;
+    // Smaller files decode about as fast as their preview could be extracted
+    constexpr qint64 PREVIEW_MIN_FILE_SIZE = 4 * 1024 * 1024;
+    // Preview bound when the item has no size yet (window not shown)
+    constexpr int PREVIEW_DEFAULT_EDGE = 2048;
+    // Magnification of level 0 that requests the full resolution, above the rounding of a fitted decode
+    constexpr qreal REFINEMENT_SCALE = 1.01;
+
+    quint64 tileKey(int level, int column, int row)
+    {
+        return (quint64(level) << 48) | (quint64(row) << 24) | quint64(column);
+    }
+
+    class TiledImageNode : public QSGNode
+    {
+    public:
+        ~TiledImageNode() override = default;
+
+        void clear()
+        {
+            for (auto &[key, tile] : tiles) {
+                removeChildNode(tile);
+                delete tile;
+            }
+            tiles.clear();
+            if (background) {
+                removeChildNode(background);
+                delete background;
+                background = nullptr;
+            }
+        }
+
+        quint64 imageSerial = 0;
+        QSGSimpleTextureNode *background = nullptr;
+        std::unordered_map<quint64, QSGSimpleTextureNode *> tiles;
+    };
+
+    QSGSimpleTextureNode *createTextureNode(QQuickWindow *window, const QImage &image)
+    {
+        auto node = new QSGSimpleTextureNode;
+        node->setTexture(window->createTextureFromImage(image));
+        node->setOwnsTexture(true);
+        return node;
+    }
+}
+
+TiledImageItem::TiledImageItem(QQuickItem *parent)
+    : QQuickItem(parent)
+    , m_consumerId(ImageProvider::createConsumerId())
+{
+    setFlag(ItemHasContents, true);
+    connect(this, &QQuickItem::smoothChanged, this, &QQuickItem::update);
+}
+
+TiledImageItem::~TiledImageItem()
+{
+    cancelPendingResponse();
+}
+
+void TiledImageItem::setSource(const QUrl &source)
+{
+    if (m_source == source) {
+        return;
+    }
+    m_source = source;
+    Q_EMIT sourceChanged();
+    // The detail is built only while tracing, the URL conversion allocates
+    if (Trace::isEnabled()) {
+        Trace::instant("load", "TiledImage::setSource", source.toString());
+    }
+
+    if (isComponentComplete()) {
+        load();
+    }
+}
+
+void TiledImageItem::reload()
+{
+    if (isComponentComplete()) {
+        load();
+    }
+}
+
+void TiledImageItem::setViewport(QQuickItem *viewport)
+{
+    if (m_viewport == viewport) {
+        return;
+    }
+    m_viewport = viewport;
+    Q_EMIT viewportChanged();
+    update();
+}
+
+void TiledImageItem::setDecodeFullResolution(bool decodeFullResolution)
+{
+    if (m_decodeFullResolution == decodeFullResolution) {
+        return;
+    }
+    m_decodeFullResolution = decodeFullResolution;
+    Q_EMIT decodeFullResolutionChanged();
+
+    // An image that is still loading is refined once ready
+    if (m_decodeFullResolution && isComponentComplete()) {
+        requestRefinement();
+    }
+}
+
+void TiledImageItem::componentComplete()
+{
+    QQuickItem::componentComplete();
+    load();
+}
+
+void TiledImageItem::geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChange(newGeometry, oldGeometry);
+    if (newGeometry.size() != oldGeometry.size()) {
+        Q_EMIT paintedGeometryChanged();
+        update();
+    }
+}
+
+void TiledImageItem::load()
+{
+    cancelPendingResponse();
+    ++m_loadSerial;
+    m_refinementRequested = false;
+
+    if (m_source.isEmpty()) {
+        setLevels({}, {}, false, nullptr);
+        setStatus(Null);
+        return;
+    }
+
+    if (!provider()) {
+        qWarning() << "TiledImage: image provider \"hdr\" is not registered";
+        setStatus(Error);
+        return;
+    }
+
+    // The previous image stays on screen until the new one is ready
+    setStatus(Loading);
+
+    // Decode for the pixels the item covers, zooming in past them requests the full resolution
+    QSize viewportSize;
+    if (!m_decodeFullResolution && window() && width() > 0 && height() > 0) {
+        viewportSize = (size() * window()->effectiveDevicePixelRatio()).toSize();
+    }
+    requestResponse(viewportSize);
+
+    startPreview(ImageDecoder::toLocalPath(m_source.toString()));
+}
+
+void TiledImageItem::requestRefinement()
+{
+    if (m_status != Ready || m_fullResolution || m_response || m_source.isEmpty() || !provider()) {
+        return;
+    }
+
+    qDebug() << "TiledImage: refining" << m_source << "to full resolution";
+    m_refining = true;
+    requestResponse(QSize());
+}
+
+void TiledImageItem::requestResponse(const QSize &requestedSize)
+{
+    const QString id = ImageProvider::idForSource(m_source, m_consumerId);
+    m_response = provider()->requestImageResponse(id, requestedSize);
+    connect(m_response, &QQuickImageResponse::finished, this, [this, response = m_response]() {
+        handleResponseFinished(response);
+    });
+}
+
+QQuickAsyncImageProvider *TiledImageItem::provider() const
+{
+    auto engine = qmlEngine(this);
+    return engine ? dynamic_cast<QQuickAsyncImageProvider *>(engine->imageProvider(QStringLiteral("hdr"))) : nullptr;
+}
+
+void TiledImageItem::startPreview(const QString &localPath)
+{
+    // Decoded and prefetched images are shown right away, small files decode quickly enough
+    if (DecodedImageCache::instance().contains(localPath) || QFileInfo(localPath).size() < PREVIEW_MIN_FILE_SIZE) {
+        return;
+    }
+
+    // No need for more pixels than the item covers on screen before zooming in
+    int maxEdge = PREVIEW_DEFAULT_EDGE;
+    if (window() && width() > 0 && height() > 0) {
+        maxEdge = static_cast<int>(std::ceil(std::max(width(), height()) * window()->effectiveDevicePixelRatio()));
+    }
+
+    auto watcher = new QFutureWatcher<PreviewFrame>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, loadSerial = m_loadSerial]() {
+        watcher->deleteLater();
+        handlePreviewFinished(loadSerial, watcher->result());
+    });
+    watcher->setFuture(QtConcurrent::run([localPath, maxEdge]() {
+        return ImageDecoder::decodePreview(localPath, maxEdge);
+    }));
+}
+
+void TiledImageItem::handlePreviewFinished(quint64 loadSerial, const PreviewFrame &preview)
+{
+    // Stale, or the full image was faster
+    if (loadSerial != m_loadSerial || m_status != Loading || preview.isNull()) {
+        return;
+    }
+    if (Trace::isEnabled()) {
+        Trace::instant("load", "Preview ready", m_source.toString());
+    }
+    setLevels({preview.image}, preview.fullSize, true, preview.memory);
+}
+
+void TiledImageItem::cancelPendingResponse()
+{
+    if (!m_response) {
+        return;
+    }
+
+    // A cancelled response still emits finished(), it deletes itself then
+    disconnect(m_response, nullptr, this, nullptr);
+    connect(m_response, &QQuickImageResponse::finished, m_response, &QObject::deleteLater);
+    m_response->cancel();
+    m_response = nullptr;
+    m_refining = false;
+}
+
+void TiledImageItem::handleResponseFinished(QQuickImageResponse *response)
+{
+    response->deleteLater();
+    if (response != m_response) {
+        return;
+    }
+    m_response = nullptr;
+    const bool refinement = std::exchange(m_refining, false);
+
+    QList<QImage> levels;
+    QSize sourceSize;
+    bool fullResolution = true;
+    std::shared_ptr<MemoryBudget::Reservation> memory;
+    if (auto imageResponse = qobject_cast<ImageResponse *>(response)) {
+        const DecodedFrame &frame = imageResponse->frame();
+        levels = frame.levels;
+        sourceSize = frame.fullSize;
+        fullResolution = frame.isFullResolution();
+        memory = frame.memory;
+    } else if (response->errorString().isEmpty()) {
+        // Foreign provider without a pyramid, show the full image only
+        std::unique_ptr<QQuickTextureFactory> factory(response->textureFactory());
+        if (factory && !factory->image().isNull()) {
+            levels = {factory->image()};
+            sourceSize = levels.first().size();
+        }
+    }
+
+    if (refinement) {
+        // The viewport sized levels stay when the full resolution does not fit or fails
+        if (levels.isEmpty()) {
+            qWarning() << "TiledImage: failed to refine" << m_source << "-" << response->errorString();
+        } else {
+            setLevels(levels, sourceSize, false, std::move(memory), fullResolution);
+        }
+        return;
+    }
+
+    setLevels(levels, sourceSize, false, std::move(memory), fullResolution);
+
+    if (m_levels.isEmpty()) {
+        qWarning() << "TiledImage: failed to load" << m_source << "-" << response->errorString();
+        setStatus(Error);
+    } else {
+        setStatus(Ready);
+        traceFirstFrame();
+        if (m_decodeFullResolution) {
+            requestRefinement();
+        }
+    }
+}
+
+void TiledImageItem::traceFirstFrame()
+{
+    if (!Trace::isEnabled() || !window()) {
+        return;
+    }
+
+    // Emitted on the render thread once the frame with the new tiles is on screen
+    const QString source = m_source.toString();
+    auto connection = std::make_shared<QMetaObject::Connection>();
+    *connection = connect(window(), &QQuickWindow::frameSwapped, window(), [connection, source]() {
+        QObject::disconnect(*connection);
+        Trace::instant("load", "First frame", source);
+        Trace::asyncEnd("load", "Load image", Trace::id(source));
+    }, Qt::DirectConnection);
+}
+
+void TiledImageItem::setLevels(const QList<QImage> &levels, const QSize &sourceSize, bool preview,
+                               std::shared_ptr<MemoryBudget::Reservation> memory, bool fullResolution)
+{
+    m_levels = levels;
+    m_memory = std::move(memory);
+    m_fullResolution = fullResolution;
+    ++m_imageSerial;
+
+    if (m_sourceSize != sourceSize) {
+        m_sourceSize = sourceSize;
+        Q_EMIT sourceSizeChanged();
+        Q_EMIT paintedGeometryChanged();
+    }
+    if (m_preview != preview) {
+        m_preview = preview;
+        Q_EMIT previewChanged();
+    }
+    update();
+}
+
+void TiledImageItem::setStatus(Status status)
+{
+    if (m_status == status) {
+        return;
+    }
+    m_status = status;
+    Q_EMIT statusChanged();
+}
+
+QRectF TiledImageItem::paintedRect() const
+{
+    const QSize imageSize = sourceSize();
+    if (imageSize.isEmpty() || width() <= 0 || height() <= 0) {
+        return {};
+    }
+
+    // PreserveAspectFit, centered in the item
+    const QSizeF painted = QSizeF(imageSize).scaled(size(), Qt::KeepAspectRatio);
+    return QRectF(QPointF((width() - painted.width()) / 2, (height() - painted.height()) / 2), painted);
+}
+
+int TiledImageItem::levelForScale(qreal imageToDevice) const
+{
+    // Coarsest level that still provides at least one texel per device pixel
+    int level = 0;
+    while (level + 1 < m_levels.size() && imageToDevice * (1 << (level + 1)) <= 1.0) {
+        ++level;
+    }
+    return level;
+}
+
+QSGNode *TiledImageItem::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData * /*data*/)
+{
+    auto node = static_cast<TiledImageNode *>(oldNode);
+    const QRectF painted = paintedRect();
+
+    if (m_levels.isEmpty() || painted.isEmpty() || !window()) {
+        delete node;
+        return nullptr;
+    }
+
+    TraceSpan span("render", "TiledImage::updatePaintNode");
+
+    if (!node) {
+        node = new TiledImageNode;
+    }
+    if (node->imageSerial != m_imageSerial) {
+        node->clear();
+        node->imageSerial = m_imageSerial;
+    }
+
+    const auto filtering = smooth() ? QSGTexture::Linear : QSGTexture::Nearest;
+
+    if (!node->background) {
+        node->background = createTextureNode(window(), m_levels.last());
+        node->prependChildNode(node->background);
+    }
+    node->background->setRect(painted);
+    node->background->setFiltering(filtering);
+
+    const QSize fullSize = m_levels.first().size();
+    const qreal itemToDevice = mapRectToScene(QRectF(0, 0, 1, 1)).width() * window()->effectiveDevicePixelRatio();
+    const qreal imageToDevice = painted.width() / fullSize.width() * itemToDevice;
+    const int level = levelForScale(imageToDevice);
+
+    // Level 0 is magnified: a viewport sized decode no longer has enough pixels
+    if (imageToDevice > REFINEMENT_SCALE && !m_fullResolution && !m_preview && !m_refinementRequested && m_status == Ready) {
+        m_refinementRequested = true;
+        QMetaObject::invokeMethod(this, &TiledImageItem::requestRefinement, Qt::QueuedConnection);
+    }
+    const QImage &levelImage = m_levels[level];
+
+    QRectF visible = boundingRect();
+    if (m_viewport) {
+        visible = visible.intersected(mapRectFromItem(m_viewport, m_viewport->boundingRect()));
+    }
+    visible = visible.intersected(painted);
+
+    // Item coordinates <-> level pixel coordinates
+    const qreal scaleX = levelImage.width() / painted.width();
+    const qreal scaleY = levelImage.height() / painted.height();
+    const int columns = (levelImage.width() + TILE_SIZE - 1) / TILE_SIZE;
+    const int rows = (levelImage.height() + TILE_SIZE - 1) / TILE_SIZE;
+
+    std::unordered_set<quint64> wanted;
+    std::vector<std::pair<qreal, QPoint>> missing;
+
+    // A preview is small enough to be shown by the background node alone
+    if (!visible.isEmpty() && !m_preview) {
+        const int firstColumn = std::max(0, int((visible.left() - painted.left()) * scaleX) / TILE_SIZE - TILE_MARGIN);
+        const int lastColumn = std::min(columns - 1, int((visible.right() - painted.left()) * scaleX) / TILE_SIZE + TILE_MARGIN);
+        const int firstRow = std::max(0, int((visible.top() - painted.top()) * scaleY) / TILE_SIZE - TILE_MARGIN);
+        const int lastRow = std::min(rows - 1, int((visible.bottom() - painted.top()) * scaleY) / TILE_SIZE + TILE_MARGIN);
+        const QPointF center = visible.center() - painted.topLeft();
+
+        for (int row = firstRow; row <= lastRow; ++row) {
+            for (int column = firstColumn; column <= lastColumn; ++column) {
+                const quint64 key = tileKey(level, column, row);
+                wanted.insert(key);
+                if (node->tiles.find(key) == node->tiles.end()) {
+                    const QPointF tileCenter((column + 0.5) * TILE_SIZE / scaleX, (row + 0.5) * TILE_SIZE / scaleY);
+                    const QPointF delta = tileCenter - center;
+                    missing.push_back({QPointF::dotProduct(delta, delta), QPoint(column, row)});
+                }
+            }
+        }
+    }
+
+    // Evict everything outside the wanted set, including tiles of other levels
+    for (auto it = node->tiles.begin(); it != node->tiles.end();) {
+        if (wanted.contains(it->first)) {
+            ++it;
+            continue;
+        }
+        node->removeChildNode(it->second);
+        delete it->second;
+        it = node->tiles.erase(it);
+    }
+
+    // Upload the tiles closest to the viewport center first
+    std::sort(missing.begin(), missing.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    const int uploads = std::min<int>(missing.size(), MAX_TILE_UPLOADS_PER_FRAME);
+    const auto uploadStart = std::chrono::steady_clock::now();
+    for (int i = 0; i < uploads; ++i) {
+        const QPoint tile = missing[i].second;
+        const QRect levelRect = QRect(tile.x() * TILE_SIZE, tile.y() * TILE_SIZE, TILE_SIZE, TILE_SIZE)
+                                    .intersected(levelImage.rect());
+        auto tileNode = createTextureNode(window(), levelImage.copy(levelRect));
+        tileNode->setRect(QRectF(painted.left() + levelRect.x() / scaleX,
+                                 painted.top() + levelRect.y() / scaleY,
+                                 levelRect.width() / scaleX,
+                                 levelRect.height() / scaleY));
+        node->appendChildNode(tileNode);
+        node->tiles.emplace(tileKey(level, tile.x(), tile.y()), tileNode);
+    }
+
+    for (auto &[key, tile] : node->tiles) {
+        tile->setFiltering(filtering);
+    }
+
+    if (uploads < static_cast<int>(missing.size())) {
+        update();
+    }
+    if (uploads > 0) {
+        auto &metrics = Metrics::instance();
+        metrics.textureUploadTime.record(std::chrono::steady_clock::now() - uploadStart);
+        metrics.tilesUploaded.add(uploads);
+        if (Trace::isEnabled()) {
+            span.setDetail(QStringLiteral("%1 tile uploads").arg(uploads));
+        }
+    }
+
+    return node;
+}
+
+#include "moc_tiled_image_item.cpp"
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+#include <QPointer>
+#include <QQmlEngine>
+#include <QQuickItem>
+#include <QSize>
+#include <QUrl>
+
+#include <memory>
+
+#include "memory_budget.h"
+
+class QQuickAsyncImageProvider;
+class QQuickImageResponse;
+struct PreviewFrame;
+
+// Displays an image as a tree of texture tiles. Only tiles that intersect the viewport are
+// resident, at the pyramid level matching the current on-screen scale, so texture memory and
+// upload time follow the viewport size instead of the image size.
+class TiledImageItem : public QQuickItem
+{
+    Q_OBJECT
+    QML_NAMED_ELEMENT(TiledImage)
+
+    Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged)
+    Q_PROPERTY(Status status READ status NOTIFY statusChanged)
+    Q_PROPERTY(QSize sourceSize READ sourceSize NOTIFY sourceSizeChanged)
+    // True while an embedded preview stands in for the image that is still decoding
+    Q_PROPERTY(bool preview READ isPreview NOTIFY previewChanged)
+    Q_PROPERTY(qreal paintedWidth READ paintedWidth NOTIFY paintedGeometryChanged)
+    Q_PROPERTY(qreal paintedHeight READ paintedHeight NOTIFY paintedGeometryChanged)
+    Q_PROPERTY(QQuickItem *viewport READ viewport WRITE setViewport NOTIFY viewportChanged)
+    // Decodes the full resolution right away instead of the viewport size first, e.g. for a frame that is
+    // pinned for comparison and must not need a refinement when the view zooms in while it is hidden
+    Q_PROPERTY(bool decodeFullResolution READ decodeFullResolution WRITE setDecodeFullResolution NOTIFY decodeFullResolutionChanged)
+
+public:
+    // Same values as Image.Status
+    enum Status {
+        Null,
+        Ready,
+        Loading,
+        Error
+    };
+    Q_ENUM(Status)
+
+    explicit TiledImageItem(QQuickItem *parent = nullptr);
+    ~TiledImageItem() override;
+
+    QUrl source() const { return m_source; }
+    void setSource(const QUrl &source);
+    // Decodes the source again after the file changed, the current image stays until the new one is ready
+    Q_INVOKABLE void reload();
+
+    Status status() const { return m_status; }
+    QSize sourceSize() const { return m_sourceSize; }
+    bool isPreview() const { return m_preview; }
+    qreal paintedWidth() const { return paintedRect().width(); }
+    qreal paintedHeight() const { return paintedRect().height(); }
+
+    // Item whose bounds limit the visible area, typically the enclosing Flickable
+    QQuickItem *viewport() const { return m_viewport; }
+    void setViewport(QQuickItem *viewport);
+
+    bool decodeFullResolution() const { return m_decodeFullResolution; }
+    void setDecodeFullResolution(bool decodeFullResolution);
+
+Q_SIGNALS:
+    void sourceChanged();
+    void statusChanged();
+    void sourceSizeChanged();
+    void previewChanged();
+    void paintedGeometryChanged();
+    void viewportChanged();
+    void decodeFullResolutionChanged();
+
+protected:
+    void componentComplete() override;
+    void geometryChange(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
+
+private:
+    void load();
+    // Replaces a viewport sized decode by the full resolution once the view zooms past it
+    void requestRefinement();
+    void requestResponse(const QSize &requestedSize);
+    QQuickAsyncImageProvider *provider() const;
+    void cancelPendingResponse();
+    void handleResponseFinished(QQuickImageResponse *response);
+    void startPreview(const QString &localPath);
+    void handlePreviewFinished(quint64 loadSerial, const PreviewFrame &preview);
+    void setLevels(const QList<QImage> &levels, const QSize &sourceSize, bool preview,
+                   std::shared_ptr<MemoryBudget::Reservation> memory, bool fullResolution = true);
+    void setStatus(Status status);
+    // Ends the "Load image" trace span at the first frame that shows the decoded image
+    void traceFirstFrame();
+
+    QRectF paintedRect() const;
+    int levelForScale(qreal imageToDevice) const;
+
+    QUrl m_source;
+    // Only this item's own newer requests supersede its pending decode, not those of other items
+    const quint64 m_consumerId;
+    Status m_status = Null;
+    QPointer<QQuickItem> m_viewport;
+    QQuickImageResponse *m_response = nullptr;
+
+    // Pyramid built by the decode pipeline: level 0 is the full resolution image,
+    // every further level halves both dimensions
+    QList<QImage> m_levels;
+    // Bumped whenever m_levels is replaced so that the render thread drops stale tiles
+    quint64 m_imageSerial = 0;
+    // Keeps the levels counted against the budget for as long as they are shown
+    std::shared_ptr<MemoryBudget::Reservation> m_memory;
+    // Size of the full image; a preview reports it too, so the layout does not change when it is replaced
+    QSize m_sourceSize;
+    bool m_preview = false;
+    // Level 0 is smaller than m_sourceSize until the refinement arrives
+    bool m_fullResolution = true;
+    bool m_refinementRequested = false;
+    bool m_decodeFullResolution = false;
+    // Set while the pending response is a refinement, the current levels stay Ready meanwhile
+    bool m_refining = false;
+    // Bumped by every load() so that previews of earlier sources are dropped
+    quint64 m_loadSerial = 0;
+};
@@ -0,0 +1,464 @@
+#include "tone_mapper.h"
+#include "trace.h"
+
+#include <QColorSpace>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+    using Isa = ToneMapper::Isa;
+
+    // Output rows per parallel work item
+    constexpr int ROWS_PER_BAND = 32;
+
+    // Linear -> sRGB code value lookup indexed by the float bit pattern, like the pyramid's encode table:
+    // 13 octaves below 1.0 reach under half an 8 bit code, 8 mantissa bits keep neighbouring buckets
+    // well within one code of each other
+    constexpr int ENCODE_MANTISSA_BITS = 8;
+    constexpr int ENCODE_EXPONENT_RANGE = 13;
+    constexpr int ENCODE_TABLE_SIZE = ENCODE_EXPONENT_RANGE << ENCODE_MANTISSA_BITS;
+    constexpr int ENCODE_BIAS = (127 - ENCODE_EXPONENT_RANGE) << ENCODE_MANTISSA_BITS;
+
+    // Linear light to BT.709 / sRGB primaries, row major
+    using Matrix = std::array<float, 9>;
+    constexpr Matrix BT2020_TO_BT709 = {
+        1.660491f, -0.587641f, -0.072850f,
+        -0.124550f, 1.132900f, -0.008349f,
+        -0.018151f, -0.100579f, 1.118730f,
+    };
+    constexpr Matrix DISPLAY_P3_TO_BT709 = {
+        1.224940f, -0.224940f, 0.0f,
+        -0.042057f, 1.042057f, 0.0f,
+        -0.019638f, -0.078636f, 1.098274f,
+    };
+    constexpr Matrix IDENTITY = {
+        1.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 1.0f,
+    };
+
+    struct Tables {
+        // 16 bit PQ code value to linear light, 1.0 = reference white
+        std::vector<float> eotf;
+        // 32 bit entries so that AVX2 can gather them
+        std::vector<qint32> encode;
+    };
+
+    Tables makeTables()
+    {
+        // SMPTE ST 2084
+        constexpr double m1 = 2610.0 / 16384.0;
+        constexpr double m2 = 2523.0 / 4096.0 * 128.0;
+        constexpr double c1 = 3424.0 / 4096.0;
+        constexpr double c2 = 2413.0 / 4096.0 * 32.0;
+        constexpr double c3 = 2392.0 / 4096.0 * 32.0;
+
+        Tables tables;
+        tables.eotf.resize(65536);
+        for (int i = 0; i < 65536; ++i) {
+            const double p = std::pow(i / 65535.0, 1.0 / m2);
+            const double linear = std::pow(std::max(p - c1, 0.0) / (c2 - c3 * p), 1.0 / m1);
+            tables.eotf[i] = static_cast<float>(linear * 10'000.0 / ToneMapper::REFERENCE_WHITE_NITS);
+        }
+
+        tables.encode.resize(ENCODE_TABLE_SIZE);
+        for (int i = 0; i < ENCODE_TABLE_SIZE; ++i) {
+            // Center of the bucket
+            const int exponent = (i >> ENCODE_MANTISSA_BITS) - ENCODE_EXPONENT_RANGE;
+            const double mantissa = 1.0 + ((i & ((1 << ENCODE_MANTISSA_BITS) - 1)) + 0.5) / (1 << ENCODE_MANTISSA_BITS);
+            const double linear = std::ldexp(mantissa, exponent);
+            const double code = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+            tables.encode[i] = static_cast<qint32>(std::clamp(std::lround(code * 255.0), 0L, 255L));
+        }
+        return tables;
+    }
+
+    const Tables &tables()
+    {
+        static const Tables toneMappingTables = makeTables();
+        return toneMappingTables;
+    }
+
+    struct Params {
+        Matrix matrix;
+        // Content peak relative to the reference white, mapped to SDR white
+        float peak;
+        float inversePeakSquared;
+    };
+
+    // Planar linear light of one row, so that the vector kernels load whole registers per channel
+    struct RowBuffers {
+        explicit RowBuffers(int width)
+            : r(width)
+            , g(width)
+            , b(width)
+        {
+        }
+
+        std::vector<float> r;
+        std::vector<float> g;
+        std::vector<float> b;
+    };
+
+    // Extended Reinhard on the largest channel; the others are scaled by the same factor so that
+    // highlights keep their hue instead of shifting towards the primaries
+    inline float toneScale(float largest, const Params &params)
+    {
+        const float clipped = std::min(largest, params.peak);
+        const float mapped = clipped * (1.0f + clipped * params.inversePeakSquared) / (1.0f + clipped);
+        return largest > 0.0f ? mapped / largest : 0.0f;
+    }
+
+    inline int encodeIndex(float linear)
+    {
+        // Negative values have the sign bit set and end up in the first bucket, 1.0 and above in the last
+        const qint32 bits = std::bit_cast<qint32>(linear);
+        return std::clamp((bits >> (23 - ENCODE_MANTISSA_BITS)) - ENCODE_BIAS, 0, ENCODE_TABLE_SIZE - 1);
+    }
+
+    inline uchar premultiply(qint32 code, qint32 alpha)
+    {
+        // Rounds like the vector kernels
+        return static_cast<uchar>(std::lrint(float(code * alpha) * (1.0f / 255.0f)));
+    }
+
+    void decodeRow(const quint16 *src, int from, int to, const float *eotf, RowBuffers &row)
+    {
+        for (int x = from; x < to; ++x) {
+            row.r[x] = eotf[src[4 * x]];
+            row.g[x] = eotf[src[4 * x + 1]];
+            row.b[x] = eotf[src[4 * x + 2]];
+        }
+    }
+
+    void mapRowScalar(RowBuffers &row, int from, int to, const Params &params)
+    {
+        const Matrix &m = params.matrix;
+        for (int x = from; x < to; ++x) {
+            const float r = row.r[x];
+            const float g = row.g[x];
+            const float b = row.b[x];
+            // Out of gamut colors are clipped before the tone curve
+            const float r709 = std::max(m[0] * r + m[1] * g + m[2] * b, 0.0f);
+            const float g709 = std::max(m[3] * r + m[4] * g + m[5] * b, 0.0f);
+            const float b709 = std::max(m[6] * r + m[7] * g + m[8] * b, 0.0f);
+            const float scale = toneScale(std::max({r709, g709, b709}), params);
+            row.r[x] = r709 * scale;
+            row.g[x] = g709 * scale;
+            row.b[x] = b709 * scale;
+        }
+    }
+
+    void encodeRow(const RowBuffers &row, const quint16 *src, uchar *dst, int from, int to, const qint32 *encode)
+    {
+        for (int x = from; x < to; ++x) {
+            const qint32 alpha = static_cast<qint32>(std::lrint(src[4 * x + 3] * (255.0f / 65535.0f)));
+            dst[4 * x] = premultiply(encode[encodeIndex(row.r[x])], alpha);
+            dst[4 * x + 1] = premultiply(encode[encodeIndex(row.g[x])], alpha);
+            dst[4 * x + 2] = premultiply(encode[encodeIndex(row.b[x])], alpha);
+            dst[4 * x + 3] = static_cast<uchar>(alpha);
+        }
+    }
+
+#if defined(__SSE2__)
+    // Table lookups stay scalar, SSE2 has no gather
+    void mapRowSse2(RowBuffers &row, int width, const Params &params)
+    {
+        const Matrix &m = params.matrix;
+        const __m128 m0 = _mm_set1_ps(m[0]), m1 = _mm_set1_ps(m[1]), m2 = _mm_set1_ps(m[2]);
+        const __m128 m3 = _mm_set1_ps(m[3]), m4 = _mm_set1_ps(m[4]), m5 = _mm_set1_ps(m[5]);
+        const __m128 m6 = _mm_set1_ps(m[6]), m7 = _mm_set1_ps(m[7]), m8 = _mm_set1_ps(m[8]);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 peak = _mm_set1_ps(params.peak);
+        const __m128 inversePeakSquared = _mm_set1_ps(params.inversePeakSquared);
+        const __m128 smallest = _mm_set1_ps(std::numeric_limits<float>::min());
+
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            const __m128 r = _mm_loadu_ps(row.r.data() + x);
+            const __m128 g = _mm_loadu_ps(row.g.data() + x);
+            const __m128 b = _mm_loadu_ps(row.b.data() + x);
+            const __m128 r709 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, r), _mm_mul_ps(m1, g)), _mm_mul_ps(m2, b)), zero);
+            const __m128 g709 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m3, r), _mm_mul_ps(m4, g)), _mm_mul_ps(m5, b)), zero);
+            const __m128 b709 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m6, r), _mm_mul_ps(m7, g)), _mm_mul_ps(m8, b)), zero);
+
+            const __m128 largest = _mm_max_ps(_mm_max_ps(r709, g709), b709);
+            const __m128 clipped = _mm_min_ps(largest, peak);
+            const __m128 mapped = _mm_div_ps(_mm_mul_ps(clipped, _mm_add_ps(one, _mm_mul_ps(clipped, inversePeakSquared))),
+                                             _mm_add_ps(one, clipped));
+            // Black stays black: mapped is 0 there as well
+            const __m128 scale = _mm_div_ps(mapped, _mm_max_ps(largest, smallest));
+
+            _mm_storeu_ps(row.r.data() + x, _mm_mul_ps(r709, scale));
+            _mm_storeu_ps(row.g.data() + x, _mm_mul_ps(g709, scale));
+            _mm_storeu_ps(row.b.data() + x, _mm_mul_ps(b709, scale));
+        }
+        mapRowScalar(row, x, width, params);
+    }
+
+    // Encoding table lookup and premultiplication of eight values of one channel
+    __attribute__((target("avx2,fma")))
+    inline __m256i encodeAvx2(__m256 linear, __m256 alpha, const int *encode)
+    {
+        const __m256i index = _mm256_min_epi32(
+            _mm256_max_epi32(_mm256_sub_epi32(_mm256_srai_epi32(_mm256_castps_si256(linear), 23 - ENCODE_MANTISSA_BITS),
+                                              _mm256_set1_epi32(ENCODE_BIAS)),
+                             _mm256_setzero_si256()),
+            _mm256_set1_epi32(ENCODE_TABLE_SIZE - 1));
+        const __m256 code = _mm256_cvtepi32_ps(_mm256_i32gather_epi32(encode, index, 4));
+        return _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(code, alpha), _mm256_set1_ps(1.0f / 255.0f)));
+    }
+
+    // Whole row in registers: the channels are gathered straight from the interleaved pixels, the
+    // EOTF and the encoding tables with hardware gathers. Compiled for AVX2 only, picked at runtime.
+    __attribute__((target("avx2,fma")))
+    void toneMapRowAvx2(const quint16 *src, uchar *dst, int width, const Tables &tables, const Params &params, RowBuffers &row)
+    {
+        const Matrix &m = params.matrix;
+        const __m256 m0 = _mm256_set1_ps(m[0]), m1 = _mm256_set1_ps(m[1]), m2 = _mm256_set1_ps(m[2]);
+        const __m256 m3 = _mm256_set1_ps(m[3]), m4 = _mm256_set1_ps(m[4]), m5 = _mm256_set1_ps(m[5]);
+        const __m256 m6 = _mm256_set1_ps(m[6]), m7 = _mm256_set1_ps(m[7]), m8 = _mm256_set1_ps(m[8]);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 peak = _mm256_set1_ps(params.peak);
+        const __m256 inversePeakSquared = _mm256_set1_ps(params.inversePeakSquared);
+        const __m256 smallest = _mm256_set1_ps(std::numeric_limits<float>::min());
+        const __m256 alphaScale = _mm256_set1_ps(255.0f / 65535.0f);
+        const __m256i lowHalf = _mm256_set1_epi32(0xffff);
+        // Byte offsets of eight RGBA64 pixels
+        const __m256i pixelOffsets = _mm256_setr_epi32(0, 8, 16, 24, 32, 40, 48, 56);
+        const __m256i blueOffsets = _mm256_add_epi32(pixelOffsets, _mm256_set1_epi32(4));
+        const float *eotf = tables.eotf.data();
+        const int *encode = tables.encode.data();
+
+        int x = 0;
+        for (; x + 8 <= width; x += 8) {
+            // Red and green of each pixel in one 32 bit lane, blue and alpha in another
+            const auto pixels = reinterpret_cast<const int *>(src + 4 * x);
+            const __m256i redGreen = _mm256_i32gather_epi32(pixels, pixelOffsets, 1);
+            const __m256i blueAlpha = _mm256_i32gather_epi32(pixels, blueOffsets, 1);
+
+            const __m256 r = _mm256_i32gather_ps(eotf, _mm256_and_si256(redGreen, lowHalf), 4);
+            const __m256 g = _mm256_i32gather_ps(eotf, _mm256_srli_epi32(redGreen, 16), 4);
+            const __m256 b = _mm256_i32gather_ps(eotf, _mm256_and_si256(blueAlpha, lowHalf), 4);
+            const __m256 alpha = _mm256_round_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(blueAlpha, 16)), alphaScale),
+                                                 _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+            const __m256 r709 = _mm256_max_ps(_mm256_fmadd_ps(m0, r, _mm256_fmadd_ps(m1, g, _mm256_mul_ps(m2, b))), zero);
+            const __m256 g709 = _mm256_max_ps(_mm256_fmadd_ps(m3, r, _mm256_fmadd_ps(m4, g, _mm256_mul_ps(m5, b))), zero);
+            const __m256 b709 = _mm256_max_ps(_mm256_fmadd_ps(m6, r, _mm256_fmadd_ps(m7, g, _mm256_mul_ps(m8, b))), zero);
+
+            const __m256 largest = _mm256_max_ps(_mm256_max_ps(r709, g709), b709);
+            const __m256 clipped = _mm256_min_ps(largest, peak);
+            const __m256 mapped = _mm256_div_ps(_mm256_mul_ps(clipped, _mm256_fmadd_ps(clipped, inversePeakSquared, one)),
+                                                _mm256_add_ps(one, clipped));
+            const __m256 scale = _mm256_div_ps(mapped, _mm256_max_ps(largest, smallest));
+
+            const __m256i red = encodeAvx2(_mm256_mul_ps(r709, scale), alpha, encode);
+            const __m256i green = encodeAvx2(_mm256_mul_ps(g709, scale), alpha, encode);
+            const __m256i blue = encodeAvx2(_mm256_mul_ps(b709, scale), alpha, encode);
+            const __m256i packed = _mm256_or_si256(
+                _mm256_or_si256(red, _mm256_slli_epi32(green, 8)),
+                _mm256_or_si256(_mm256_slli_epi32(blue, 16), _mm256_slli_epi32(_mm256_cvtps_epi32(alpha), 24)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * x), packed);
+        }
+
+        decodeRow(src, x, width, eotf, row);
+        mapRowScalar(row, x, width, params);
+        encodeRow(row, src, dst, x, width, encode);
+    }
+#elif defined(__aarch64__)
+    // Table lookups stay scalar, NEON has no gather
+    void mapRowNeon(RowBuffers &row, int width, const Params &params)
+    {
+        const Matrix &m = params.matrix;
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        const float32x4_t peak = vdupq_n_f32(params.peak);
+        const float32x4_t smallest = vdupq_n_f32(std::numeric_limits<float>::min());
+
+        int x = 0;
+        for (; x + 4 <= width; x += 4) {
+            const float32x4_t r = vld1q_f32(row.r.data() + x);
+            const float32x4_t g = vld1q_f32(row.g.data() + x);
+            const float32x4_t b = vld1q_f32(row.b.data() + x);
+            const float32x4_t r709 = vmaxq_f32(vfmaq_n_f32(vfmaq_n_f32(vmulq_n_f32(r, m[0]), g, m[1]), b, m[2]), zero);
+            const float32x4_t g709 = vmaxq_f32(vfmaq_n_f32(vfmaq_n_f32(vmulq_n_f32(r, m[3]), g, m[4]), b, m[5]), zero);
+            const float32x4_t b709 = vmaxq_f32(vfmaq_n_f32(vfmaq_n_f32(vmulq_n_f32(r, m[6]), g, m[7]), b, m[8]), zero);
+
+            const float32x4_t largest = vmaxq_f32(vmaxq_f32(r709, g709), b709);
+            const float32x4_t clipped = vminq_f32(largest, peak);
+            const float32x4_t mapped = vdivq_f32(vmulq_f32(clipped, vfmaq_n_f32(one, clipped, params.inversePeakSquared)),
+                                                 vaddq_f32(one, clipped));
+            const float32x4_t scale = vdivq_f32(mapped, vmaxq_f32(largest, smallest));
+
+            vst1q_f32(row.r.data() + x, vmulq_f32(r709, scale));
+            vst1q_f32(row.g.data() + x, vmulq_f32(g709, scale));
+            vst1q_f32(row.b.data() + x, vmulq_f32(b709, scale));
+        }
+        mapRowScalar(row, x, width, params);
+    }
+#endif
+
+    void toneMapRow(const quint16 *src, uchar *dst, int width, Isa isa, const Tables &tables, const Params &params, RowBuffers &row)
+    {
+        switch (isa) {
+#if defined(__SSE2__)
+        case Isa::AVX2:
+            toneMapRowAvx2(src, dst, width, tables, params, row);
+            return;
+        case Isa::SSE2:
+            decodeRow(src, 0, width, tables.eotf.data(), row);
+            mapRowSse2(row, width, params);
+            encodeRow(row, src, dst, 0, width, tables.encode.data());
+            return;
+#elif defined(__aarch64__)
+        case Isa::NEON:
+            decodeRow(src, 0, width, tables.eotf.data(), row);
+            mapRowNeon(row, width, params);
+            encodeRow(row, src, dst, 0, width, tables.encode.data());
+            return;
+#endif
+        default:
+            decodeRow(src, 0, width, tables.eotf.data(), row);
+            mapRowScalar(row, 0, width, params);
+            encodeRow(row, src, dst, 0, width, tables.encode.data());
+            return;
+        }
+    }
+}
+
+void ToneMapper::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+QImage ToneMapper::toneMapPQToSRGB(const QImage &image, FileDetector::ColorPrimaries primaries, Isa isa)
+{
+    if (image.isNull()) {
+        return {};
+    }
+
+    TraceSpan span("decode", "ToneMapper::toneMapPQToSRGB");
+    if (Trace::isEnabled()) {
+        span.setDetail(QString::fromLatin1(isaName(isa)));
+    }
+
+    // 16 bit code values index the EOTF table directly. Other formats are converted one band at a
+    // time, a converted copy of the whole image would not be part of the decode's memory reservation.
+    const bool rgba64 = image.format() == QImage::Format_RGBA64 || image.format() == QImage::Format_RGBX64;
+    QImage dst(image.size(), QImage::Format_RGBA8888_Premultiplied);
+    if (dst.isNull()) {
+        return {};
+    }
+    dst.setColorSpace(QColorSpace::SRgb);
+
+    Params params;
+    switch (primaries) {
+    case FileDetector::ColorPrimaries::BT709:
+        params.matrix = IDENTITY;
+        break;
+    case FileDetector::ColorPrimaries::DisplayP3:
+        params.matrix = DISPLAY_P3_TO_BT709;
+        break;
+    default:
+        // PQ content without other information is BT.2020, like the description set for PQ surfaces
+        params.matrix = BT2020_TO_BT709;
+        break;
+    }
+    params.peak = static_cast<float>(CONTENT_PEAK_NITS / REFERENCE_WHITE_NITS);
+    params.inversePeakSquared = 1.0f / (params.peak * params.peak);
+
+    const Tables &lookup = tables();
+    const int width = image.width();
+    // Detach once here, QImage::scanLine() is not safe to call from several threads
+    uchar *dstBits = dst.bits();
+    const qsizetype dstBytesPerLine = dst.bytesPerLine();
+    const uchar *srcBits = image.constBits();
+    const qsizetype srcBytesPerLine = image.bytesPerLine();
+
+    std::vector<std::pair<int, int>> bands;
+    for (int row = 0; row < dst.height(); row += ROWS_PER_BAND) {
+        bands.emplace_back(row, std::min(row + ROWS_PER_BAND, dst.height()));
+    }
+    std::atomic_bool failed = false;
+    QtConcurrent::blockingMap(bands, [&](const std::pair<int, int> &band) {
+        RowBuffers row(width);
+        const uchar *bandBits = srcBits + band.first * srcBytesPerLine;
+        qsizetype bandBytesPerLine = srcBytesPerLine;
+        QImage converted;
+        if (!rgba64) {
+            converted = image.copy(0, band.first, width, band.second - band.first).convertToFormat(QImage::Format_RGBA64);
+            if (converted.isNull()) {
+                failed = true;
+                return;
+            }
+            bandBits = converted.constBits();
+            bandBytesPerLine = converted.bytesPerLine();
+        }
+        for (int y = band.first; y < band.second; ++y) {
+            toneMapRow(reinterpret_cast<const quint16 *>(bandBits + (y - band.first) * bandBytesPerLine),
+                       dstBits + y * dstBytesPerLine, width, isa, lookup, params, row);
+        }
+    });
+    if (failed) {
+        return {};
+    }
+    return dst;
+}
+
+ToneMapper::Isa ToneMapper::bestIsa()
+{
+#if defined(__SSE2__)
+    static const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return avx2 ? Isa::AVX2 : Isa::SSE2;
+#elif defined(__aarch64__)
+    return Isa::NEON;
+#else
+    return Isa::Scalar;
+#endif
+}
+
+QList<ToneMapper::Isa> ToneMapper::supportedIsas()
+{
+    QList<Isa> isas = {Isa::Scalar};
+#if defined(__SSE2__)
+    isas.append(Isa::SSE2);
+    if (bestIsa() == Isa::AVX2) {
+        isas.append(Isa::AVX2);
+    }
+#elif defined(__aarch64__)
+    isas.append(Isa::NEON);
+#endif
+    return isas;
+}
+
+const char *ToneMapper::isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::SSE2:
+        return "SSE2";
+    case Isa::AVX2:
+        return "AVX2";
+    case Isa::NEON:
+        return "NEON";
+    }
+    return "unknown";
+}
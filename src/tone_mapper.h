@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QImage>
+#include <QList>
+
+#include <atomic>
+
+#include "file_detector.h"
+
+// Fallback for compositors without the parts of color-management-v1 that PQ surfaces need (e.g.
+// mastering luminances): HDR images are tone mapped to SDR sRGB on the CPU before the pyramid is
+// built, and the window stays a plain sRGB surface. The kernels are picked at runtime, AVX2 where
+// the CPU has it, SSE2 or NEON otherwise; rows are processed in parallel.
+class ToneMapper
+{
+public:
+    enum class Isa {
+        Scalar,
+        SSE2,
+        AVX2,
+        NEON
+    };
+
+    // PQ code value of the BT.2408 reference white, mapped to a little over half of SDR white
+    static constexpr double REFERENCE_WHITE_NITS = 203.0;
+    // Mastering peak assumed for the content, highlights above it are clipped
+    static constexpr double CONTENT_PEAK_NITS = 1000.0;
+
+    // Set from the compositor's color management features, read by the decoders
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+
+    // PQ images only: HLG is made to look right on SDR displays and is shown as it is
+    static bool appliesTo(const FileDetector::ImageProbe &probe)
+    {
+        return isEnabled() && probe.transfer == FileDetector::TransferFunction::PQ;
+    }
+
+    // PQ code values in the given primaries (BT.2020 unless the probe found others) to premultiplied
+    // RGBA8888 in sRGB, the SDR texture format of ImagePyramid. Needs no memory beyond the result
+    // and a few bands of converted input.
+    static QImage toneMapPQToSRGB(const QImage &image, FileDetector::ColorPrimaries primaries, Isa isa = bestIsa());
+
+    // Fastest kernel set the CPU supports, and all of them for the benchmark
+    static Isa bestIsa();
+    static QList<Isa> supportedIsas();
+    static const char *isaName(Isa isa);
+
+private:
+    static inline std::atomic_bool s_enabled = false;
+};
@@ -0,0 +1,177 @@
+#include "trace.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+
+using namespace Qt::Literals::StringLiterals;
+
+namespace {
+    thread_local int t_threadId = -1;
+}
+
+struct Trace::State {
+    QMutex mutex;
+    QString path;
+    QElapsedTimer clock;
+    QList<Event> events;
+    // Small sequential ids instead of pthread handles, named in the metadata events
+    QHash<Qt::HANDLE, int> threadIds;
+    QList<QString> threadNames;
+};
+
+Trace::State &Trace::state()
+{
+    static State traceState;
+    return traceState;
+}
+
+void Trace::start(const QString &path)
+{
+    auto &s = state();
+    QMutexLocker locker(&s.mutex);
+    s.path = path;
+    s.events.clear();
+    s.clock.start();
+    s_enabled.store(true);
+    qDebug() << "Tracing to" << path;
+}
+
+bool Trace::stop()
+{
+    if (!isEnabled()) {
+        return true;
+    }
+    s_enabled.store(false);
+
+    auto &s = state();
+    QMutexLocker locker(&s.mutex);
+
+    QJsonArray traceEvents;
+    const qint64 pid = QCoreApplication::applicationPid();
+    for (qsizetype thread = 0; thread < s.threadNames.size(); ++thread) {
+        traceEvents.append(QJsonObject{
+            {u"ph"_s, u"M"_s},
+            {u"name"_s, u"thread_name"_s},
+            {u"pid"_s, pid},
+            {u"tid"_s, thread},
+            {u"args"_s, QJsonObject{{u"name"_s, s.threadNames[thread]}}},
+        });
+    }
+
+    for (const Event &event : std::as_const(s.events)) {
+        QJsonObject object{
+            {u"ph"_s, QString(QLatin1Char(event.phase))},
+            {u"cat"_s, QLatin1StringView(event.category)},
+            {u"name"_s, QLatin1StringView(event.name)},
+            {u"pid"_s, pid},
+            {u"tid"_s, event.thread},
+            {u"ts"_s, event.timestamp},
+        };
+        switch (event.phase) {
+            case 'X':
+                object.insert(u"dur"_s, event.duration);
+                break;
+            case 'b':
+            case 'e':
+                object.insert(u"id"_s, QString::number(event.id, 16));
+                break;
+            case 'i':
+                // Thread scoped, drawn as a marker on the emitting thread
+                object.insert(u"s"_s, u"t"_s);
+                break;
+        }
+        if (!event.detail.isEmpty()) {
+            object.insert(u"args"_s, QJsonObject{{u"detail"_s, event.detail}});
+        }
+        traceEvents.append(object);
+    }
+
+    QSaveFile file(s.path);
+    const QByteArray json = QJsonDocument(QJsonObject{
+        {u"traceEvents"_s, traceEvents},
+        {u"displayTimeUnit"_s, u"ms"_s},
+    }).toJson(QJsonDocument::Compact);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+        qWarning() << "Cannot write trace to" << s.path << "-" << file.errorString();
+        return false;
+    }
+
+    qDebug() << "Wrote" << s.events.size() << "trace events to" << s.path;
+    s.events.clear();
+    return true;
+}
+
+double Trace::now()
+{
+    return state().clock.nsecsElapsed() / 1000.0;
+}
+
+void Trace::instant(const char *category, const char *name, const QString &detail)
+{
+    if (isEnabled()) {
+        record(Event{category, name, 'i', currentThread(), now(), 0.0, 0, detail});
+    }
+}
+
+void Trace::asyncBegin(const char *category, const char *name, quint64 id, const QString &detail)
+{
+    if (isEnabled()) {
+        record(Event{category, name, 'b', currentThread(), now(), 0.0, id, detail});
+    }
+}
+
+void Trace::asyncEnd(const char *category, const char *name, quint64 id)
+{
+    if (isEnabled()) {
+        record(Event{category, name, 'e', currentThread(), now(), 0.0, id, {}});
+    }
+}
+
+void Trace::record(Event event)
+{
+    auto &s = state();
+    QMutexLocker locker(&s.mutex);
+    s.events.append(std::move(event));
+}
+
+int Trace::currentThread()
+{
+    if (t_threadId >= 0) {
+        return t_threadId;
+    }
+
+    QThread *thread = QThread::currentThread();
+    QString name = thread->objectName();
+    if (name.isEmpty()) {
+        const QCoreApplication *app = QCoreApplication::instance();
+        name = app && thread == app->thread() ? u"Main"_s : u"Worker"_s;
+    }
+
+    auto &s = state();
+    QMutexLocker locker(&s.mutex);
+    const auto it = s.threadIds.constFind(QThread::currentThreadId());
+    if (it != s.threadIds.constEnd()) {
+        t_threadId = it.value();
+    } else {
+        t_threadId = static_cast<int>(s.threadNames.size());
+        s.threadIds.insert(QThread::currentThreadId(), t_threadId);
+        s.threadNames.append(u"%1 %2"_s.arg(name).arg(t_threadId));
+    }
+    return t_threadId;
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (m_start >= 0 && Trace::isEnabled()) {
+        const double end = Trace::now();
+        Trace::record(Trace::Event{m_category, m_name, 'X', Trace::currentThread(), m_start, end - m_start, 0, std::move(m_detail)});
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <QHashFunctions>
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+#include <utility>
+
+// Collects timing events in the Chrome trace event format, written as JSON when tracing stops so
+// that it can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing. Disabled unless started
+// with --trace; a disabled span costs one relaxed atomic load. All methods are thread safe.
+class Trace
+{
+public:
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Starts recording, the events are written to path by stop()
+    static void start(const QString &path);
+    // Writes the recorded events and stops recording, returns false when the file cannot be written
+    static bool stop();
+
+    // Microseconds since start()
+    static double now();
+
+    // Marks a point in time, e.g. the first presented frame
+    static void instant(const char *category, const char *name, const QString &detail = {});
+    // Spans that start and end in different places, e.g. across event loop iterations; matched by id
+    static void asyncBegin(const char *category, const char *name, quint64 id, const QString &detail = {});
+    static void asyncEnd(const char *category, const char *name, quint64 id);
+    // Async span id for a key known at both ends, e.g. the image URL
+    static quint64 id(const QString &key) { return qHash(key); }
+
+private:
+    friend class TraceSpan;
+
+    struct Event {
+        const char *category;
+        const char *name;
+        char phase;
+        int thread;
+        double timestamp;
+        double duration;
+        quint64 id;
+        QString detail;
+    };
+
+    struct State;
+    static State &state();
+    static void record(Event event);
+    static int currentThread();
+
+    static inline std::atomic_bool s_enabled = false;
+};
+
+// Records the time from construction to destruction as a complete event on the current thread.
+// category and name must be string literals, they are stored without copying.
+class TraceSpan
+{
+public:
+    TraceSpan(const char *category, const char *name)
+        : m_category(category)
+        , m_name(name)
+        , m_start(Trace::isEnabled() ? Trace::now() : -1.0)
+    {
+    }
+
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    // Shown as the span's argument, e.g. the file being processed; ignored while tracing is disabled
+    void setDetail(const QString &detail)
+    {
+        if (m_start >= 0) {
+            m_detail = detail;
+        }
+    }
+
+private:
+    const char *m_category;
+    const char *m_name;
+    double m_start;
+    QString m_detail;
+};